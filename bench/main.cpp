@@ -0,0 +1,325 @@
+// Multi-threaded stress workloads, run against lego compositions and the system malloc.
+//
+//     g++ -std=c++17 -O2 -pthread -o lego_bench bench/main.cpp
+//     ./lego_bench [max threads] [seconds per run]
+//
+// Every workload runs with 1, 2, 4, ... up to max threads (the number of cores by default),
+// and prints the throughput and the peak RSS of each run:
+//   larson:            server-like churn. Threads free and replace random blocks, and hand
+//                      their blocks over to each other, so many frees cross threads.
+//   producer-consumer: half the threads allocate, the other half free what they get
+//                      (with 1 thread, there's still one of each).
+//   threadtest:        every thread allocates a batch of objects and frees them again.
+//   false-sharing:     every thread allocates tiny objects and writes to them. Allocators that
+//                      give neighbouring bytes to different threads make the cache lines bounce.
+//
+// Peak RSS is read from /proc/self/status, so it's only reported on Linux.
+// Allocations that fail are skipped and counted. A run that reports failures measured less work than it claims.
+// Sharded heaps also print how long their threads waited for and held the shard locks.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../lego/page_allocator.h"
+#include "../lego/freelist_allocator.h"
+#include "../lego/locked_allocator.h"
+#include "../lego/sharded_allocator.h"
+#include "../lego/thread_heap_allocator.h"
+
+using namespace lego;
+
+namespace {
+	constexpr size_t maxThreads = 128;
+
+	// The workloads only need malloc and free with the size, which is all lego wants back
+	class SystemHeap {
+	public:
+		void* allocate(size_t size) { return malloc(size); }
+		void deallocate(void* ptr, size_t) { free(ptr); }
+	};
+
+	template<class Allocator>
+	class LegoHeap {
+		Allocator allocator;
+	public:
+		void* allocate(size_t size) { return allocator.allocate(size, alignof(max_align_t)).ptr; }
+		// Like free(), so that workloads can hand back failed allocations as they are
+		void deallocate(void* ptr, size_t size) {
+			if (ptr != nullptr)
+				allocator.deallocate({ ptr, size });
+		}
+		const Allocator& get() const { return allocator; }
+	};
+
+	using LockedFreeList = LegoHeap<LockedAllocator<FreeListAllocator<1024 * 1024 * 1024, PageAllocator, detail::FirstFitStrategy>>>;
+	using ShardedFreeList = LegoHeap<ShardedAllocator<16, FreeListAllocator<64 * 1024 * 1024, PageAllocator, detail::FirstFitStrategy>>>;
+	using ThreadHeaps = LegoHeap<ThreadHeapAllocator<maxThreads, FreeListAllocator<16 * 1024 * 1024, PageAllocator, detail::FirstFitStrategy>>>;
+
+	struct Block {
+		void* ptr;
+		size_t size;
+	};
+
+	// Allocations that came back empty in the current run
+	std::atomic<size_t> failures = { 0 };
+
+	template<class Heap>
+	void* allocateOrCount(Heap& heap, size_t size) {
+		void* ret = heap.allocate(size);
+		if (ret == nullptr)
+			failures.fetch_add(1, std::memory_order_relaxed);
+		return ret;
+	}
+
+	// Peak RSS since the last reset, in bytes. 0 if we can't tell.
+	void resetPeakRss() {
+		// Writing 5 to clear_refs resets VmHWM
+		std::ofstream file("/proc/self/clear_refs");
+		if (file)
+			file << "5";
+	}
+
+	size_t peakRss() {
+		std::ifstream file("/proc/self/status");
+		std::string line;
+		while (std::getline(file, line)) {
+			if (line.compare(0, 6, "VmHWM:") == 0)
+				return std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+		}
+		return 0;
+	}
+
+	// Runs 'body(index, stop)' on 'threads' threads for 'seconds', and returns the operations per second.
+	// Every body returns how many operations it did.
+	double runThreads(size_t threads, double seconds, const std::function<size_t(size_t, const std::atomic<bool>&)>& body) {
+		std::atomic<bool> stop = { false };
+		std::atomic<size_t> ops = { 0 };
+		std::vector<std::thread> workers;
+
+		auto begin = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < threads; ++i) {
+			workers.emplace_back([&, i]() { ops += body(i, stop); });
+		}
+		std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+		stop = true;
+		for (auto& worker : workers) {
+			worker.join();
+		}
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		return ops / elapsed;
+	}
+
+	template<class Heap>
+	double larson(Heap& heap, size_t threads, double seconds) {
+		constexpr size_t slots = 1000;
+		constexpr size_t round = 10000;
+
+		auto fill = [&](std::mt19937& random) {
+			std::uniform_int_distribution<size_t> sizes(16, 512);
+			auto ret = new std::vector<Block>(slots);
+			for (auto& block : *ret) {
+				block.size = sizes(random);
+				block.ptr = allocateOrCount(heap, block.size);
+			}
+			return ret;
+		};
+
+		// Threads drop their blocks here and pick up someone else's.
+		// There is always one set waiting, so nobody comes back empty handed.
+		std::mt19937 mainRandom;
+		std::atomic<std::vector<Block>*> handoff = { fill(mainRandom) };
+
+		double ret = runThreads(threads, seconds, [&](size_t index, const std::atomic<bool>& stop) {
+			std::mt19937 random(static_cast<unsigned>(index));
+			std::uniform_int_distribution<size_t> sizes(16, 512);
+			std::uniform_int_distribution<size_t> picks(0, slots - 1);
+			auto mine = fill(random);
+
+			size_t ops = 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+				for (size_t i = 0; i < round; ++i) {
+					Block& block = (*mine)[picks(random)];
+					heap.deallocate(block.ptr, block.size);
+					block.size = sizes(random);
+					block.ptr = allocateOrCount(heap, block.size);
+				}
+				ops += round;
+				mine = handoff.exchange(mine);
+			}
+
+			for (auto& block : *mine) {
+				heap.deallocate(block.ptr, block.size);
+			}
+			delete mine;
+			return ops;
+		});
+
+		auto last = handoff.load();
+		for (auto& block : *last) {
+			heap.deallocate(block.ptr, block.size);
+		}
+		delete last;
+		return ret;
+	}
+
+	template<class Heap>
+	double producerConsumer(Heap& heap, size_t threads, double seconds) {
+		constexpr size_t maxQueued = 1024;
+
+		struct Queue {
+			std::mutex mutex;
+			std::deque<Block> blocks;
+		};
+		size_t pairs = threads > 1 ? threads / 2 : 1;
+		std::vector<Queue> queues(pairs);
+
+		double ret = runThreads(pairs * 2, seconds, [&](size_t index, const std::atomic<bool>& stop) {
+			Queue& queue = queues[index / 2];
+			std::mt19937 random(static_cast<unsigned>(index));
+			std::uniform_int_distribution<size_t> sizes(16, 1024);
+
+			size_t ops = 0;
+			bool producer = index % 2 == 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+				std::lock_guard<std::mutex> guard(queue.mutex);
+				if (producer && queue.blocks.size() < maxQueued) {
+					size_t size = sizes(random);
+					queue.blocks.push_back({ allocateOrCount(heap, size), size });
+				}
+				else if (!producer && !queue.blocks.empty()) {
+					Block block = queue.blocks.front();
+					queue.blocks.pop_front();
+					heap.deallocate(block.ptr, block.size);
+					++ops;
+				}
+			}
+			return ops;
+		});
+
+		for (auto& queue : queues) {
+			for (auto& block : queue.blocks) {
+				heap.deallocate(block.ptr, block.size);
+			}
+		}
+		return ret;
+	}
+
+	template<class Heap>
+	double threadTest(Heap& heap, size_t threads, double seconds) {
+		constexpr size_t batch = 1000;
+		constexpr size_t size = 64;
+
+		return runThreads(threads, seconds, [&](size_t, const std::atomic<bool>& stop) {
+			std::vector<void*> objects(batch);
+			size_t ops = 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+				for (auto& object : objects) {
+					object = allocateOrCount(heap, size);
+				}
+				for (auto& object : objects) {
+					heap.deallocate(object, size);
+				}
+				ops += batch;
+			}
+			return ops;
+		});
+	}
+
+	template<class Heap>
+	double falseSharing(Heap& heap, size_t threads, double seconds) {
+		constexpr size_t size = 8;
+		constexpr size_t writes = 1000;
+
+		return runThreads(threads, seconds, [&](size_t, const std::atomic<bool>& stop) {
+			size_t ops = 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+				volatile char* object = static_cast<char*>(allocateOrCount(heap, size));
+				if (object == nullptr)
+					continue;
+				for (size_t i = 0; i < writes; ++i) {
+					for (size_t j = 0; j < size; ++j) {
+						object[j] = object[j] + 1;
+					}
+				}
+				heap.deallocate(const_cast<char*>(object), size);
+				++ops;
+			}
+			return ops;
+		});
+	}
+
+	// Nothing to say for most heaps
+	template<class Heap>
+	void printContention(const Heap&) {}
+
+	template<size_t N, class Allocator, class Lock>
+	void printContention(const LegoHeap<ShardedAllocator<N, Allocator, Lock>>& heap) {
+		ShardStats total = {};
+		for (size_t i = 0; i < N; ++i) {
+			ShardStats stats = heap.get().stats(i);
+			total.acquisitions += stats.acquisitions;
+			total.contended += stats.contended;
+			total.waitNanoseconds += stats.waitNanoseconds;
+			total.holdNanoseconds += stats.holdNanoseconds;
+		}
+		if (total.acquisitions == 0)
+			return;
+		printf("%-18s %-16s %14.1f%% contended %8.0f ns wait %8.0f ns hold (per lock)\n", "", "",
+			100.0 * total.contended / total.acquisitions,
+			static_cast<double>(total.waitNanoseconds) / total.acquisitions,
+			static_cast<double>(total.holdNanoseconds) / total.acquisitions);
+	}
+
+	template<class Heap>
+	void runWorkload(const char* workload, const char* name, size_t maxThreadCount, double seconds,
+		double (*body)(Heap&, size_t, double)) {
+		for (size_t threads = 1; threads <= maxThreadCount; threads *= 2) {
+			// A fresh heap every run, so that one run doesn't warm up the next
+			auto heap = std::make_unique<Heap>();
+			resetPeakRss();
+			failures = 0;
+			double opsPerSecond = body(*heap, threads, seconds);
+			printf("%-18s %-16s %4zu threads %14.0f ops/s %10.1f MB peak RSS\n",
+				workload, name, threads, opsPerSecond, peakRss() / (1024.0 * 1024.0));
+			if (failures != 0)
+				printf("%-18s %-16s %14zu allocations failed\n", "", "", failures.load());
+			printContention(*heap);
+			fflush(stdout);
+		}
+	}
+
+	template<class Heap>
+	void runAll(const char* name, size_t maxThreadCount, double seconds) {
+		runWorkload<Heap>("larson", name, maxThreadCount, seconds, larson<Heap>);
+		runWorkload<Heap>("producer-consumer", name, maxThreadCount, seconds, producerConsumer<Heap>);
+		runWorkload<Heap>("threadtest", name, maxThreadCount, seconds, threadTest<Heap>);
+		runWorkload<Heap>("false-sharing", name, maxThreadCount, seconds, falseSharing<Heap>);
+	}
+}
+
+int main(int argc, char** argv) {
+	size_t maxThreadCount = argc > 1 ? strtoul(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+	double seconds = argc > 2 ? strtod(argv[2], nullptr) : 1.0;
+
+	// The main thread and the runs' threads all take a ThreadHeapAllocator slot
+	if (maxThreadCount == 0)
+		maxThreadCount = 1;
+	if (maxThreadCount >= maxThreads)
+		maxThreadCount = maxThreads - 1;
+
+	runAll<SystemHeap>("system malloc", maxThreadCount, seconds);
+	runAll<LockedFreeList>("locked freelist", maxThreadCount, seconds);
+	runAll<ShardedFreeList>("sharded freelist", maxThreadCount, seconds);
+	runAll<ThreadHeaps>("thread heaps", maxThreadCount, seconds);
+}
@@ -0,0 +1,98 @@
+#ifndef __LEGO_ATOMIC_LINEAR_ALLOCATOR_H__
+#define __LEGO_ATOMIC_LINEAR_ALLOCATOR_H__
+
+// LinearAllocator that many threads can allocate from at the same time, without locking.
+// 'current' is moved forward with a CAS, which also takes care of alignment.
+// deallocateAll() is a single store, but it must not race with allocate():
+// only reset once every thread is done with the batch.
+
+#include <atomic>
+#include <cassert>
+#include "blk.h"
+
+#include "detail/owner_map.h"
+#include "detail/pointer.h"
+#include "detail/zero_memory.h"
+#include "local_allocator.h"
+#include "heap_allocator.h"
+
+namespace lego {
+	template<size_t Capacity, class Allocator>
+	class AtomicLinearAllocator
+	{
+		static_assert(Capacity != 0);
+
+		Allocator allocator;
+		Blk memoryBlk = {};
+		char* start = nullptr;
+		detail::OwnerRegistration registration;
+		std::atomic<char*> current = { nullptr };
+	public:
+		AtomicLinearAllocator() {
+			memoryBlk = allocator.allocate(Capacity, alignof(max_align_t));
+			assert(memoryBlk);
+			start = reinterpret_cast<char*>(memoryBlk.ptr);
+			registration.assign(this, start, Capacity);
+			current.store(start, std::memory_order_relaxed);
+		}
+
+		~AtomicLinearAllocator() {
+			registration.reset();
+			allocator.deallocate(memoryBlk);
+		}
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+
+			char* expected = current.load(std::memory_order_relaxed);
+			char* alignedAddress;
+			do {
+				size_t adjustment = detail::pointer::getAlignForwardDiff(expected, alignment);
+
+				// if not enough space, return nullptr
+				if (adjustment + size > static_cast<size_t>(start + Capacity - expected)) {
+					return nullptr;
+				}
+
+				alignedAddress = expected + adjustment;
+			} while (!current.compare_exchange_weak(expected, alignedAddress + size, std::memory_order_relaxed));
+
+			return { alignedAddress, size };
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			Blk blk = allocate(size, alignment);
+			detail::zero(blk);
+			return blk;
+		}
+
+		void deallocate(Blk blk)
+		{
+			// does nothing
+		}
+
+		bool owns(Blk blk) const noexcept {
+			return blk.ptr >= start && blk.ptr < start + Capacity;
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return size;
+		}
+
+		void deallocateAll() {
+			current.store(start, std::memory_order_relaxed);
+		}
+	};
+
+
+	template<size_t Capacity>
+	using LocalAtomicLinearAllocator = AtomicLinearAllocator<Capacity, LocalAllocator<Capacity>>;
+
+	template<size_t Capacity>
+	using HeapAtomicLinearAllocator = AtomicLinearAllocator<Capacity, HeapAllocator>;
+}
+
+#endif
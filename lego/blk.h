@@ -1,6 +1,8 @@
 #ifndef __LEGO_ALLOCATORS_BLK_H__
 #define __LEGO_ALLOCATORS_BLK_H__
 
+#include <cstddef>
+
 namespace lego {
 	struct Blk {
 		void* ptr;
@@ -0,0 +1,247 @@
+#ifndef __LEGO_BUDDY_ALLOCATOR_H__
+#define __LEGO_BUDDY_ALLOCATOR_H__
+
+// Allocator that splits its memory in halves until a block fits, and merges the halves back on deallocate.
+// Blocks are MinBlock << order bytes. Every block has exactly one buddy, the other half of the block it was split from:
+//
+// order 2 |               0               |
+// order 1 |       0       |       1       |
+// order 0 |   0   |   1   |   2   |   3   |
+//
+// Free blocks of each order are on their own doubly linked list, so any of them can be taken off in O(1).
+// Two bitmaps, one bit per block of every order, say which blocks are free and which are split.
+// deallocate() finds the block's order by following the split bits down,
+// and merges with the buddy for as long as the buddy is free. No list is ever walked.
+//
+// Blocks are aligned to their size, as long as the parent gives us memory aligned to Capacity (we ask for it).
+// The bitmaps live right after the blocks, in the same allocation.
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include "blk.h"
+
+#include "detail/owner_map.h"
+#include "detail/pointer.h"
+#include "detail/zero_memory.h"
+#include "heap_allocator.h"
+
+namespace lego {
+	template<size_t Capacity, size_t MinBlock, class Allocator>
+	class BuddyAllocator
+	{
+		struct FreeBlock {
+			FreeBlock* prev;
+			FreeBlock* next;
+		};
+
+		static_assert(detail::pointer::isPowerOfTwo(Capacity), "Capacity must be a power of 2");
+		static_assert(detail::pointer::isPowerOfTwo(MinBlock), "MinBlock must be a power of 2");
+		static_assert(MinBlock >= sizeof(FreeBlock), "MinBlock is too small to hold a FreeBlock");
+		static_assert(Capacity >= MinBlock, "Capacity is smaller than MinBlock");
+
+		constexpr static size_t log2(size_t value) noexcept {
+			size_t ret = 0;
+			while (value >>= 1)
+				++ret;
+			return ret;
+		}
+
+		constexpr static size_t minShift = log2(MinBlock);
+		constexpr static size_t maxOrder = log2(Capacity / MinBlock);
+		constexpr static size_t orders = maxOrder + 1;
+
+		// Blocks of all orders together, with the biggest order first: 1 + 2 + 4 + ... + Capacity / MinBlock
+		constexpr static size_t bitCount = 2 * (Capacity / MinBlock) - 1;
+		constexpr static size_t bitmapWords = (bitCount + 63) / 64;
+
+		Allocator allocator;
+		Blk memory = {};
+		char* start = nullptr;
+		detail::OwnerRegistration registration;
+		size_t baseAlignment = 0;
+		FreeBlock* freeLists[orders] = {};
+		uint64_t* freeBits = nullptr;
+		uint64_t* splitBits = nullptr;
+
+		static size_t blockSize(size_t order) noexcept {
+			return MinBlock << order;
+		}
+
+		// Position of a block in the bitmaps
+		size_t bitOf(size_t order, size_t offset) const noexcept {
+			size_t level = maxOrder - order;
+			return ((size_t(1) << level) - 1) + (offset >> (minShift + order));
+		}
+
+		static bool test(const uint64_t* bits, size_t bit) noexcept {
+			return (bits[bit / 64] >> (bit % 64)) & 1;
+		}
+
+		static void set(uint64_t* bits, size_t bit, bool value) noexcept {
+			if (value)
+				bits[bit / 64] |= uint64_t(1) << (bit % 64);
+			else
+				bits[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+		}
+
+		size_t offsetOf(const void* ptr) const noexcept {
+			return static_cast<const char*>(ptr) - start;
+		}
+
+		void push(size_t order, size_t offset) noexcept {
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(start + offset);
+			block->prev = nullptr;
+			block->next = freeLists[order];
+			if (freeLists[order] != nullptr)
+				freeLists[order]->prev = block;
+			freeLists[order] = block;
+			set(freeBits, bitOf(order, offset), true);
+		}
+
+		void remove(size_t order, size_t offset) noexcept {
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(start + offset);
+			if (block->prev != nullptr)
+				block->prev->next = block->next;
+			else
+				freeLists[order] = block->next;
+			if (block->next != nullptr)
+				block->next->prev = block->prev;
+			set(freeBits, bitOf(order, offset), false);
+		}
+
+		// The order a request needs, or 'orders' if it can't fit
+		size_t orderFor(size_t size, size_t alignment) const noexcept {
+			// Blocks are aligned to their own size, so a big alignment just needs a big enough block
+			if (alignment > size)
+				size = alignment;
+
+			size_t order = 0;
+			while (order < orders && blockSize(order) < size)
+				++order;
+			return order;
+		}
+
+	public:
+		BuddyAllocator() {
+			constexpr size_t total = Capacity + bitmapWords * 2 * sizeof(uint64_t);
+
+			// Natural alignment only holds if the whole thing is aligned to Capacity.
+			// Not every parent can do that (e.g. LocalAllocator), so settle for less if we have to.
+			memory = allocator.allocate(total, Capacity);
+			if (!memory)
+				memory = allocator.allocate(total, alignof(max_align_t));
+			assert(memory);
+
+			start = static_cast<char*>(memory.ptr);
+			registration.assign(this, start, Capacity);
+			uintptr_t address = reinterpret_cast<uintptr_t>(start);
+			baseAlignment = address & (~address + 1);
+			if (baseAlignment > Capacity || baseAlignment == 0)
+				baseAlignment = Capacity;
+
+			freeBits = reinterpret_cast<uint64_t*>(start + Capacity);
+			splitBits = freeBits + bitmapWords;
+
+			deallocateAll();
+		}
+
+		~BuddyAllocator() {
+			registration.reset();
+			allocator.deallocate(memory);
+		}
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+
+			if (alignment > baseAlignment)
+				return {};
+
+			size_t order = orderFor(size, alignment);
+			if (order >= orders)
+				return {};
+
+			// The smallest free block that is big enough
+			size_t found = order;
+			while (found < orders && freeLists[found] == nullptr)
+				++found;
+			if (found == orders)
+				return {};
+
+			size_t offset = offsetOf(freeLists[found]);
+			remove(found, offset);
+
+			// Split it down, keeping the lower half and freeing the upper one
+			while (found > order) {
+				set(splitBits, bitOf(found, offset), true);
+				--found;
+				push(found, offset + blockSize(found));
+			}
+
+			return { start + offset, blockSize(order) };
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			Blk blk = allocate(size, alignment);
+			detail::zero(blk);
+			return blk;
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			assert(owns(blk));
+
+			size_t offset = offsetOf(blk.ptr);
+
+			// Follow the split blocks down to the one that was handed out
+			size_t order = maxOrder;
+			while (order > 0 && test(splitBits, bitOf(order, offset & ~(blockSize(order) - 1))))
+				--order;
+			assert((offset & (blockSize(order) - 1)) == 0);
+			assert(!test(freeBits, bitOf(order, offset)));
+
+			// Merge for as long as the buddy is free
+			while (order < maxOrder) {
+				size_t buddy = offset ^ blockSize(order);
+				if (!test(freeBits, bitOf(order, buddy)))
+					break;
+
+				remove(order, buddy);
+				offset &= ~blockSize(order);
+				++order;
+				set(splitBits, bitOf(order, offset), false);
+			}
+
+			push(order, offset);
+		}
+
+		bool owns(Blk blk) const noexcept {
+			return blk.ptr >= start && blk.ptr < start + Capacity;
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			size_t order = orderFor(size, 1);
+			return order < orders ? blockSize(order) : size;
+		}
+
+		void deallocateAll() noexcept {
+			memset(freeBits, 0, bitmapWords * 2 * sizeof(uint64_t));
+			for (auto& list : freeLists) {
+				list = nullptr;
+			}
+			push(maxOrder, 0);
+		}
+	};
+
+
+	template<size_t Capacity, size_t MinBlock>
+	using HeapBuddyAllocator = BuddyAllocator<Capacity, MinBlock, HeapAllocator>;
+}
+
+#endif
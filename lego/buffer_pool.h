@@ -0,0 +1,298 @@
+#ifndef __LEGO_BUFFER_POOL_H__
+#define __LEGO_BUFFER_POOL_H__
+
+// Reference counted buffers for I/O pipelines, so that stages pass slices around instead of copying payloads.
+//
+// A BufferPool hands out Buffers of BufferSize bytes from its Allocator (a SlabAllocator fits best).
+// Every buffer starts with a small header that holds the count of Buffers pointing into it:
+//
+// ------------------------------------------------
+// | references | pool | ... | data               |
+// ------------------------------------------------
+//                           ^      ^         ^
+//                 Buffer: [ data          ]  |
+//                 slice:         [ data      ]
+//
+// A Buffer is a view into the data that keeps the buffer alive. Copies and slices share the buffer,
+// and it goes back to its pool when the last of them is gone, on whichever thread that happens.
+// So the Allocator must be thread safe (e.g. wrap it in a LockedAllocator) if Buffers cross threads.
+// The pool must outlive its Buffers.
+//
+// Buffers don't copy on write: fill a buffer before sharing it.
+// A BufferChain collects Buffers and lays them out as iovecs for readv/writev.
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "blk.h"
+
+#include "detail/pointer.h"
+#include "heap_allocator.h"
+#include "slab_allocator.h"
+#include "small_vector.h"
+
+#ifdef _WIN32
+namespace lego {
+	// Windows has no readv/writev, but the layout is handy anyway
+	struct iovec {
+		void* iov_base;
+		size_t iov_len;
+	};
+}
+#else
+#include <sys/uio.h>
+#endif
+
+namespace lego {
+	namespace detail {
+		struct BufferHeader {
+			std::atomic<uint32_t> references;
+			void (*release)(BufferHeader*);
+			void* pool;
+			Blk memory;
+		};
+
+		// The data starts on its own cache line
+		constexpr size_t bufferHeaderSize = pointer::roundToAlignment(sizeof(BufferHeader), 64);
+	}
+
+	class Buffer
+	{
+		template<size_t BufferSize, class Allocator>
+		friend class BufferPool;
+
+		detail::BufferHeader* header = nullptr;
+		char* begin = nullptr;
+		size_t length = 0;
+
+		Buffer(detail::BufferHeader* header, char* begin, size_t length) noexcept
+			: header(header), begin(begin), length(length) {}
+
+		void retain() const noexcept {
+			if (header != nullptr)
+				header->references.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void release() noexcept {
+			// acq_rel, so that whoever frees the buffer sees everything the other owners wrote
+			if (header != nullptr && header->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				header->release(header);
+			header = nullptr;
+			begin = nullptr;
+			length = 0;
+		}
+
+	public:
+		Buffer() = default;
+
+		Buffer(const Buffer& other) noexcept : header(other.header), begin(other.begin), length(other.length) {
+			retain();
+		}
+
+		Buffer(Buffer&& other) noexcept : header(other.header), begin(other.begin), length(other.length) {
+			other.header = nullptr;
+			other.begin = nullptr;
+			other.length = 0;
+		}
+
+		Buffer& operator=(const Buffer& other) noexcept {
+			if (this != &other) {
+				other.retain();
+				release();
+				header = other.header;
+				begin = other.begin;
+				length = other.length;
+			}
+			return *this;
+		}
+
+		Buffer& operator=(Buffer&& other) noexcept {
+			if (this != &other) {
+				release();
+				std::swap(header, other.header);
+				std::swap(begin, other.begin);
+				std::swap(length, other.length);
+			}
+			return *this;
+		}
+
+		~Buffer() {
+			release();
+		}
+
+		char* data() const noexcept {
+			return begin;
+		}
+
+		size_t size() const noexcept {
+			return length;
+		}
+
+		bool empty() const noexcept {
+			return length == 0;
+		}
+
+		explicit operator bool() const noexcept {
+			return header != nullptr;
+		}
+
+		// Another view into the same buffer, 'size' bytes from 'offset' on (as many as there are by default)
+		Buffer slice(size_t offset, size_t size = SIZE_MAX) const noexcept {
+			assert(offset <= length);
+			if (size > length - offset)
+				size = length - offset;
+			retain();
+			return Buffer(header, begin + offset, size);
+		}
+
+		// Drops bytes from the front, e.g. the ones a write already took
+		void consume(size_t bytes) noexcept {
+			assert(bytes <= length);
+			begin += bytes;
+			length -= bytes;
+		}
+
+		// Keeps only the first 'size' bytes, e.g. the ones a read filled
+		void truncate(size_t size) noexcept {
+			assert(size <= length);
+			length = size;
+		}
+
+		// How many Buffers share the buffer
+		uint32_t useCount() const noexcept {
+			return header != nullptr ? header->references.load(std::memory_order_relaxed) : 0;
+		}
+
+		iovec toIovec() const noexcept {
+			return { begin, length };
+		}
+	};
+
+	template<size_t BufferSize, class Allocator>
+	class BufferPool
+	{
+		static_assert(BufferSize != 0);
+
+		Allocator allocator;
+		std::atomic<size_t> outstanding = { 0 };
+
+		static void release(detail::BufferHeader* header) noexcept {
+			BufferPool* pool = static_cast<BufferPool*>(header->pool);
+			Blk memory = header->memory;
+			header->~BufferHeader();
+			pool->allocator.deallocate(memory);
+			pool->outstanding.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+	public:
+		// What every buffer takes from the Allocator
+		constexpr static size_t blockSize = detail::bufferHeaderSize + BufferSize;
+		constexpr static size_t blockAlignment = 64;
+
+		BufferPool() = default;
+		BufferPool(const BufferPool&) = delete;
+		BufferPool& operator=(const BufferPool&) = delete;
+
+		~BufferPool() {
+			assert(outstanding.load() == 0 && "Buffers outlive their pool");
+		}
+
+		// An empty Buffer if the Allocator has no room left
+		Buffer acquire() {
+			Blk memory = allocator.allocate(blockSize, blockAlignment);
+			if (!memory)
+				return {};
+
+			auto header = new (memory.ptr) detail::BufferHeader;
+			header->references.store(1, std::memory_order_relaxed);
+			header->release = &release;
+			header->pool = this;
+			header->memory = memory;
+			outstanding.fetch_add(1, std::memory_order_relaxed);
+			return Buffer(header, static_cast<char*>(memory.ptr) + detail::bufferHeaderSize, BufferSize);
+		}
+
+		// Buffers that haven't come back yet
+		size_t outstandingBuffers() const noexcept {
+			return outstanding.load(std::memory_order_relaxed);
+		}
+
+		constexpr static size_t bufferSize() noexcept {
+			return BufferSize;
+		}
+	};
+
+	// Buffers that go out (or come in) together, e.g. a header and a payload.
+	// The first N are kept inline.
+	template<size_t N = 8>
+	class BufferChain
+	{
+		SmallVector<Buffer, N> buffers;
+		SmallVector<iovec, N> vectors;
+		size_t bytes = 0;
+
+	public:
+		void append(Buffer buffer) {
+			if (buffer.empty())
+				return;
+			bytes += buffer.size();
+			buffers.push_back(std::move(buffer));
+		}
+
+		// The buffers laid out for readv/writev. Good until the chain changes.
+		const iovec* iovecs() {
+			vectors.clear();
+			for (auto& buffer : buffers) {
+				vectors.push_back(buffer.toIovec());
+			}
+			return vectors.data();
+		}
+
+		// How many iovecs there are
+		size_t count() const noexcept {
+			return buffers.size();
+		}
+
+		// Bytes over all the buffers
+		size_t size() const noexcept {
+			return bytes;
+		}
+
+		bool empty() const noexcept {
+			return bytes == 0;
+		}
+
+		// Drops 'bytes' from the front, e.g. after a writev that didn't take everything.
+		// Buffers that are used up are let go.
+		void consume(size_t count) noexcept {
+			assert(count <= bytes);
+			bytes -= count;
+			size_t used = 0;
+			while (count != 0 && count >= buffers[used].size()) {
+				count -= buffers[used].size();
+				++used;
+			}
+			if (count != 0)
+				buffers[used].consume(count);
+			buffers.erase(buffers.begin(), buffers.begin() + used);
+		}
+
+		Buffer& operator[](size_t index) noexcept {
+			return buffers[index];
+		}
+
+		void clear() noexcept {
+			buffers.clear();
+			bytes = 0;
+		}
+	};
+
+
+	template<size_t BufferSize, size_t Count>
+	using HeapBufferPool = BufferPool<BufferSize,
+		SlabAllocator<Count * (detail::bufferHeaderSize + BufferSize), detail::bufferHeaderSize + BufferSize, 64, HeapAllocator>>;
+}
+
+#endif
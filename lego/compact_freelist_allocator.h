@@ -0,0 +1,254 @@
+#ifndef __LEGO_COMPACT_FREELIST_ALLOCATOR_H__
+#define __LEGO_COMPACT_FREELIST_ALLOCATOR_H__
+
+// FreeListAllocator for small objects.
+// The normal FreeListAllocator pads its Header and every object to max_align_t,
+// so a 4-byte allocation costs 32 bytes. This one stores the block size in 4 bytes
+// and rounds objects only to 4 bytes, so a 4-byte allocation costs 8 bytes.
+//
+// Free blocks link to each other with 4-byte offsets from the start of the memory,
+// which is why Capacity must fit in 32 bits.
+//
+// Over-aligned objects are placed after some padding. The lowest bit of the Header
+// says whether there is padding, and if there is, its size is stored right before the Header:
+// -------------------------------------------
+// | padding | adjustment | header | object  |
+// -------------------------------------------
+// ^ block start                   ^ aligned
+
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include "blk.h"
+
+#include "detail/owner_map.h"
+#include "detail/pointer.h"
+#include "detail/zero_memory.h"
+#include "detail/predef_freelist_strategies.h"
+#include "local_allocator.h"
+#include "heap_allocator.h"
+
+namespace lego {
+
+	template<size_t Capacity, class Allocator, class FitStrategy>
+	class CompactFreeListAllocator {
+		static_assert(Capacity != 0);
+		static_assert(Capacity < UINT32_MAX, "Capacity must fit in 32 bits");
+	protected:
+		struct FreeBlock {
+			uint32_t size;
+			uint32_t next; // offset from start
+		};
+
+		using Header = uint32_t;
+
+		constexpr static size_t granularity = alignof(FreeBlock);
+		constexpr static uint32_t nullOffset = UINT32_MAX;
+		constexpr static uint32_t paddedFlag = 1;
+		constexpr static size_t minBlockSize = sizeof(FreeBlock);
+		static_assert(sizeof(Header) + granularity >= minBlockSize, "Every block must be able to turn back into a FreeBlock");
+
+		Blk memory = {};
+		char* start = nullptr;
+		detail::OwnerRegistration registration;
+		FreeBlock* freeList = nullptr;
+		Allocator allocator;
+		FitStrategy fitStrategy;
+
+		FreeBlock* toBlock(uint32_t offset) const noexcept {
+			return offset == nullOffset ? nullptr : reinterpret_cast<FreeBlock*>(start + offset);
+		}
+
+		uint32_t toOffset(FreeBlock* block) const noexcept {
+			return block == nullptr ? nullOffset : static_cast<uint32_t>(reinterpret_cast<char*>(block) - start);
+		}
+
+		class iterator {
+			FreeBlock* current;
+			const CompactFreeListAllocator* owner;
+		public:
+			iterator(FreeBlock* block, const CompactFreeListAllocator* owner = nullptr) : current(block), owner(owner) {}
+			iterator& operator++() {
+				current = owner->toBlock(current->next);
+				return (*this);
+			}
+
+			iterator operator++(int) {
+				iterator tmp(current, owner);
+				current = owner->toBlock(current->next);
+				return tmp;
+			}
+
+			FreeBlock* operator*() {
+				return current;
+			}
+
+			bool operator==(const iterator& rhs) {
+				return this->current == rhs.current;
+			}
+			bool operator!=(const iterator& rhs) {
+				return this->current != rhs.current;
+			}
+
+		};
+
+
+	public:
+		CompactFreeListAllocator()
+		{
+			memory = allocator.allocate(Capacity, alignof(max_align_t));
+			assert(memory);
+			start = static_cast<char*>(memory.ptr);
+			registration.assign(this, start, Capacity);
+
+			deallocateAll();
+
+			// The whole allocator must be able to contain at least a minimum block size
+			assert(freeList->size >= minBlockSize);
+		}
+
+
+		~CompactFreeListAllocator()
+		{
+			registration.reset();
+			allocator.deallocate(memory);
+		}
+
+
+		Blk allocate(size_t size, size_t alignment) {
+			assert(size && alignment);
+
+			// Objects are only rounded to our granularity so that the next block stays aligned for FreeBlock
+			size_t roundObjectSize = detail::pointer::roundToAlignment(size, granularity);
+			size_t totalSize = sizeof(Header) + roundObjectSize;
+
+			// Blocks always start at our granularity, so the worst case padding is alignment - granularity.
+			size_t worstPadding = alignment > granularity ? alignment - granularity : 0;
+			if (totalSize + worstPadding > Capacity)
+				return {};
+
+			auto [prev, itr] = fitStrategy.find(iterator(freeList, this), iterator(nullptr, this), totalSize + worstPadding);
+
+			// Could not find a block that fits
+			if ((*itr) == nullptr)
+				return {};
+
+			// The padding is a multiple of granularity, so if there is any, there is room to store it
+			size_t adjustment = detail::pointer::getAlignForwardDiff(detail::pointer::add(*itr, sizeof(Header)), alignment);
+			totalSize += adjustment;
+
+			// Split the block if the rest can still hold a FreeBlock. Otherwise, give away the whole block.
+			FreeBlock* nextBlock;
+			size_t remainingSize = (*itr)->size - totalSize;
+			if (remainingSize < minBlockSize) {
+				nextBlock = toBlock((*itr)->next);
+				totalSize = (*itr)->size;
+			}
+			else {
+				nextBlock = reinterpret_cast<FreeBlock*>(detail::pointer::add(*itr, totalSize));
+				nextBlock->size = static_cast<uint32_t>(remainingSize);
+				nextBlock->next = (*itr)->next;
+			}
+
+			if (*prev) {
+				(*prev)->next = toOffset(nextBlock);
+			}
+			else {
+				this->freeList = nextBlock;
+			}
+
+			Header* header = reinterpret_cast<Header*>(detail::pointer::add(*itr, adjustment));
+			*header = static_cast<uint32_t>(totalSize);
+			if (adjustment != 0) {
+				*header |= paddedFlag;
+				*(header - 1) = static_cast<uint32_t>(adjustment);
+			}
+
+			// Everything up to the end of the block is usable
+			return { header + 1, totalSize - adjustment - sizeof(Header) };
+		}
+
+		bool owns(Blk blk) const noexcept {
+			return reinterpret_cast<char*>(blk.ptr) >= start && reinterpret_cast<char*>(blk.ptr) < start + Capacity;
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return detail::pointer::roundToAlignment(size, granularity);
+		}
+
+		// Reset all variables to start
+		void deallocateAll() noexcept {
+			this->freeList = reinterpret_cast<FreeBlock*>(start);
+			this->freeList->size = static_cast<uint32_t>(detail::pointer::getAlignBackward(Capacity, granularity));
+			this->freeList->next = nullOffset;
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			Blk blk = allocate(size, alignment);
+			detail::zero(blk);
+			return blk;
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			assert(owns(blk));
+
+			Header* header = reinterpret_cast<Header*>(blk.ptr) - 1;
+			size_t adjustment = (*header & paddedFlag) ? *(header - 1) : 0;
+			size_t blockSize = *header & ~paddedFlag;
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(detail::pointer::sub(header, adjustment));
+			uintptr_t blockEnd = reinterpret_cast<uintptr_t>(block) + blockSize;
+
+			// Look for the FreeBlocks around this block, the list is sorted by address
+			FreeBlock* itr = freeList;
+			FreeBlock* prev = nullptr;
+			while (itr != nullptr && reinterpret_cast<uintptr_t>(itr) < blockEnd) {
+				prev = itr;
+				itr = toBlock(itr->next);
+			}
+
+			if (prev == nullptr) {
+				block->size = static_cast<uint32_t>(blockSize);
+				block->next = toOffset(freeList);
+				freeList = block;
+				prev = block;
+			}
+			else if (reinterpret_cast<uintptr_t>(prev) + prev->size == reinterpret_cast<uintptr_t>(block)) {
+				// Combine with the previous block
+				prev->size += static_cast<uint32_t>(blockSize);
+			}
+			else {
+				block->size = static_cast<uint32_t>(blockSize);
+				block->next = prev->next;
+				prev->next = toOffset(block);
+				prev = block;
+			}
+
+			// Combine with the next block
+			if (itr != nullptr && reinterpret_cast<uintptr_t>(itr) == blockEnd) {
+				prev->size += itr->size;
+				prev->next = itr->next;
+			}
+		}
+	};
+
+
+	template<size_t Capacity>
+	using LocalFirstFitCompactFreeListAllocator = CompactFreeListAllocator<Capacity, LocalAllocator<Capacity>, detail::FirstFitStrategy>;
+
+	template<size_t Capacity>
+	using HeapFirstFitCompactFreeListAllocator = CompactFreeListAllocator<Capacity, HeapAllocator, detail::FirstFitStrategy>;
+
+	template<size_t Capacity>
+	using LocalBestFitCompactFreeListAllocator = CompactFreeListAllocator<Capacity, LocalAllocator<Capacity>, detail::BestFitStrategy>;
+
+	template<size_t Capacity>
+	using HeapBestFitCompactFreeListAllocator = CompactFreeListAllocator<Capacity, HeapAllocator, detail::BestFitStrategy>;
+}
+
+#endif
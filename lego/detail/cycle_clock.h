@@ -0,0 +1,68 @@
+#ifndef __LEGO_DETAIL_CYCLE_CLOCK_H__
+#define __LEGO_DETAIL_CYCLE_CLOCK_H__
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define LEGO_HAS_RDTSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// Clock for timing short calls, e.g. a single allocate.
+// On x86 it reads the time stamp counter, which costs a few nanoseconds where a clock_gettime costs 20 or more.
+// Elsewhere it falls back to steady_clock. Ticks are turned into nanoseconds with nanosecondsPerTick().
+//
+//     uint64_t from = cycle_clock::begin();
+//     ... the call ...
+//     uint64_t ticks = cycle_clock::end() - from;
+//
+// The TSC of modern CPUs runs at a constant rate, no matter the frequency the cores are at.
+
+namespace lego {
+	namespace detail {
+		namespace cycle_clock {
+			inline uint64_t begin() noexcept {
+#ifdef LEGO_HAS_RDTSC
+				return __rdtsc();
+#else
+				return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+			}
+
+			// rdtscp waits for everything before it to finish, so the timed call is all in
+			inline uint64_t end() noexcept {
+#ifdef LEGO_HAS_RDTSC
+				unsigned int processor;
+				return __rdtscp(&processor);
+#else
+				return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+			}
+
+			// Measured against steady_clock the first time it's asked, which takes 10ms
+			inline double nanosecondsPerTick() {
+#ifdef LEGO_HAS_RDTSC
+				static const double ret = []() {
+					auto from = std::chrono::steady_clock::now();
+					uint64_t ticks = begin();
+					while (std::chrono::steady_clock::now() - from < std::chrono::milliseconds(10)) {
+					}
+					auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - from).count();
+					return static_cast<double>(nanoseconds) / static_cast<double>(end() - ticks);
+				}();
+				return ret;
+#else
+				using Period = std::chrono::steady_clock::period;
+				return 1e9 * Period::num / Period::den;
+#endif
+			}
+		}
+	}
+}
+
+#endif
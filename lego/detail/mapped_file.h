@@ -0,0 +1,118 @@
+#ifndef __LEGO_DETAIL_MAPPED_FILE_H__
+#define __LEGO_DETAIL_MAPPED_FILE_H__
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A file mapped into memory with MAP_SHARED, so writes to the memory end up in the file.
+// The file is created or resized to 'size' if needed.
+
+namespace lego {
+	namespace detail {
+		class MappedFile {
+			void* ptr = nullptr;
+			size_t size = 0;
+			bool existed = false;
+#ifdef _WIN32
+			HANDLE file = INVALID_HANDLE_VALUE;
+			HANDLE mapping = nullptr;
+#endif
+		public:
+			MappedFile(const char* path, size_t size) : size(size) {
+#ifdef _WIN32
+				file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+				if (file == INVALID_HANDLE_VALUE)
+					return;
+
+				LARGE_INTEGER fileSize = {};
+				GetFileSizeEx(file, &fileSize);
+				existed = static_cast<size_t>(fileSize.QuadPart) == size;
+
+				mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+					static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32), static_cast<DWORD>(size), nullptr);
+				if (mapping == nullptr)
+					return;
+				ptr = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+				int fd = open(path, O_RDWR | O_CREAT, 0644);
+				if (fd < 0)
+					return;
+
+				struct stat info = {};
+				existed = fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) == size;
+				if (!existed && ftruncate(fd, size) != 0) {
+					close(fd);
+					return;
+				}
+
+				void* ret = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				close(fd);
+				ptr = ret == MAP_FAILED ? nullptr : ret;
+#endif
+			}
+
+			~MappedFile() {
+#ifdef _WIN32
+				if (ptr != nullptr)
+					UnmapViewOfFile(ptr);
+				if (mapping != nullptr)
+					CloseHandle(mapping);
+				if (file != INVALID_HANDLE_VALUE)
+					CloseHandle(file);
+#else
+				if (ptr != nullptr)
+					munmap(ptr, size);
+#endif
+			}
+
+			MappedFile(const MappedFile&) = delete;
+			MappedFile& operator=(const MappedFile&) = delete;
+
+			void* data() const noexcept {
+				return ptr;
+			}
+
+			// Whether the file was already there with the right size.
+			// Its contents still have to be validated.
+			bool reopened() const noexcept {
+				return existed;
+			}
+
+			// Writes the dirty pages to disk and waits for it
+			bool flush() noexcept {
+#ifdef _WIN32
+				return FlushViewOfFile(ptr, size) && FlushFileBuffers(file);
+#else
+				return msync(ptr, size, MS_SYNC) == 0;
+#endif
+			}
+
+			// Same for [offset, offset + length) only. 'offset' must be page aligned.
+			bool flush(size_t offset, size_t length) noexcept {
+				char* from = static_cast<char*>(ptr) + offset;
+#ifdef _WIN32
+				return FlushViewOfFile(from, length) && FlushFileBuffers(file);
+#else
+				return msync(from, length, MS_SYNC) == 0;
+#endif
+			}
+		};
+	}
+}
+
+#endif
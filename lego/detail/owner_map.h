@@ -0,0 +1,244 @@
+#ifndef __LEGO_DETAIL_OWNER_MAP_H__
+#define __LEGO_DETAIL_OWNER_MAP_H__
+
+// Finds the allocator that owns an address in O(1), instead of asking every allocator in turn.
+// Allocators that carve blocks out of one big range (arenas) register it here. Composites look the owner up
+// and hand the block to the child that contains it, and HeapAllocator / PageAllocator know what is not theirs.
+//
+// It's a radix tree over 4KB pages, three levels of 4096 entries each:
+// ----------------------------------------------------------------
+// | unused (16) | root (12) | middle (12) | leaf (12) | page (12) |
+// ----------------------------------------------------------------
+// Only pages that lie completely inside a range are mapped, so the first and last page of an
+// unaligned range (and ranges smaller than a page) aren't. Looking those up gives nullptr,
+// which means "ask owns()", so nothing breaks, it's just not O(1) there.
+// HeapAllocator and PageAllocator own whatever nobody has claimed, which includes those edges.
+// So they declare ownsUnclaimed, and composites ask their other child first (see claims()).
+//
+// Lookups don't lock. Nodes come straight from the OS and are never freed,
+// so that registering never calls malloc (lego_malloc registers while holding its lock).
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include "../blk.h"
+
+#include "spin_lock.h"
+#include "virtual_memory.h"
+
+namespace lego {
+	namespace detail {
+		class OwnerMap {
+		public:
+			constexpr static size_t pageShift = 12;
+			constexpr static size_t levelBits = 12;
+			constexpr static size_t addressBits = pageShift + 3 * levelBits;
+		private:
+			constexpr static size_t entries = size_t(1) << levelBits;
+
+			struct Leaf {
+				std::atomic<const void*> owners[entries];
+			};
+
+			struct Middle {
+				std::atomic<Leaf*> leaves[entries];
+			};
+
+			std::atomic<Middle*> roots[entries] = {};
+			SpinLock lock;
+
+			static size_t indexAt(uintptr_t page, size_t level) noexcept {
+				return (page >> (levelBits * (2 - level))) & (entries - 1);
+			}
+
+			// Fresh pages are zero, which is a null pointer for every entry
+			template<class Node>
+			static Node* createNode() noexcept {
+				return static_cast<Node*>(virtual_memory::allocate(sizeof(Node)));
+			}
+
+			// Creates the path as needed. Writers hold the lock.
+			std::atomic<const void*>* slotFor(uintptr_t page) noexcept {
+				Middle* middle = roots[indexAt(page, 0)].load(std::memory_order_acquire);
+				if (middle == nullptr) {
+					middle = createNode<Middle>();
+					if (middle == nullptr)
+						return nullptr;
+					roots[indexAt(page, 0)].store(middle, std::memory_order_release);
+				}
+
+				Leaf* leaf = middle->leaves[indexAt(page, 1)].load(std::memory_order_acquire);
+				if (leaf == nullptr) {
+					leaf = createNode<Leaf>();
+					if (leaf == nullptr)
+						return nullptr;
+					middle->leaves[indexAt(page, 1)].store(leaf, std::memory_order_release);
+				}
+
+				return &leaf->owners[indexAt(page, 2)];
+			}
+
+			// The whole pages inside [begin, end)
+			static bool pagesWithin(const void* begin, const void* end, uintptr_t& first, uintptr_t& last) noexcept {
+				uintptr_t from = reinterpret_cast<uintptr_t>(begin);
+				uintptr_t to = reinterpret_cast<uintptr_t>(end);
+				first = (from + (uintptr_t(1) << pageShift) - 1) >> pageShift;
+				last = to >> pageShift;
+				return first < last && (to >> addressBits) == 0;
+			}
+
+		public:
+			static OwnerMap& instance() noexcept {
+				// Constant initialized, so it's there before any constructor runs and is never destroyed
+				static OwnerMap map;
+				return map;
+			}
+
+			const void* find(const void* ptr) const noexcept {
+				uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+				if ((address >> addressBits) != 0)
+					return nullptr;
+
+				uintptr_t page = address >> pageShift;
+				Middle* middle = roots[indexAt(page, 0)].load(std::memory_order_acquire);
+				if (middle == nullptr)
+					return nullptr;
+				Leaf* leaf = middle->leaves[indexAt(page, 1)].load(std::memory_order_acquire);
+				if (leaf == nullptr)
+					return nullptr;
+				return leaf->owners[indexAt(page, 2)].load(std::memory_order_acquire);
+			}
+
+			// Maps the whole pages in [begin, end) to 'owner'.
+			// Returns who had the first page before, e.g. the arena that 'owner' got its memory from.
+			const void* assign(const void* begin, const void* end, const void* owner) noexcept {
+				uintptr_t first, last;
+				if (!pagesWithin(begin, end, first, last))
+					return nullptr;
+
+				std::lock_guard<SpinLock> guard(lock);
+				const void* previous = nullptr;
+				for (uintptr_t page = first; page < last; ++page) {
+					std::atomic<const void*>* slot = slotFor(page);
+					if (slot == nullptr)
+						continue;
+					if (page == first)
+						previous = slot->load(std::memory_order_relaxed);
+					slot->store(owner, std::memory_order_release);
+				}
+				return previous;
+			}
+
+			// Gives the pages of 'owner' in [begin, end) back to 'previous'.
+			// Pages someone else has taken over in the meantime are left alone.
+			void release(const void* begin, const void* end, const void* owner, const void* previous) noexcept {
+				uintptr_t first, last;
+				if (!pagesWithin(begin, end, first, last))
+					return;
+
+				std::lock_guard<SpinLock> guard(lock);
+				for (uintptr_t page = first; page < last; ++page) {
+					std::atomic<const void*>* slot = slotFor(page);
+					if (slot != nullptr && slot->load(std::memory_order_relaxed) == owner)
+						slot->store(previous, std::memory_order_release);
+				}
+			}
+		};
+
+		// nullptr if no arena has registered the page 'ptr' is in
+		inline const void* ownerOf(const void* ptr) noexcept {
+			return OwnerMap::instance().find(ptr);
+		}
+
+		// Whether 'owner' is 'child' itself or lives inside it, i.e. the block belongs to that child
+		template<class Child>
+		bool isWithin(const Child& child, const void* owner) noexcept {
+			uintptr_t address = reinterpret_cast<uintptr_t>(owner);
+			uintptr_t begin = reinterpret_cast<uintptr_t>(&child);
+			return address >= begin && address < begin + sizeof(Child);
+		}
+
+		// Allocators whose owns() only means "no arena has claimed it" declare
+		//     static constexpr bool ownsUnclaimed = true;
+		// and so do the composites and wrappers that have one of them inside.
+		template<class Allocator, class = void>
+		struct OwnsUnclaimed : std::false_type {};
+
+		template<class Allocator>
+		struct OwnsUnclaimed<Allocator, std::void_t<decltype(Allocator::ownsUnclaimed)>> : std::bool_constant<Allocator::ownsUnclaimed> {};
+
+		// Whether a block the owner map doesn't know goes to 'child' rather than its sibling 'other'.
+		// It may be in the edge page of an arena in 'other', which a child that owns the unclaimed would take too.
+		template<class Child, class Other>
+		bool claims(const Child& child, const Other& other, const Blk& blk) {
+			if (!child.owns(blk))
+				return false;
+			return !OwnsUnclaimed<Child>::value || OwnsUnclaimed<Other>::value || !other.owns(blk);
+		}
+
+		template<class Allocator, class = void>
+		struct HasOwnsClaimed : std::false_type {};
+
+		template<class Allocator>
+		struct HasOwnsClaimed<Allocator, std::void_t<decltype(std::declval<const Allocator&>().ownsClaimed(std::declval<const Blk&>()))>> : std::true_type {};
+
+		// Whether the block is in one of the allocator's arenas, not just unclaimed.
+		// For picking between allocators of the same type, where claims() can't tell them apart.
+		// Composites and wrappers that own the unclaimed answer it with ownsClaimed(), HeapAllocator & co. with no.
+		template<class Allocator>
+		bool ownsClaimed(const Allocator& allocator, const Blk& blk) {
+			if constexpr (!OwnsUnclaimed<Allocator>::value)
+				return allocator.owns(blk);
+			else if constexpr (HasOwnsClaimed<Allocator>::value)
+				return allocator.ownsClaimed(blk);
+			else
+				return false;
+		}
+
+		// Registers an arena for as long as it lives. Arenas keep one as a member.
+		// Call reset() before giving the memory back, so no one is sent to us in between.
+		class OwnerRegistration {
+			const void* owner = nullptr;
+			const void* begin = nullptr;
+			const void* end = nullptr;
+			const void* previous = nullptr;
+		public:
+			OwnerRegistration() = default;
+			OwnerRegistration(const OwnerRegistration&) = delete;
+			OwnerRegistration& operator=(const OwnerRegistration&) = delete;
+
+			~OwnerRegistration() {
+				reset();
+			}
+
+			void assign(const void* owner, const void* begin, size_t size) noexcept {
+				reset();
+				this->owner = owner;
+				this->begin = begin;
+				this->end = static_cast<const char*>(begin) + size;
+				previous = OwnerMap::instance().assign(this->begin, this->end, owner);
+			}
+
+			// Takes in the pages up to begin + size as well, for arenas that grow in place.
+			// Only the new pages are mapped, so growing costs as much as what was added.
+			void grow(size_t size) noexcept {
+				const void* newEnd = static_cast<const char*>(begin) + size;
+				if (owner == nullptr || newEnd <= end)
+					return;
+				OwnerMap::instance().assign(end, newEnd, owner);
+				end = newEnd;
+			}
+
+			void reset() noexcept {
+				if (owner == nullptr)
+					return;
+				OwnerMap::instance().release(begin, end, owner, previous);
+				owner = nullptr;
+			}
+		};
+	}
+}
+
+#endif
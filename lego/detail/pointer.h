@@ -32,12 +32,12 @@ namespace lego {
 			// e.g.  4 bytes -> ~(0100 - 1) = ~0011 = 1100
 			// e.g.  8 bytes -> ~(1000 - 1) = ~0111 = 1000
 			// And thus, the forumla for backward alignment is: A & ~(N-1)
-			static uintptr_t getAlignBackward(uintptr_t alignee, uint8_t alignment) noexcept {
-				return alignee & ~(alignment - 1);
+			static uintptr_t getAlignBackward(uintptr_t alignee, size_t alignment) noexcept {
+				return alignee & ~(static_cast<uintptr_t>(alignment) - 1);
 			}
 			template<typename T>
-			static T* getAlignBackward(T* alignee, uint8_t alignment) noexcept {
-				return reinterpret_cast<char*>(getAlignBackward(reinterpret_cast<uintptr_t>(alignee), alignment));
+			static T* getAlignBackward(T* alignee, size_t alignment) noexcept {
+				return reinterpret_cast<T*>(getAlignBackward(reinterpret_cast<uintptr_t>(alignee), alignment));
 			}
 
 
@@ -47,13 +47,13 @@ namespace lego {
 			// If the forward alignment formula is: (A & ~(N-1))
 			// Then the formula for the difference is the the original address minus the result: 
 			// A - (A & ~(N-1))
-			static uint8_t getAlignBackwardDiff(uintptr_t addressToAlign, uint8_t alignment) noexcept {
-				return static_cast<uint8_t>(addressToAlign - getAlignBackward(addressToAlign, alignment));
+			static size_t getAlignBackwardDiff(uintptr_t addressToAlign, size_t alignment) noexcept {
+				return static_cast<size_t>(addressToAlign - getAlignBackward(addressToAlign, alignment));
 			}
 
 			template<typename T>
-			static uint8_t getAlignBackwardDiff(T* addressToAlign, uint8_t alignment) noexcept {
-				return static_cast<uint8_t>(addressToAlign - getAlignBackward(addressToAlign, alignment));
+			static size_t getAlignBackwardDiff(T* addressToAlign, size_t alignment) noexcept {
+				return getAlignBackwardDiff(reinterpret_cast<uintptr_t>(addressToAlign), alignment);
 			}
 
 
@@ -61,12 +61,12 @@ namespace lego {
 			// We don't add N to A because if A is ALREADY aligned, we want it to remain as the same value.
 			// Thus the completed formular is: (A + (N-1)) & (~(N-1))
 			// e.g. 4-byte alignment of 0110 -> (0110 + (0100 - 1) & (~(0100 - 1)) = (1001 & 0100) = 1000
-			static uintptr_t getAlignForward(uintptr_t alignee, uint8_t alignment) noexcept {
-				return (alignee + (alignment - 1)) & ~(alignment - 1);
+			static uintptr_t getAlignForward(uintptr_t alignee, size_t alignment) noexcept {
+				return (alignee + (static_cast<uintptr_t>(alignment) - 1)) & ~(static_cast<uintptr_t>(alignment) - 1);
 			}
 
 			template<typename T>
-			static T* getAlignForward(T* alignee, uint8_t alignment) noexcept {
+			static T* getAlignForward(T* alignee, size_t alignment) noexcept {
 				return reinterpret_cast<T*>(getAlignForward(reinterpret_cast<uintptr_t>(alignee), alignment));
 			}
 
@@ -76,13 +76,13 @@ namespace lego {
 			// If the forward alignment formula is: (A + (N-1)) & (~(N-1))
 			// Then the formula for the difference is the result minus the original address: 
 			// ((A + (N-1)) & (~(N-1))) - A
-			static uint8_t getAlignForwardDiff(uintptr_t addressToAlign, uint8_t alignment) noexcept {
-				return static_cast<uint8_t>(getAlignForward(addressToAlign, alignment) - addressToAlign);
+			static size_t getAlignForwardDiff(uintptr_t addressToAlign, size_t alignment) noexcept {
+				return static_cast<size_t>(getAlignForward(addressToAlign, alignment) - addressToAlign);
 			}
 
 			template<typename T>
-			static uint8_t getAlignForwardDiff(T* addressToAlign, uint8_t alignment) noexcept {
-				return static_cast<uint8_t>(getAlignForward(addressToAlign, alignment) - addressToAlign);
+			static size_t getAlignForwardDiff(T* addressToAlign, size_t alignment) noexcept {
+				return getAlignForwardDiff(reinterpret_cast<uintptr_t>(addressToAlign), alignment);
 			}
 
 
@@ -96,11 +96,17 @@ namespace lego {
 				return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(lhs) - rhs);
 			}
 
-			static size_t roundToAlignment(size_t size, uint8_t alignment)
+			constexpr static size_t roundToAlignment(size_t size, size_t alignment)
 			{
 				size_t ret = size / alignment * alignment;
 				return (ret == size) ? ret : ret + alignment;
 			}
+
+			// Alignments are only valid if they are a power of 2 (see above).
+			// Anything up to the size of the address space is fine, e.g. 4096 for pages or 2MB for huge pages.
+			constexpr static bool isPowerOfTwo(size_t alignment) noexcept {
+				return alignment != 0 && (alignment & (alignment - 1)) == 0;
+			}
 		}
 	}
 
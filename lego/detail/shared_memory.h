@@ -0,0 +1,129 @@
+#ifndef __LEGO_DETAIL_SHARED_MEMORY_H__
+#define __LEGO_DETAIL_SHARED_MEMORY_H__
+
+#include <chrono>
+#include <cstddef>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A named piece of memory that several processes can map at the same time.
+// The first process to open a name creates (and zeroes) it, everyone after that just maps it.
+// The memory can end up at a different address in each process.
+//
+// Names follow the platform's rules: "/name" for shm_open, "Local\\name" or "Global\\name" on Windows.
+//
+// If the creator dies before it has sized the memory, nobody else will. So the others only wait
+// for 'timeout', and then give up with data() == nullptr. remove() the name to start over.
+
+namespace lego {
+	namespace detail {
+		// How long everyone but the creator waits for the creator to set the memory up
+		constexpr std::chrono::milliseconds attachTimeout{ 5000 };
+
+		class SharedMemory {
+			void* ptr = nullptr;
+			size_t size = 0;
+			bool creator = false;
+#ifdef _WIN32
+			HANDLE mapping = nullptr;
+#endif
+		public:
+			SharedMemory(const char* name, size_t size, std::chrono::milliseconds timeout = attachTimeout) : size(size) {
+#ifdef _WIN32
+				mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+					static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32), static_cast<DWORD>(size), name);
+				if (mapping == nullptr)
+					return;
+				creator = GetLastError() != ERROR_ALREADY_EXISTS;
+				ptr = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+				int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+				if (fd >= 0) {
+					creator = true;
+					if (ftruncate(fd, size) != 0) {
+						close(fd);
+						shm_unlink(name);
+						return;
+					}
+				}
+				else if (errno == EEXIST) {
+					fd = shm_open(name, O_RDWR, 0600);
+					if (fd < 0)
+						return;
+
+					// The creator may not have sized it yet. Touching it before then would be a SIGBUS.
+					struct stat info = {};
+					auto deadline = std::chrono::steady_clock::now() + timeout;
+					while (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) < size) {
+						if (std::chrono::steady_clock::now() > deadline) {
+							close(fd);
+							return;
+						}
+						std::this_thread::yield();
+					}
+					if (static_cast<size_t>(info.st_size) < size) {
+						close(fd);
+						return;
+					}
+				}
+				else {
+					return;
+				}
+
+				void* ret = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				close(fd);
+				ptr = ret == MAP_FAILED ? nullptr : ret;
+#endif
+			}
+
+			~SharedMemory() {
+#ifdef _WIN32
+				if (ptr != nullptr)
+					UnmapViewOfFile(ptr);
+				if (mapping != nullptr)
+					CloseHandle(mapping);
+#else
+				if (ptr != nullptr)
+					munmap(ptr, size);
+#endif
+			}
+
+			SharedMemory(const SharedMemory&) = delete;
+			SharedMemory& operator=(const SharedMemory&) = delete;
+
+			void* data() const noexcept {
+				return ptr;
+			}
+
+			// Whether this process created the memory (and so has to set it up)
+			bool created() const noexcept {
+				return creator;
+			}
+
+			// Removes the name. Processes that have it mapped keep using it.
+			// Windows removes it by itself once nobody has it mapped.
+			static void remove(const char* name) noexcept {
+#ifndef _WIN32
+				shm_unlink(name);
+#endif
+			}
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __LEGO_DETAIL_SPIN_LOCK_H__
+#define __LEGO_DETAIL_SPIN_LOCK_H__
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace lego {
+	namespace detail {
+		// Smallest possible lock that works with std::lock_guard.
+		// Lock-free atomics don't care about the address they live at,
+		// so this also works inside memory that is shared between processes.
+		class SpinLock {
+			std::atomic<uint32_t> flag = { 0 };
+			static_assert(std::atomic<uint32_t>::is_always_lock_free, "SpinLock needs lock-free atomics");
+		public:
+			bool try_lock() noexcept {
+				return flag.load(std::memory_order_relaxed) == 0 && flag.exchange(1, std::memory_order_acquire) == 0;
+			}
+
+			void lock() noexcept {
+				for (unsigned spins = 0; !try_lock(); ++spins) {
+					// Give the owner a chance to run if it's taking a while
+					if (spins > 64)
+						std::this_thread::yield();
+				}
+			}
+
+			void unlock() noexcept {
+				flag.store(0, std::memory_order_release);
+			}
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef __LEGO_DETAIL_STACK_TRACE_H__
+#define __LEGO_DETAIL_STACK_TRACE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__GLIBC__) || defined(__APPLE__)
+#define LEGO_HAS_EXECINFO
+#include <execinfo.h>
+#include <cxxabi.h>
+#endif
+
+// Frames are counted, so the functions that count them must really be there
+#ifdef _MSC_VER
+#define LEGO_NOINLINE __declspec(noinline)
+#else
+#define LEGO_NOINLINE __attribute__((noinline))
+#endif
+
+// Captures the return addresses of the calling thread, innermost first.
+// Capturing doesn't allocate, except for the very first call on glibc, which loads the unwinder.
+//
+// Names are looked up with backtrace_symbols, which only knows exported functions (link with -rdynamic).
+// Windows would need DbgHelp for names, so it gets addresses there, as do frames without a name.
+
+namespace lego {
+	namespace detail {
+		namespace stack_trace {
+			// Returns how many frames were written. 'skip' leaves out the innermost ones, e.g. the allocator itself.
+			LEGO_NOINLINE inline size_t capture(void** frames, size_t maxDepth, size_t skip) noexcept {
+#ifdef _WIN32
+				return CaptureStackBackTrace(static_cast<DWORD>(skip + 1), static_cast<DWORD>(maxDepth), frames, nullptr);
+#elif defined(LEGO_HAS_EXECINFO)
+				// backtrace() can't skip, so take a few more and drop them. Counting starts at our caller,
+				// there can be frames in between (sanitizers wrap backtrace()).
+				void* buffer[128];
+				size_t total = skip + 4 + maxDepth;
+				size_t depth = backtrace(buffer, static_cast<int>(total < 128 ? total : 128));
+				size_t caller = 0;
+				while (caller < depth && buffer[caller] != __builtin_return_address(0))
+					++caller;
+				size_t first = (caller < depth ? caller : 1) + skip;
+				if (depth <= first)
+					return 0;
+				size_t ret = depth - first;
+				if (ret > maxDepth)
+					ret = maxDepth;
+				memcpy(frames, buffer + first, ret * sizeof(void*));
+				return ret;
+#else
+				return 0;
+#endif
+			}
+
+			inline std::string addressName(const void* frame) {
+				char buffer[2 + 16 + 1];
+				static const char digits[] = "0123456789abcdef";
+				uintptr_t address = reinterpret_cast<uintptr_t>(frame);
+				char* end = buffer + sizeof(buffer);
+				char* itr = end;
+				do {
+					*--itr = digits[address & 0xF];
+					address >>= 4;
+				} while (address != 0);
+				*--itr = 'x';
+				*--itr = '0';
+				return std::string(itr, end);
+			}
+
+			// Calls function(index, name) for every frame
+			template<class Function>
+			inline void symbolize(void* const* frames, size_t depth, Function&& function) {
+#ifdef LEGO_HAS_EXECINFO
+				char** symbols = depth != 0 ? backtrace_symbols(frames, static_cast<int>(depth)) : nullptr;
+				for (size_t i = 0; i < depth; ++i) {
+					std::string name;
+					if (symbols != nullptr) {
+						// glibc: "binary(name+0x12) [0x...]", macOS: "3 binary 0x... name + 18"
+						const char* symbol = symbols[i];
+#ifdef __APPLE__
+						const char* begin = strstr(symbol, " 0x");
+						begin = begin != nullptr ? strchr(begin + 1, ' ') : nullptr;
+						const char* end = begin != nullptr ? strstr(begin + 1, " + ") : nullptr;
+						if (begin != nullptr)
+							++begin;
+#else
+						const char* begin = strchr(symbol, '(');
+						const char* end = begin != nullptr ? strpbrk(begin, "+)") : nullptr;
+						if (begin != nullptr)
+							++begin;
+#endif
+						if (begin != nullptr && end != nullptr && end > begin)
+							name.assign(begin, end);
+					}
+
+					if (!name.empty()) {
+						int status = 0;
+						char* demangled = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+						if (status == 0 && demangled != nullptr)
+							name = demangled;
+						free(demangled);
+					}
+					else {
+						name = addressName(frames[i]);
+					}
+					function(i, name);
+				}
+				free(symbols);
+#else
+				for (size_t i = 0; i < depth; ++i) {
+					function(i, addressName(frames[i]));
+				}
+#endif
+			}
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef __LEGO_DETAIL_THREAD_INDEX_H__
+#define __LEGO_DETAIL_THREAD_INDEX_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace lego {
+	namespace detail {
+		// Gives every live thread a small number, starting from 0.
+		// Numbers are handed back when a thread exits, so they stay dense and can index fixed-size arrays.
+		class ThreadIndexPool {
+			std::mutex mutex;
+			std::vector<size_t> released;
+			size_t next = 0;
+		public:
+			size_t acquire() {
+				std::lock_guard<std::mutex> guard(mutex);
+				if (released.empty())
+					return next++;
+				size_t ret = released.back();
+				released.pop_back();
+				return ret;
+			}
+
+			void release(size_t index) {
+				std::lock_guard<std::mutex> guard(mutex);
+				released.push_back(index);
+			}
+
+			static ThreadIndexPool& instance() {
+				// Never destroyed, threads may exit after static destructors have run
+				static ThreadIndexPool* pool = new ThreadIndexPool();
+				return *pool;
+			}
+		};
+
+		// What threadIndex() returns once the thread has handed its number back.
+		// It's never below any MaxThreads, so it gets the overflow slots and the remote frees.
+		constexpr size_t exitedThreadIndex = SIZE_MAX;
+
+		// The number goes back when the thread's thread_locals are destroyed. Some code still runs after that:
+		// thread_locals built before our first call, pthread key destructors. By then a new thread may have
+		// the number, so from then on this thread only gets exitedThreadIndex.
+		inline size_t threadIndex() {
+			constexpr size_t unassigned = SIZE_MAX - 1;
+
+			// Trivial, so it's still there after every destructor has run
+			thread_local size_t index = unassigned;
+			if (index == unassigned) {
+				index = ThreadIndexPool::instance().acquire();
+
+				struct Release {
+					~Release() {
+						ThreadIndexPool::instance().release(index);
+						index = exitedThreadIndex;
+					}
+				};
+				thread_local Release release;
+			}
+			return index;
+		}
+	}
+}
+
+#endif
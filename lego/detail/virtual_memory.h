@@ -0,0 +1,147 @@
+#ifndef __LEGO_DETAIL_VIRTUAL_MEMORY_H__
+#define __LEGO_DETAIL_VIRTUAL_MEMORY_H__
+
+#include <cstdint>
+#include <cstddef>
+#include "pointer.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Thin wrapper over the OS virtual memory functions.
+// 'reserve' only takes address space, 'commit' makes it usable and 'decommit' gives it back.
+// 'discard' hands the physical pages back to the OS but leaves the range usable:
+// the next touch gets fresh, zeroed pages.
+//
+// All pointers and sizes given to these functions must be page aligned.
+
+namespace lego {
+	namespace detail {
+		namespace virtual_memory {
+			inline size_t pageSize() noexcept {
+				static const size_t size = []() {
+#ifdef _WIN32
+					SYSTEM_INFO info;
+					GetSystemInfo(&info);
+					return static_cast<size_t>(info.dwPageSize);
+#else
+					return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+				}();
+				return size;
+			}
+
+			// Alignments up to the page size come for free.
+			// Bigger ones (e.g. 2MB for huge pages) reserve extra and cut it off.
+			inline void* reserve(size_t size, size_t alignment = 0) noexcept {
+				if (alignment <= pageSize()) {
+#ifdef _WIN32
+					return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+					void* ret = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+					return ret == MAP_FAILED ? nullptr : ret;
+#endif
+				}
+
+#ifdef _WIN32
+				// Windows can't release part of a reservation, so find an aligned hole and try to grab it.
+				// Another thread may take the hole in between, so try a few times.
+				for (int i = 0; i < 8; ++i) {
+					void* hole = VirtualAlloc(nullptr, size + alignment, MEM_RESERVE, PAGE_NOACCESS);
+					if (hole == nullptr)
+						return nullptr;
+					VirtualFree(hole, 0, MEM_RELEASE);
+					void* ret = VirtualAlloc(pointer::getAlignForward(hole, alignment), size, MEM_RESERVE, PAGE_NOACCESS);
+					if (ret != nullptr)
+						return ret;
+				}
+				return nullptr;
+#else
+				char* raw = static_cast<char*>(mmap(nullptr, size + alignment, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+				if (raw == MAP_FAILED)
+					return nullptr;
+				char* ret = pointer::getAlignForward(raw, alignment);
+				if (ret != raw)
+					munmap(raw, ret - raw);
+				if (ret + size != raw + size + alignment)
+					munmap(ret + size, (raw + size + alignment) - (ret + size));
+				return ret;
+#endif
+			}
+
+			inline bool commit(void* ptr, size_t size) noexcept {
+#ifdef _WIN32
+				return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+				return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+			}
+
+			inline void decommit(void* ptr, size_t size) noexcept {
+#ifdef _WIN32
+				VirtualFree(ptr, size, MEM_DECOMMIT);
+#else
+				madvise(ptr, size, MADV_DONTNEED);
+				mprotect(ptr, size, PROT_NONE);
+#endif
+			}
+
+			inline void release(void* ptr, size_t size) noexcept {
+#ifdef _WIN32
+				VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+				munmap(ptr, size);
+#endif
+			}
+
+			// Reserve and commit in one go
+			inline void* allocate(size_t size, size_t alignment = 0) noexcept {
+#ifndef _WIN32
+				if (alignment <= pageSize()) {
+					void* ret = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+					return ret == MAP_FAILED ? nullptr : ret;
+				}
+#endif
+				void* ret = reserve(size, alignment);
+				if (ret != nullptr && !commit(ret, size)) {
+					release(ret, size);
+					return nullptr;
+				}
+				return ret;
+			}
+
+			inline void discard(void* ptr, size_t size) noexcept {
+#ifdef _WIN32
+				// MEM_RESET would leave garbage behind, decommit and commit again so the pages come back zeroed
+				VirtualFree(ptr, size, MEM_DECOMMIT);
+				VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE);
+#else
+				madvise(ptr, size, MADV_DONTNEED);
+#endif
+			}
+
+			// Discards all the whole pages that lie in [begin, end).
+			// Returns the number of bytes that were given back.
+			inline size_t discardPagesWithin(void* begin, void* end) noexcept {
+				char* first = pointer::getAlignForward(static_cast<char*>(begin), pageSize());
+				char* last = pointer::getAlignBackward(static_cast<char*>(end), pageSize());
+				if (first >= last)
+					return 0;
+				discard(first, last - first);
+				return last - first;
+			}
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef __LEGO_DETAIL_ZERO_MEMORY_H__
+#define __LEGO_DETAIL_ZERO_MEMORY_H__
+
+// Helpers for allocateZeroed().
+// Clearing memory that is already zero is pure waste: fresh pages from the OS and
+// pages we've discarded come back zeroed, and touching them just to write zeros faults them all in.
+// So allocators remember where their clean memory is, and only clear the rest.
+
+#include <cstring>
+#include <type_traits>
+#include "../blk.h"
+
+namespace lego {
+	namespace detail {
+		// Allocators whose fresh memory is always zero declare
+		//     static constexpr bool allocatesZeroed = true;
+		// so the allocators built on top of them know it starts out clean.
+		template<class Allocator, class = void>
+		struct AllocatesZeroed : std::false_type {};
+
+		template<class Allocator>
+		struct AllocatesZeroed<Allocator, std::void_t<decltype(Allocator::allocatesZeroed)>> : std::bool_constant<Allocator::allocatesZeroed> {};
+
+		// memset is already vectorized by the C library, and turns big clears into non-temporal stores
+		inline void zero(Blk blk) noexcept {
+			if (blk)
+				memset(blk.ptr, 0, blk.size);
+		}
+
+		// Clears the parts of 'blk' that lie outside of [cleanBegin, cleanEnd), which is known to be zero.
+		// ------------------------------------------
+		// | memset |      clean       |   memset   |
+		// ------------------------------------------
+		// ^ blk.ptr ^ cleanBegin      ^ cleanEnd
+		inline void zeroOutside(Blk blk, const void* cleanBegin, const void* cleanEnd) noexcept {
+			if (!blk)
+				return;
+
+			char* begin = static_cast<char*>(blk.ptr);
+			char* end = begin + blk.size;
+			const char* first = static_cast<const char*>(cleanBegin);
+			const char* last = static_cast<const char*>(cleanEnd);
+
+			if (first >= last || first >= end || last <= begin) {
+				memset(begin, 0, blk.size);
+				return;
+			}
+			if (first > begin)
+				memset(begin, 0, first - begin);
+			if (last < end)
+				memset(begin + (last - begin), 0, end - last);
+		}
+	}
+}
+
+#endif
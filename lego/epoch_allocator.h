@@ -0,0 +1,275 @@
+#ifndef __LEGO_EPOCH_ALLOCATOR_H__
+#define __LEGO_EPOCH_ALLOCATOR_H__
+
+// Deferred freeing for lock-free data structures (epoch based reclamation).
+// A node that was unlinked may still be read by threads that found it just before.
+// So instead of deallocate(), retire() it: it's freed once every thread has moved on.
+//
+// Threads pin() for as long as they hold pointers into the structure:
+//     auto guard = allocator.pin();
+//     Node* node = head.load(); ...
+//     if (head.compare_exchange_strong(node, node->next))
+//         allocator.retire({ node, sizeof(Node) });
+//
+// There is one global epoch. A pinned thread announces the epoch it saw.
+// The epoch only moves forward once every pinned thread has seen the current one,
+// so anything retired two epochs ago can't be reached by anyone anymore.
+//
+// Every thread keeps its retired blocks in three lists, one per epoch in flight,
+// and frees them in batches. The lists are kept in Bags from the Parent, not in the blocks:
+// a retired block may still be read, so it must stay exactly as it was until it's freed.
+// Threads are numbered with detail::threadIndex(), and the first MaxThreads of them get a slot each.
+// Threads beyond that share one more slot behind a lock. While any of them is pinned, the shared slot
+// stays in the epoch the first one saw, so the epoch moves slower, but nothing is freed too early.
+//
+// Blocks are freed by whichever thread retired them, so the Parent must be safe to use from any thread.
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "blk.h"
+
+#include "detail/owner_map.h"
+#include "detail/spin_lock.h"
+#include "detail/thread_index.h"
+
+namespace lego {
+	template<class Parent, size_t MaxThreads = 64>
+	class EpochAllocator
+	{
+		static_assert(MaxThreads != 0);
+
+		// Try to move the epoch forward every this many retires
+		constexpr static size_t collectEvery = 64;
+		constexpr static size_t lists = 3;
+
+		// Retired blocks, a few dozen to a node
+		struct Bag {
+			Bag* next;
+			size_t count;
+			Blk blks[collectEvery];
+		};
+
+		// Each on its own cache line, other threads read 'state' on every collect
+		struct alignas(64) Slot {
+			// (epoch << 1) | 1 while pinned, 0 otherwise
+			std::atomic<uint64_t> state = { 0 };
+
+			// Only touched by the thread that owns the slot
+			size_t depth = 0;
+			size_t retiredSinceCollect = 0;
+			Bag* retired[lists] = {};
+			uint64_t retiredEpoch[lists] = {};
+		};
+
+		Parent parent;
+		std::atomic<uint64_t> epoch = { 0 };
+
+		// MaxThreads + 1, the last one is shared by the threads beyond MaxThreads and guarded by overflowLock
+		Slot slots[MaxThreads + 1];
+		detail::SpinLock overflowLock;
+
+		// Runs 'body' on the calling thread's slot
+		template<class Body>
+		auto withMySlot(Body body) noexcept {
+			size_t index = detail::threadIndex();
+			if (index < MaxThreads)
+				return body(slots[index]);
+
+			std::lock_guard<detail::SpinLock> guard(overflowLock);
+			return body(slots[MaxThreads]);
+		}
+
+		void release(Bag*& list) noexcept {
+			while (list != nullptr) {
+				Bag* next = list->next;
+				for (size_t i = 0; i < list->count; ++i) {
+					parent.deallocate(list->blks[i]);
+				}
+				parent.deallocate({ list, sizeof(Bag) });
+				list = next;
+			}
+		}
+
+		// Frees everything of ours that was retired at least two epochs before 'current'
+		void releaseBefore(Slot& slot, uint64_t current) noexcept {
+			for (size_t i = 0; i < lists; ++i) {
+				if (slot.retired[i] != nullptr && slot.retiredEpoch[i] + 2 <= current)
+					release(slot.retired[i]);
+			}
+		}
+
+		// The epoch can move once nobody is pinned in an older one
+		bool tryAdvance() noexcept {
+			uint64_t current = epoch.load(std::memory_order_seq_cst);
+			for (auto& slot : slots) {
+				uint64_t state = slot.state.load(std::memory_order_seq_cst);
+				if ((state & 1) && (state >> 1) != current)
+					return false;
+			}
+			return epoch.compare_exchange_strong(current, current + 1, std::memory_order_seq_cst);
+		}
+
+		void unpin() noexcept {
+			withMySlot([&](Slot& slot) {
+				assert(slot.depth != 0);
+				if (--slot.depth == 0)
+					slot.state.store(0, std::memory_order_release);
+			});
+		}
+
+		void collect(Slot& slot) noexcept {
+			slot.retiredSinceCollect = 0;
+			tryAdvance();
+			releaseBefore(slot, epoch.load(std::memory_order_seq_cst));
+		}
+
+		// Waits until every thread that could have seen a block retired now has unpinned.
+		// The caller must not be pinned, or it would wait for itself.
+		void synchronize() noexcept {
+			uint64_t target = epoch.load(std::memory_order_seq_cst) + 2;
+			while (epoch.load(std::memory_order_seq_cst) < target) {
+				if (!tryAdvance())
+					std::this_thread::yield();
+			}
+		}
+
+		// Files 'blk' under the current epoch. Fails when there's no memory for a new Bag.
+		bool addRetired(Slot& slot, Blk blk) noexcept {
+			uint64_t current = epoch.load(std::memory_order_seq_cst);
+
+			// The list for this epoch last held blocks from three epochs ago, which are safe by now
+			size_t index = current % lists;
+			if (slot.retiredEpoch[index] != current) {
+				release(slot.retired[index]);
+				slot.retiredEpoch[index] = current;
+			}
+
+			Bag* bag = slot.retired[index];
+			if (bag == nullptr || bag->count == collectEvery) {
+				Blk memory = parent.allocate(sizeof(Bag), alignof(Bag));
+				if (!memory)
+					return false;
+				bag = static_cast<Bag*>(memory.ptr);
+				bag->next = slot.retired[index];
+				bag->count = 0;
+				slot.retired[index] = bag;
+			}
+			bag->blks[bag->count++] = blk;
+			return true;
+		}
+
+	public:
+		static constexpr bool ownsUnclaimed = detail::OwnsUnclaimed<Parent>::value;
+
+		// Keeps the calling thread pinned while it's alive. Pins can be nested.
+		class Guard {
+			EpochAllocator* owner;
+		public:
+			explicit Guard(EpochAllocator* owner) noexcept : owner(owner) {}
+			Guard(Guard&& other) noexcept : owner(other.owner) { other.owner = nullptr; }
+			Guard(const Guard&) = delete;
+			Guard& operator=(const Guard&) = delete;
+			Guard& operator=(Guard&&) = delete;
+
+			~Guard() {
+				if (owner != nullptr)
+					owner->unpin();
+			}
+		};
+
+		EpochAllocator() = default;
+		EpochAllocator(const EpochAllocator&) = delete;
+		EpochAllocator& operator=(const EpochAllocator&) = delete;
+
+		// Nobody may be pinned anymore, so everything can go
+		~EpochAllocator() {
+			for (auto& slot : slots) {
+				for (auto& list : slot.retired) {
+					release(list);
+				}
+			}
+		}
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+			return parent.allocate(size, alignment);
+		}
+
+		// Frees right away. Only for blocks that no other thread has seen, use retire() for the rest.
+		void deallocate(Blk blk)
+		{
+			parent.deallocate(blk);
+		}
+
+		bool owns(Blk blk) const noexcept {
+			return parent.owns(blk);
+		}
+
+		bool ownsClaimed(Blk blk) const {
+			return detail::ownsClaimed(parent, blk);
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return parent.goodSize(size);
+		}
+
+		Guard pin() noexcept {
+			withMySlot([&](Slot& slot) {
+				if (slot.depth++ == 0) {
+					slot.state.store((epoch.load(std::memory_order_relaxed) << 1) | 1, std::memory_order_seq_cst);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+				}
+			});
+			return Guard(this);
+		}
+
+		// Frees the block once no thread can be reading it anymore.
+		// If there's no memory to keep track of it, what is safe gets freed first to make room.
+		// Still nothing? A thread that isn't pinned waits for the others to move on and frees the block right away.
+		// A pinned one can't, and gets false back: the block is still the caller's, retire it again later.
+		bool retire(Blk blk) noexcept {
+			if (!blk)
+				return true;
+
+			assert(owns(blk));
+
+			bool unpinned = false;
+			bool retired = withMySlot([&](Slot& slot) {
+				if (addRetired(slot, blk)) {
+					if (++slot.retiredSinceCollect >= collectEvery)
+						collect(slot);
+					return true;
+				}
+
+				collect(slot);
+				if (addRetired(slot, blk))
+					return true;
+
+				// Others share the overflow slot, so it being unpinned doesn't tell us anything
+				unpinned = slot.depth == 0 && &slot != &slots[MaxThreads];
+				return false;
+			});
+			if (retired || !unpinned)
+				return retired;
+
+			synchronize();
+			parent.deallocate(blk);
+			return true;
+		}
+
+		// Tries to move the epoch forward and frees what the calling thread retired that is now safe.
+		// retire() calls this every so often. Call it when a thread goes quiet, so its last blocks don't wait forever.
+		void collect() noexcept {
+			withMySlot([&](Slot& slot) {
+				collect(slot);
+			});
+		}
+	};
+}
+
+#endif
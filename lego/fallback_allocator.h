@@ -2,9 +2,12 @@
 #define __LEGO_FALLBACK_ALLOCATOR_H__
 
 // If the Primary allocator fails, the Fallback allocator will allocate.
+// Blocks are given back through the owner map when their owner registered, so the order doesn't matter for those.
 #include <cassert>
 #include "blk.h"
 
+#include "detail/owner_map.h"
+
 
 namespace lego {
 	template <class Primary, class Fallback>
@@ -13,7 +16,9 @@ namespace lego {
 		Primary primary = {};
 		Fallback fallback = {};
 	public:
-		Blk allocate(size_t size, uint8_t alignment)
+		static constexpr bool ownsUnclaimed = detail::OwnsUnclaimed<Primary>::value || detail::OwnsUnclaimed<Fallback>::value;
+
+		Blk allocate(size_t size, size_t alignment)
 		{
 			assert(size && alignment);
 
@@ -25,12 +30,29 @@ namespace lego {
 			return blk;
 		}
 
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+
+			Blk blk = primary.allocateZeroed(size, alignment);
+			if (!blk) {
+				return fallback.allocateZeroed(size, alignment);
+			}
+
+			return blk;
+		}
+
 		void deallocate(Blk blk) noexcept  // Use pointer if pointer is not a value_type*
 		{
 			if (!blk)
 				return;
 
-			if (primary.owns(blk))
+			const void* owner = detail::ownerOf(blk.ptr);
+			if (detail::isWithin(primary, owner))
+				primary.deallocate(blk);
+			else if (detail::isWithin(fallback, owner))
+				fallback.deallocate(blk);
+			else if (detail::claims(primary, fallback, blk))
 				primary.deallocate(blk);
 			else if (fallback.owns(blk))
 				fallback.deallocate(blk);
@@ -39,9 +61,24 @@ namespace lego {
 		}
 
 		bool owns(const Blk& blk) const {
+			const void* owner = detail::ownerOf(blk.ptr);
+			if (detail::isWithin(primary, owner))
+				return primary.owns(blk);
+			if (detail::isWithin(fallback, owner))
+				return fallback.owns(blk);
 			return primary.owns(blk) || fallback.owns(blk);
 		}
 
+		// Like owns(), but leaves out what only a child that owns the unclaimed would take
+		bool ownsClaimed(const Blk& blk) const {
+			return detail::ownsClaimed(primary, blk) || detail::ownsClaimed(fallback, blk);
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return primary.goodSize(size);
+		}
+
 
 
 	};
@@ -8,8 +8,11 @@
 #include <utility>
 #include "blk.h"
 
+#include "detail/owner_map.h"
 #include "detail/pointer.h"
 #include "detail/predef_freelist_strategies.h"
+#include "detail/virtual_memory.h"
+#include "detail/zero_memory.h"
 #include "local_allocator.h"
 #include "heap_allocator.h"
 
@@ -19,24 +22,34 @@ namespace lego {
 	class FreeListAllocator {
 		static_assert(Capacity != 0);
 	protected:
+		// 'decommitted' is set once trim() has given the pages inside this block back to the OS,
+		// which also means they are zero.
 		union FreeBlock {
 			struct {
 				size_t size;
 				FreeBlock* next;
+				bool decommitted;
 			};
 		protected:
 			max_align_t Align;
 		};
 
+		// 'adjustment' is the padding between the start of the block and the Header.
+		// It's only non-zero for over-aligned requests (bigger than max_align_t).
 		union Header {
-			size_t size;
+			struct {
+				size_t size;
+				size_t adjustment;
+			};
 		protected:
 			max_align_t Align;
 		};
 
 		Blk memory = {};
 		char* start = nullptr;
+		detail::OwnerRegistration registration;
 		FreeBlock* freeList = nullptr;
+		size_t trimThreshold = 0;
 		Allocator allocator;
 		FitStrategy fitStrategy;
 
@@ -77,9 +90,13 @@ namespace lego {
 			memory = allocator.allocate(Capacity, alignof(max_align_t));
 			assert(memory);
 			start = static_cast<char*>(memory.ptr);
+			registration.assign(this, start, Capacity);
 
 			deallocateAll();
 
+			// Memory that is zero to begin with is as good as decommitted
+			freeList->decommitted = detail::AllocatesZeroed<Allocator>::value;
+
 			// The whole allocator must be able to contain at least a minimum block size
 			assert(freeList->size > minBlockSize);
 		}
@@ -87,11 +104,122 @@ namespace lego {
 
 		~FreeListAllocator()
 		{
+			registration.reset();
 			allocator.deallocate(memory);
 		}
 
 
-		Blk allocate(size_t size, uint8_t alignment) {
+		Blk allocate(size_t size, size_t alignment) {
+			return allocateBlock(size, alignment, false);
+		}
+
+		// Only the pages that trim() has given back are known to be zero, the rest is cleared
+		Blk allocateZeroed(size_t size, size_t alignment) {
+			return allocateBlock(size, alignment, true);
+		}
+
+		bool owns(Blk blk) const noexcept {
+			return reinterpret_cast<char*>(blk.ptr) >= start && reinterpret_cast<char*>(blk.ptr) < start + Capacity;
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return detail::pointer::roundToAlignment(size, alignof(max_align_t));
+		}
+
+		// Reset all variables to start
+		void deallocateAll() noexcept {
+			this->freeList = reinterpret_cast<FreeBlock*>(start);
+			this->freeList->size = Capacity;
+			this->freeList->next = nullptr;
+			this->freeList->decommitted = false;
+		}
+
+		// Gives the whole pages inside free blocks back to the OS. 
+		// They are faulted back in (zeroed) when they get allocated again.
+		// Returns the number of bytes given back.
+		size_t trim() noexcept {
+			size_t ret = 0;
+			for (FreeBlock* itr = freeList; itr != nullptr; itr = itr->next) {
+				ret += trimBlock(itr);
+			}
+			return ret;
+		}
+
+		// Trims a free block automatically once it grows to at least 'bytes' on deallocate. 0 turns it off.
+		void setTrimThreshold(size_t bytes) noexcept {
+			trimThreshold = bytes;
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			assert(owns(blk));
+
+			Header* header = reinterpret_cast<Header*>(detail::pointer::sub(blk.ptr, sizeof(Header)));
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(detail::pointer::sub(header, header->adjustment));
+			size_t blockSize = header->size;
+			uintptr_t blockEnd = reinterpret_cast<uintptr_t>(detail::pointer::add(block, blockSize));
+
+			// Look for a FreeBlock which we can combine
+			FreeBlock* itr = freeList;
+			FreeBlock* prev = nullptr;
+			while (itr != nullptr) {
+				// search until we are past the current block
+				if (reinterpret_cast<uintptr_t>(itr) >= blockEnd)
+					break;
+				prev = itr;
+				itr = itr->next;
+			}
+
+			// if there is no prev block, that means itr is at the start of the block
+			// set the head of freeList to be this 
+			if (prev == nullptr) {
+				// use prev for the next step of combining with the next block
+				prev = block;
+				prev->size = blockSize;
+				prev->next = freeList;
+				freeList = prev;
+			}
+
+			else if (reinterpret_cast<uintptr_t>(prev) + prev->size == reinterpret_cast<uintptr_t>(block)) {
+				// If the previous block is directly next to this block, combine by just adding this block's size 
+				// to the prev block's size
+				prev->size += blockSize;
+			}
+
+			else {
+				// Here, there is a prev block, but it is not next to the current block, so we can't combine
+				// So we turn the current block into a Free
+				// The header may be overwritten from here on, which is why we saved blockSize.
+				block->size = blockSize;
+				block->next = prev->next;
+
+				// update prev block
+				prev->next = block;
+
+				// set this for the next step of combining with the next block
+				prev = block;
+			}
+
+			// Check if we can combine prev with the NEXT block
+			if (itr != nullptr && reinterpret_cast<uintptr_t>(itr) == blockEnd)
+			{
+				prev->size += itr->size;
+				prev->next = itr->next;
+			}
+
+			// The block we just freed is dirty, so whatever it got combined into is too
+			prev->decommitted = false;
+
+			if (trimThreshold != 0 && prev->size >= trimThreshold)
+				trimBlock(prev);
+		}
+
+	protected:
+		Blk allocateBlock(size_t size, size_t alignment, bool zeroed) {
 			assert(size && alignment);
 
 			// Calculate the size of the header + object rounded to alignment.
@@ -99,18 +227,33 @@ namespace lego {
 			size_t roundObjectSize = detail::pointer::roundToAlignment(size, alignof(max_align_t));
 			size_t totalSize = sizeof(Header) + roundObjectSize;
 
+			// Over-aligned objects may need padding in front of the Header.
+			// Blocks always start at max_align_t, so the worst case is alignment - alignof(max_align_t).
+			size_t worstPadding = alignment > alignof(max_align_t) ? alignment - alignof(max_align_t) : 0;
+
 
 			// result->first is previous node.
 			// result->second is the node that fits.
-			auto [prev, itr] = fitStrategy.find(iterator(freeList), iterator(nullptr), totalSize);
+			auto [prev, itr] = fitStrategy.find(iterator(freeList), iterator(nullptr), totalSize + worstPadding);
 			
 
+			// Could not find a block that fits
 			if ((*itr) == nullptr)
 				return {};
 
+			// Remember which pages are still zero before we write into the block
+			char* cleanBegin = nullptr;
+			char* cleanEnd = nullptr;
+			if (zeroed && (*itr)->decommitted) {
+				cleanBegin = detail::pointer::getAlignForward(reinterpret_cast<char*>(*itr + 1), detail::virtual_memory::pageSize());
+				cleanEnd = detail::pointer::getAlignBackward(reinterpret_cast<char*>(*itr) + (*itr)->size, detail::virtual_memory::pageSize());
+			}
 
+			// Now that we know where the block is, we know the real padding.
+			// It is a multiple of max_align_t, so the block after this one stays aligned.
+			size_t adjustment = detail::pointer::getAlignForwardDiff(detail::pointer::add(*itr, sizeof(Header)), alignment);
+			totalSize += adjustment;
 
-			// Could not find a block that fits
 			
 			// Here, we have found a block that fits and update our freeList.
 			// Check if the block can be split after allocation.
@@ -138,6 +281,11 @@ namespace lego {
 				nextBlock->size = remainingSize;
 				nextBlock->next = (*itr)->next;
 
+				// Writing the new FreeBlock may fault a page that trim() gave back in again.
+				// That's fine: what counts as clean starts at the first page after the FreeBlock
+				// (see allocateBlock and trimBlock), so the pages behind it are as decommitted as before.
+				nextBlock->decommitted = (*itr)->decommitted;
+
 			}
 
 			// Here, we update our linked list!
@@ -152,83 +300,27 @@ namespace lego {
 			}
 
 			// Get and Update the header
-			Header* header = reinterpret_cast<Header*>(*itr);
+			Header* header = reinterpret_cast<Header*>(detail::pointer::add(*itr, adjustment));
 			header->size = totalSize;
+			header->adjustment = adjustment;
 
-			// Get the object to return to the user
-			void* ret = detail::pointer::add(*itr, sizeof(Header));
-			return { ret, size };
-		}
+			// Get the object to return to the user.
+			// Everything up to the end of the block is theirs, including the rounding and whatever was too small to split off.
+			void* ret = detail::pointer::add(header, sizeof(Header));
+			Blk blk = { ret, totalSize - adjustment - sizeof(Header) };
 
-		bool owns(Blk blk) const noexcept {
-			return reinterpret_cast<char*>(blk.ptr) >= start && reinterpret_cast<char*>(blk.ptr) < start + Capacity;
+			if (zeroed)
+				detail::zeroOutside(blk, cleanBegin, cleanEnd);
+			return blk;
 		}
 
-		// Reset all variables to start
-		void deallocateAll() noexcept {
-			this->freeList = reinterpret_cast<FreeBlock*>(start);
-			this->freeList->size = Capacity;
-			this->freeList->next = nullptr;
-		}
-
-		void deallocate(Blk blk)
-		{
-			if (!blk)
-				return;
+		// Everything after the FreeBlock itself can be given back
+		size_t trimBlock(FreeBlock* block) noexcept {
+			if (block->decommitted)
+				return 0;
 
-			assert(owns(blk));
-
-			Header* header = reinterpret_cast<Header*>(detail::pointer::sub(blk.ptr, sizeof(Header)));
-			uintptr_t blockEnd = reinterpret_cast<uintptr_t>(detail::pointer::add(header, header->size));
-
-			// Look for a FreeBlock which we can combine
-			FreeBlock* itr = freeList;
-			FreeBlock* prev = nullptr;
-			while (itr != nullptr) {
-				// search until we are past the current block
-				if (reinterpret_cast<uintptr_t>(itr) >= blockEnd)
-					break;
-				prev = itr;
-				itr = itr->next;
-			}
-
-			// if there is no prev block, that means itr is at the start of the block
-			// set the head of freeList to be this 
-			if (prev == nullptr) {
-				// use prev for the next step of combining with the next block
-				prev = reinterpret_cast<FreeBlock*>(header);
-				prev->size = header->size;
-				prev->next = freeList;
-				freeList = prev;
-			}
-
-			else if (reinterpret_cast<uintptr_t>(prev) + prev->size == reinterpret_cast<uintptr_t>(header)) {
-				// If the previous block is directly next to this block, combine by just adding this block's size 
-				// to the prev block's size
-				prev->size += header->size;
-			}
-
-			else {
-				// Here, there is a prev block, but it is not next to the current block, so we can't combine
-				// So we turn the current block into a Free
-				FreeBlock* temp = reinterpret_cast<FreeBlock*>(header);
-				// a bit of a tightrope here, but it should be fine because we have not touched the memory around header->size
-				temp->size = header->size;
-				temp->next = prev->next; // now, header->size is gone.
-
-				// update prev block
-				prev->next = temp;
-
-				// set this for the next step of combining with the next block
-				prev = temp;
-			}
-
-			// Check if we can combine prev with the NEXT block
-			if (itr != nullptr && reinterpret_cast<uintptr_t>(itr) == blockEnd)
-			{
-				prev->size += itr->size;
-				prev->next = itr->next;
-			}
+			block->decommitted = true;
+			return detail::virtual_memory::discardPagesWithin(block + 1, detail::pointer::add(block, block->size));
 		}
 	};
 
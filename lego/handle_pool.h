@@ -0,0 +1,278 @@
+#ifndef __LEGO_HANDLE_POOL_H__
+#define __LEGO_HANDLE_POOL_H__
+
+// Pool of T that hands out generational handles instead of pointers, so that it can move its objects.
+// Handles go through a table to find their object:
+//
+//  handle                    table                      objects
+// -----------------------    --------------------       -------------------------
+// | generation | index  | -> | slot | generation | ->  | T | hole | T | T | ... |
+// -----------------------    --------------------       -------------------------
+//
+// Objects are placed one after the other. Destroying one leaves a hole, and compact() slides
+// the objects behind it down, a few at a time, and patches the table. So the objects stay dense
+// and in creation order no matter how long the pool lives.
+//
+// The index takes as many bits as Capacity needs, the generation gets the rest.
+// Destroying an object bumps its generation, so old handles to it are detected instead of
+// reaching whatever lives there next. Generations wrap, use a 64-bit HandleType if
+// an entry may be reused more often than that while a stale handle is still around.
+//
+// Pointers from get() are only good until the next compact().
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "blk.h"
+
+#include "detail/pointer.h"
+#include "heap_allocator.h"
+
+namespace lego {
+	template<class T, size_t Capacity, class Allocator, class HandleType = uint32_t>
+	class HandlePool
+	{
+		static_assert(Capacity != 0);
+		static_assert(std::is_unsigned<HandleType>::value, "HandleType must be an unsigned integer");
+
+		constexpr static size_t bitsFor(size_t value) noexcept {
+			size_t bits = 1;
+			while (value >>= 1)
+				++bits;
+			return bits;
+		}
+
+		constexpr static size_t indexBits = bitsFor(Capacity - 1);
+		constexpr static size_t generationBits = std::numeric_limits<HandleType>::digits - indexBits;
+		static_assert(generationBits >= 8, "Capacity leaves too few bits for the generation, use a bigger HandleType");
+
+		constexpr static HandleType indexMask = static_cast<HandleType>((HandleType(1) << indexBits) - 1);
+		constexpr static HandleType maxGeneration = static_cast<HandleType>(std::numeric_limits<HandleType>::max() >> indexBits);
+		constexpr static HandleType noOwner = std::numeric_limits<HandleType>::max();
+
+		// 'slot' is where the object lives, or the next free entry while the entry is free.
+		// 'generation' is the one of the live handle, or the one the next handle will get.
+		struct Entry {
+			HandleType slot;
+			HandleType generation;
+		};
+
+		// One allocation for everything:
+		// ----------------------------------------------
+		// | objects | entries           | owners       |
+		// ----------------------------------------------
+		// owners[slot] is the entry of the object in that slot, or noOwner for a hole.
+		constexpr static size_t entriesOffset = detail::pointer::roundToAlignment(Capacity * sizeof(T), alignof(Entry));
+		constexpr static size_t ownersOffset = entriesOffset + Capacity * sizeof(Entry);
+		constexpr static size_t totalSize = ownersOffset + Capacity * sizeof(HandleType);
+
+		Allocator allocator;
+		Blk memory = {};
+		T* objects = nullptr;
+		Entry* entries = nullptr;
+		HandleType* owners = nullptr;
+
+		// Free entries, and the ones that were never used
+		HandleType freeEntry = noOwner;
+		size_t untouchedEntry = 0;
+
+		// Objects live in [0, top), with holes in between
+		size_t top = 0;
+		size_t live = 0;
+
+		// Where the current compaction has got to. Everything in [write, read) is a hole.
+		size_t write = 0;
+		size_t read = 0;
+
+	public:
+		class Handle {
+			friend class HandlePool;
+			HandleType value = 0;
+			explicit Handle(HandleType value) noexcept : value(value) {}
+		public:
+			Handle() = default;
+
+			explicit operator bool() const noexcept {
+				return value != 0;
+			}
+
+			bool operator==(const Handle& rhs) const noexcept {
+				return value == rhs.value;
+			}
+
+			bool operator!=(const Handle& rhs) const noexcept {
+				return value != rhs.value;
+			}
+
+			HandleType raw() const noexcept {
+				return value;
+			}
+		};
+
+	private:
+		static size_t indexOf(Handle handle) noexcept {
+			return handle.value & indexMask;
+		}
+
+		static HandleType generationOf(Handle handle) noexcept {
+			return static_cast<HandleType>(handle.value >> indexBits);
+		}
+
+		Entry* find(Handle handle) const noexcept {
+			size_t index = indexOf(handle);
+			if (!handle || index >= untouchedEntry)
+				return nullptr;
+
+			Entry* entry = &entries[index];
+			return entry->generation == generationOf(handle) ? entry : nullptr;
+		}
+
+		void move(size_t from, size_t to) {
+			new (&objects[to]) T(std::move(objects[from]));
+			objects[from].~T();
+
+			owners[to] = owners[from];
+			owners[from] = noOwner;
+			entries[owners[to]].slot = static_cast<HandleType>(to);
+		}
+
+	public:
+		HandlePool() {
+			memory = allocator.allocate(totalSize, alignof(T) > alignof(max_align_t) ? alignof(T) : alignof(max_align_t));
+			assert(memory);
+
+			char* start = static_cast<char*>(memory.ptr);
+			objects = reinterpret_cast<T*>(start);
+			entries = reinterpret_cast<Entry*>(start + entriesOffset);
+			owners = reinterpret_cast<HandleType*>(start + ownersOffset);
+		}
+
+		HandlePool(const HandlePool&) = delete;
+		HandlePool& operator=(const HandlePool&) = delete;
+
+		~HandlePool() {
+			for (size_t slot = 0; slot < top; ++slot) {
+				if (owners[slot] != noOwner)
+					objects[slot].~T();
+			}
+			allocator.deallocate(memory);
+		}
+
+		// Returns an empty Handle when the pool is full
+		template<class... Args>
+		Handle create(Args&&... args) {
+			if (live == Capacity)
+				return {};
+
+			// Out of room at the top, so close all the holes first
+			if (top == Capacity)
+				compact(Capacity);
+
+			HandleType index;
+			if (freeEntry != noOwner) {
+				index = freeEntry;
+				freeEntry = entries[index].slot;
+			}
+			else {
+				index = static_cast<HandleType>(untouchedEntry++);
+				entries[index].generation = 1;
+			}
+
+			new (&objects[top]) T(std::forward<Args>(args)...);
+			owners[top] = index;
+			entries[index].slot = static_cast<HandleType>(top);
+			++top;
+			++live;
+
+			return Handle(static_cast<HandleType>((static_cast<HandleType>(entries[index].generation) << indexBits) | index));
+		}
+
+		// Stale handles are ignored
+		void destroy(Handle handle) {
+			Entry* entry = find(handle);
+			if (entry == nullptr)
+				return;
+
+			size_t slot = entry->slot;
+			objects[slot].~T();
+			owners[slot] = noOwner;
+			--live;
+
+			// Old handles must not match the next object in this entry. 0 is never used, so that no Handle is 0.
+			entry->generation = entry->generation == maxGeneration ? 1 : entry->generation + 1;
+			entry->slot = freeEntry;
+			freeEntry = static_cast<HandleType>(indexOf(handle));
+
+			// The top hole can go right away
+			while (top > read && owners[top - 1] == noOwner)
+				--top;
+		}
+
+		// nullptr if the handle is stale
+		T* get(Handle handle) const noexcept {
+			Entry* entry = find(handle);
+			return entry != nullptr ? &objects[entry->slot] : nullptr;
+		}
+
+		bool isValid(Handle handle) const noexcept {
+			return find(handle) != nullptr;
+		}
+
+		// Slides up to 'budget' objects down into the holes before them.
+		// Call it a bit every frame or request, the work carries on where it stopped.
+		// Returns how many objects were moved.
+		size_t compact(size_t budget) {
+			size_t moved = 0;
+			while (moved < budget) {
+				// Start a new pass at the first hole
+				if (read == write) {
+					while (write < top && owners[write] != noOwner)
+						++write;
+					read = write;
+				}
+
+				// Skip to the next object to move
+				while (read < top && owners[read] == noOwner)
+					++read;
+
+				if (read >= top) {
+					// Everything from 'write' on is a hole now
+					top = write;
+					read = write = 0;
+					break;
+				}
+
+				move(read++, write++);
+				++moved;
+			}
+			return moved;
+		}
+
+		size_t size() const noexcept {
+			return live;
+		}
+
+		// How many slots below the top are holes
+		size_t holes() const noexcept {
+			return top - live;
+		}
+
+		// Visits the objects in memory order
+		template<class Function>
+		void forEach(Function&& function) {
+			for (size_t slot = 0; slot < top; ++slot) {
+				if (owners[slot] != noOwner)
+					function(objects[slot]);
+			}
+		}
+	};
+
+
+	template<class T, size_t Capacity, class HandleType = uint32_t>
+	using HeapHandlePool = HandlePool<T, Capacity, HeapAllocator, HandleType>;
+}
+
+#endif
@@ -3,27 +3,83 @@
 
 // Simple allocator that reserves memory on the heap.
 // Sometimes called the Mallocator.
+//
+// Any power of 2 alignment is supported (e.g. 4096 for O_DIRECT buffers).
+// We go through the platform's aligned malloc instead of aligned operator new,
+// because aligned operator delete needs the alignment back and a Blk does not carry it.
 #include <cassert>
+#include <cstdlib>
 #include "blk.h"
+#include "detail/owner_map.h"
+#include "detail/pointer.h"
+#include "detail/zero_memory.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
 
 namespace lego {
 	class HeapAllocator
 	{
 	public:
-		Blk allocate(size_t size, uint8_t alignment)
+		// owns() can only tell that no arena has claimed a block, see detail/owner_map.h
+		static constexpr bool ownsUnclaimed = true;
+
+		Blk allocate(size_t size, size_t alignment)
 		{
 			assert(size && alignment);
-			return { ::operator new(size),	size };
+			assert(detail::pointer::isPowerOfTwo(alignment));
+
+#ifdef _WIN32
+			void* ptr = _aligned_malloc(size, alignment);
+#else
+			// posix_memalign requires the alignment to be at least sizeof(void*)
+			void* ptr = nullptr;
+			if (posix_memalign(&ptr, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) != 0)
+				ptr = nullptr;
+#endif
+			if (ptr == nullptr)
+				return {};
+
+			return { ptr, size };
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+#ifndef _WIN32
+			// calloc knows when its memory comes fresh from the OS and skips clearing it.
+			// It only gives max_align_t alignment, and _aligned_free can't free it on Windows.
+			if (alignment <= alignof(max_align_t)) {
+				assert(size);
+				void* ptr = calloc(1, size);
+				if (ptr == nullptr)
+					return {};
+				return { ptr, size };
+			}
+#endif
+			Blk blk = allocate(size, alignment);
+			detail::zero(blk);
+			return blk;
 		}
 
 		void deallocate(Blk blk)  
 		{
-			::operator delete(blk.ptr);
+#ifdef _WIN32
+			_aligned_free(blk.ptr);
+#else
+			free(blk.ptr);
+#endif
 		}
 
+		// Anything no arena has claimed in the owner map
 		bool owns(Blk blk) const noexcept {
-			return true;
+			return detail::ownerOf(blk.ptr) == nullptr;
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return size;
 		}
 
 
@@ -31,4 +87,4 @@ namespace lego {
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,309 @@
+#ifndef __LEGO_LATENCY_PROBE_ALLOCATOR_H__
+#define __LEGO_LATENCY_PROBE_ALLOCATOR_H__
+
+// Times every allocate and deallocate of Parent and keeps the timings in histograms,
+// so that the tail latency of any composition shows: the rare long free list walk or parent refill that averages hide.
+//
+// The histograms are log-linear. The first 32 ticks get a bucket each, and from there on
+// every power of two is split into 16 buckets, so a value is never off by more than 1/16 (6%):
+// ------------------------------------------------------------------------
+// | 0 | 1 | ... | 31 | 32-33 | 34-35 | ... | 62-63 | 64-67 | ... | 124-127 | ...
+// ------------------------------------------------------------------------
+//
+// Every thread records into histograms of its own (by threadIndex(), up to MaxThreads of them),
+// which only takes a few plain stores on cache lines no other thread writes.
+// Threads beyond MaxThreads share one more set, with atomic adds.
+// Calls are timed with cycle_clock (rdtsc where there is one), and the ticks are turned into nanoseconds when read.
+//
+// The histograms come straight from the OS, so recording never calls malloc.
+// Parent must be thread safe if the probe is used from several threads.
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include "blk.h"
+
+#include "detail/cycle_clock.h"
+#include "detail/owner_map.h"
+#include "detail/thread_index.h"
+#include "detail/virtual_memory.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace lego {
+	// In nanoseconds
+	struct LatencySummary {
+		uint64_t count;
+		double mean;
+		double p50;
+		double p90;
+		double p99;
+		double p999;
+		double p9999;
+		double max;
+	};
+
+	template<class Parent, size_t MaxThreads = 64>
+	class LatencyProbeAllocator
+	{
+		static_assert(MaxThreads != 0);
+
+		constexpr static size_t subBucketBits = 4;
+		constexpr static size_t subBuckets = size_t(1) << subBucketBits;
+		constexpr static size_t bucketCount = (64 - subBucketBits + 1) * subBuckets;
+
+		struct Histogram {
+			std::atomic<uint64_t> counts[bucketCount];
+			std::atomic<uint64_t> totalTicks;
+			std::atomic<uint64_t> longest;
+		};
+
+		struct alignas(64) ThreadHistograms {
+			Histogram operations[2];
+		};
+
+		Parent parent;
+
+		// MaxThreads + 1, the last one is shared by the threads beyond MaxThreads
+		ThreadHistograms* threads = nullptr;
+		constexpr static size_t tableBytes = (MaxThreads + 1) * sizeof(ThreadHistograms);
+
+		static size_t highestBit(uint64_t value) noexcept {
+#if defined(_MSC_VER) && defined(_M_X64)
+			unsigned long ret;
+			_BitScanReverse64(&ret, value);
+			return ret;
+#elif defined(_MSC_VER)
+			size_t ret = 0;
+			while (value >>= 1)
+				++ret;
+			return ret;
+#else
+			return 63 - __builtin_clzll(value);
+#endif
+		}
+
+		static size_t bucketOf(uint64_t ticks) noexcept {
+			if (ticks < subBuckets)
+				return static_cast<size_t>(ticks);
+			size_t shift = highestBit(ticks) - subBucketBits;
+			return (shift + 1) * subBuckets + static_cast<size_t>(ticks >> shift) - subBuckets;
+		}
+
+		// The highest value that lands in 'bucket'
+		static uint64_t highestOf(size_t bucket) noexcept {
+			if (bucket < 2 * subBuckets)
+				return bucket;
+			size_t shift = bucket / subBuckets - 1;
+			uint64_t lowest = static_cast<uint64_t>(subBuckets + bucket % subBuckets) << shift;
+			return lowest + (uint64_t(1) << shift) - 1;
+		}
+
+		void record(size_t operation, uint64_t ticks) noexcept {
+			size_t index = detail::threadIndex();
+			size_t bucket = bucketOf(ticks);
+			if (index < MaxThreads) {
+				// Nobody else writes here, so there's no need for a locked add
+				Histogram& histogram = threads[index].operations[operation];
+				histogram.counts[bucket].store(histogram.counts[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				histogram.totalTicks.store(histogram.totalTicks.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+				if (ticks > histogram.longest.load(std::memory_order_relaxed))
+					histogram.longest.store(ticks, std::memory_order_relaxed);
+				return;
+			}
+
+			Histogram& histogram = threads[MaxThreads].operations[operation];
+			histogram.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+			histogram.totalTicks.fetch_add(ticks, std::memory_order_relaxed);
+			uint64_t longest = histogram.longest.load(std::memory_order_relaxed);
+			while (ticks > longest && !histogram.longest.compare_exchange_weak(longest, ticks, std::memory_order_relaxed)) {
+			}
+		}
+
+		// All the counts of one operation, over one thread or all of them
+		struct Merged {
+			uint64_t counts[bucketCount];
+			uint64_t count;
+			uint64_t totalTicks;
+			uint64_t longest;
+		};
+
+		void merge(size_t operation, size_t thread, Merged& merged) const noexcept {
+			merged = {};
+			size_t first = thread == allThreads ? 0 : thread;
+			size_t last = thread == allThreads ? MaxThreads : thread;
+			assert(last <= MaxThreads);
+			for (size_t i = first; i <= last; ++i) {
+				const Histogram& histogram = threads[i].operations[operation];
+				for (size_t bucket = 0; bucket < bucketCount; ++bucket) {
+					uint64_t count = histogram.counts[bucket].load(std::memory_order_relaxed);
+					merged.counts[bucket] += count;
+					merged.count += count;
+				}
+				merged.totalTicks += histogram.totalTicks.load(std::memory_order_relaxed);
+				merged.longest = std::max(merged.longest, histogram.longest.load(std::memory_order_relaxed));
+			}
+		}
+
+		// In ticks, never more than the longest call
+		static uint64_t percentileOf(const Merged& merged, double percent) noexcept {
+			if (merged.count == 0)
+				return 0;
+			uint64_t rank = static_cast<uint64_t>(std::ceil(percent / 100.0 * merged.count));
+			rank = std::max<uint64_t>(rank, 1);
+			uint64_t seen = 0;
+			for (size_t bucket = 0; bucket < bucketCount; ++bucket) {
+				seen += merged.counts[bucket];
+				if (seen >= rank)
+					return std::min(highestOf(bucket), merged.longest);
+			}
+			return merged.longest;
+		}
+
+	public:
+		static constexpr bool ownsUnclaimed = detail::OwnsUnclaimed<Parent>::value;
+
+		enum class Operation {
+			allocate,
+			deallocate
+		};
+
+		// Passed as 'thread' to read over every thread
+		constexpr static size_t allThreads = SIZE_MAX;
+
+		LatencyProbeAllocator() {
+			// Fresh pages are zero, which are empty histograms
+			threads = static_cast<ThreadHistograms*>(detail::virtual_memory::allocate(tableBytes));
+			assert(threads != nullptr);
+		}
+
+		LatencyProbeAllocator(const LatencyProbeAllocator&) = delete;
+		LatencyProbeAllocator& operator=(const LatencyProbeAllocator&) = delete;
+
+		~LatencyProbeAllocator() {
+			detail::virtual_memory::release(threads, tableBytes);
+		}
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+
+			uint64_t from = detail::cycle_clock::begin();
+			Blk blk = parent.allocate(size, alignment);
+			record(0, detail::cycle_clock::end() - from);
+			return blk;
+		}
+
+		// Counted as an allocate
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+
+			uint64_t from = detail::cycle_clock::begin();
+			Blk blk = parent.allocateZeroed(size, alignment);
+			record(0, detail::cycle_clock::end() - from);
+			return blk;
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			uint64_t from = detail::cycle_clock::begin();
+			parent.deallocate(blk);
+			record(1, detail::cycle_clock::end() - from);
+		}
+
+		bool owns(Blk blk) const noexcept {
+			return parent.owns(blk);
+		}
+
+		bool ownsClaimed(Blk blk) const {
+			return detail::ownsClaimed(parent, blk);
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return parent.goodSize(size);
+		}
+
+		void deallocateAll() {
+			parent.deallocateAll();
+		}
+
+		// In nanoseconds. The first read measures the clock, which takes 10ms.
+		// 'thread' is a threadIndex(), or MaxThreads for the threads beyond them.
+		double percentile(Operation operation, double percent, size_t thread = allThreads) const {
+			Merged merged;
+			merge(static_cast<size_t>(operation), thread, merged);
+			return percentileOf(merged, percent) * detail::cycle_clock::nanosecondsPerTick();
+		}
+
+		LatencySummary summary(Operation operation, size_t thread = allThreads) const {
+			Merged merged;
+			merge(static_cast<size_t>(operation), thread, merged);
+			double scale = detail::cycle_clock::nanosecondsPerTick();
+
+			LatencySummary ret;
+			ret.count = merged.count;
+			ret.mean = merged.count == 0 ? 0 : scale * merged.totalTicks / merged.count;
+			ret.p50 = scale * percentileOf(merged, 50);
+			ret.p90 = scale * percentileOf(merged, 90);
+			ret.p99 = scale * percentileOf(merged, 99);
+			ret.p999 = scale * percentileOf(merged, 99.9);
+			ret.p9999 = scale * percentileOf(merged, 99.99);
+			ret.max = scale * merged.longest;
+			return ret;
+		}
+
+		// One line per bucket that isn't empty: "<from ns> <to ns> <count>", e.g. to plot it
+		void dumpHistogram(std::ostream& out, Operation operation, size_t thread = allThreads) const {
+			Merged merged;
+			merge(static_cast<size_t>(operation), thread, merged);
+			double scale = detail::cycle_clock::nanosecondsPerTick();
+			for (size_t bucket = 0; bucket < bucketCount; ++bucket) {
+				if (merged.counts[bucket] == 0)
+					continue;
+				uint64_t lowest = bucket == 0 ? 0 : highestOf(bucket - 1) + 1;
+				out << lowest * scale << ' ' << (highestOf(bucket) + 1) * scale << ' ' << merged.counts[bucket] << '\n';
+			}
+		}
+
+		// A table of both operations over all threads
+		void dump(std::ostream& out) const {
+			char line[160];
+			snprintf(line, sizeof(line), "%-10s %12s %10s %10s %10s %10s %10s %10s %12s\n",
+				"(ns)", "count", "mean", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+			out << line;
+			for (Operation operation : { Operation::allocate, Operation::deallocate }) {
+				LatencySummary stats = summary(operation);
+				snprintf(line, sizeof(line), "%-10s %12llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %12.1f\n",
+					operation == Operation::allocate ? "allocate" : "deallocate", static_cast<unsigned long long>(stats.count),
+					stats.mean, stats.p50, stats.p90, stats.p99, stats.p999, stats.p9999, stats.max);
+				out << line;
+			}
+		}
+
+		// Empties the histograms. Calls that are being recorded meanwhile may survive it in part.
+		void reset() noexcept {
+			for (size_t i = 0; i <= MaxThreads; ++i) {
+				for (Histogram& histogram : threads[i].operations) {
+					for (auto& count : histogram.counts) {
+						count.store(0, std::memory_order_relaxed);
+					}
+					histogram.totalTicks.store(0, std::memory_order_relaxed);
+					histogram.longest.store(0, std::memory_order_relaxed);
+				}
+			}
+		}
+	};
+}
+
+#endif
@@ -7,9 +7,13 @@
 #include <cassert>
 #include "blk.h"
 
+#include "detail/owner_map.h"
 #include "detail/pointer.h"
+#include "detail/virtual_memory.h"
+#include "detail/zero_memory.h"
 #include "local_allocator.h"
 #include "heap_allocator.h"
+#include "virtual_allocator.h"
 
 namespace lego {
 	template<size_t Capacity, class Allocator>
@@ -20,37 +24,91 @@ namespace lego {
 		Allocator allocator;
 		Blk memoryBlk = {};
 		char* start = nullptr;
+		detail::OwnerRegistration registration;
 		char* current = nullptr;
+
+		// Highest point that has been handed out since the last trim.
+		// Everything above it has either never been touched or was given back to the OS,
+		// so it's zero as long as the parent gave us zeroed memory.
+		char* dirtyEnd = nullptr;
+		size_t trimThreshold = 0;
+
+		// With a parent that commits on demand (e.g. VirtualAllocator), only [start, committedEnd) is usable
+		// and the rest is just reserved. Otherwise all of it is there from the start.
+		constexpr static bool commitsOnDemand = detail::CommitsOnDemand<Allocator>::value;
+		char* committedEnd = nullptr;
+		size_t retainedBytes = 1024 * 1024;
+
+		// Commits the pages up to 'end' (and a bit beyond, so we don't come back for every page)
+		bool commitUpTo(char* end) noexcept {
+			if constexpr (commitsOnDemand) {
+				char* reservedEnd = detail::pointer::getAlignForward(start + Capacity, detail::virtual_memory::pageSize());
+				char* newEnd = detail::pointer::getAlignForward(end, Allocator::commitGranularity);
+				if (newEnd > reservedEnd)
+					newEnd = reservedEnd;
+				if (!allocator.commit(committedEnd, newEnd - committedEnd))
+					return false;
+
+				committedEnd = newEnd;
+				registration.grow(committedEnd - start);
+				return true;
+			}
+			else {
+				return false;
+			}
+		}
 	public:
 		LinearAllocator() {
 			memoryBlk = allocator.allocate(Capacity, alignof(max_align_t));
 			assert(memoryBlk);
 			start = current = reinterpret_cast<char*>(memoryBlk.ptr);
 
+			// Nothing is committed yet, so the owner map only takes the pages in as they are
+			committedEnd = commitsOnDemand ? start : start + Capacity;
+			registration.assign(this, start, committedEnd - start);
+
+			// Unless the parent says otherwise, assume all of it is dirty
+			dirtyEnd = detail::AllocatesZeroed<Allocator>::value ? start : start + Capacity;
+
 		}
 
 		~LinearAllocator() {
+			registration.reset();
 			allocator.deallocate(memoryBlk);
 		}
 
-		Blk allocate(size_t size, uint8_t alignment)
+		Blk allocate(size_t size, size_t alignment)
 		{
 			assert(size && alignment);
 
-			uint8_t adjustment = detail::pointer::getAlignForwardDiff(current, alignment);
+			size_t adjustment = detail::pointer::getAlignForwardDiff(current, alignment);
 
 			// if not enough space, return nullptr
 			if (current + adjustment + size > start + Capacity) {
 				return nullptr;
 			}
+			if (current + adjustment + size > committedEnd && !commitUpTo(current + adjustment + size)) {
+				return nullptr;
+			}
 
 			// otherwise, get the aligned address
 			char* alignedAddress = current + adjustment;
 			current = alignedAddress + size;
+			if (current > dirtyEnd)
+				dirtyEnd = current;
 
 			return { alignedAddress, size };
 		}
 
+		// Only clears what lies below the high-water mark
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			char* clean = dirtyEnd;
+			Blk blk = allocate(size, alignment);
+			detail::zeroOutside(blk, clean, start + Capacity);
+			return blk;
+		}
+
 		void deallocate(Blk blk) 
 		{
 			// does nothing
@@ -60,8 +118,78 @@ namespace lego {
 			return blk.ptr >= start && blk.ptr < start + Capacity;
 		}
 
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return size;
+		}
+
 		void deallocateAll() {
 			current = start;
+
+			if constexpr (commitsOnDemand)
+				decommitAbove(retainedBytes);
+
+			if (trimThreshold != 0 && static_cast<size_t>(dirtyEnd - start) >= trimThreshold)
+				trim();
+		}
+
+		// Gives the whole pages above 'current' back to the OS.
+		// They are faulted back in (zeroed) when allocations reach them again.
+		// Returns the number of bytes given back.
+		size_t trim() noexcept {
+			// The page that dirtyEnd is in is dirty as a whole
+			char* end = detail::pointer::getAlignForward(dirtyEnd, detail::virtual_memory::pageSize());
+			if (end > start + Capacity)
+				end = start + Capacity;
+
+			size_t ret = detail::virtual_memory::discardPagesWithin(current, end);
+
+			// The bytes before the first whole page above 'current' were not given back, so they may still be dirty.
+			// If the end could not be given back either (Capacity is not page aligned), keep the old mark.
+			char* first = detail::pointer::getAlignForward(current, detail::virtual_memory::pageSize());
+			if (first < dirtyEnd && first + ret >= dirtyEnd)
+				dirtyEnd = first;
+			return ret;
+		}
+
+		// Trims automatically on deallocateAll() once at least 'bytes' have been used. 0 turns it off.
+		void setTrimThreshold(size_t bytes) noexcept {
+			trimThreshold = bytes;
+		}
+
+		// With a parent that commits on demand: decommits the pages above the first 'bytes' that aren't in use.
+		// Unlike trim(), the pages must be committed again before they are used.
+		// Returns the number of bytes given back.
+		size_t decommitAbove(size_t bytes) noexcept {
+			if constexpr (commitsOnDemand) {
+				size_t kept = bytes > static_cast<size_t>(current - start) ? bytes : current - start;
+				if (kept >= static_cast<size_t>(committedEnd - start))
+					return 0;
+
+				char* mark = detail::pointer::getAlignForward(start + kept, detail::virtual_memory::pageSize());
+				if (mark >= committedEnd)
+					return 0;
+
+				size_t ret = committedEnd - mark;
+				allocator.decommit(mark, ret);
+				committedEnd = mark;
+				if (dirtyEnd > mark)
+					dirtyEnd = mark;
+				return ret;
+			}
+			else {
+				return 0;
+			}
+		}
+
+		// How much deallocateAll() keeps committed, 1MB by default
+		void setRetainedBytes(size_t bytes) noexcept {
+			retainedBytes = bytes;
+		}
+
+		// What is usable without committing more. All of it if the parent doesn't commit on demand.
+		size_t committedBytes() const noexcept {
+			return committedEnd - start;
 		}
 
 
@@ -73,6 +201,9 @@ namespace lego {
 
 	template<size_t Capacity>
 	using HeapLinearAllocator = LinearAllocator<Capacity, HeapAllocator>;
+
+	template<size_t Capacity>
+	using VirtualLinearAllocator = LinearAllocator<Capacity, VirtualAllocator>;
 }
 
 #endif 
@@ -6,30 +6,42 @@
 // It will always return the start point of the array on 'allocation'.
 // Once it's allocated, cannot allocate again until it's deallocated.
 // This is useful if you do not want to reserve memory in the heap using the HeapAllocator
+// The array is only guaranteed to be aligned to max_align_t, so bigger alignments may fail.
 
 
+#include <cassert>
+#include <cstddef>
 #include "blk.h"
+#include "detail/pointer.h"
+#include "detail/zero_memory.h"
 
 
 namespace lego {
 	template<size_t Capacity>
 	class LocalAllocator
 	{
-		char arr[Capacity] = {0};
+		alignas(alignof(max_align_t)) char arr[Capacity] = {0};
 		bool allocated = false;
 	public:
-		Blk allocate(size_t size, uint8_t alignment)
+		Blk allocate(size_t size, size_t alignment)
 		{
 			assert(size && alignment);
 
-			if (allocated || size > Capacity)
+			if (allocated || size > Capacity || detail::pointer::getAlignForwardDiff(arr, alignment) != 0)
 				return {};
 			else {
 				allocated = true;
-				return { arr, size };
+				return { arr, Capacity };
 			}
 		}
 
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			Blk blk = allocate(size, alignment);
+			detail::zero(blk);
+			return blk;
+		}
+
 		void deallocate(Blk blk)  
 		{
 			assert(blk && owns(blk) && allocated);
@@ -40,9 +52,14 @@ namespace lego {
 			return blk.ptr == arr;
 		}
 
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return size <= Capacity ? Capacity : size;
+		}
+
 		void deallocateAll()
 		{
-			deallocate();
+			allocated = false;
 		}
 	};
 
@@ -0,0 +1,66 @@
+#ifndef __LEGO_LOCKED_ALLOCATOR_H__
+#define __LEGO_LOCKED_ALLOCATOR_H__
+
+// Makes any allocator safe to share between threads by putting one lock around it.
+// Simple, but every thread waits on the same lock: use ThreadHeapAllocator when that hurts.
+// Lock can be anything with lock()/unlock(), e.g. detail::SpinLock for short critical sections.
+
+#include <cassert>
+#include <mutex>
+#include "blk.h"
+
+#include "detail/owner_map.h"
+
+namespace lego {
+	template<class Allocator, class Lock = std::mutex>
+	class LockedAllocator
+	{
+		Allocator allocator;
+		mutable Lock lock;
+	public:
+		static constexpr bool ownsUnclaimed = detail::OwnsUnclaimed<Allocator>::value;
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			std::lock_guard<Lock> guard(lock);
+			return allocator.allocate(size, alignment);
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			std::lock_guard<Lock> guard(lock);
+			return allocator.allocateZeroed(size, alignment);
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			std::lock_guard<Lock> guard(lock);
+			allocator.deallocate(blk);
+		}
+
+		bool owns(Blk blk) const noexcept {
+			std::lock_guard<Lock> guard(lock);
+			return allocator.owns(blk);
+		}
+
+		bool ownsClaimed(Blk blk) const {
+			std::lock_guard<Lock> guard(lock);
+			return detail::ownsClaimed(allocator, blk);
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return allocator.goodSize(size);
+		}
+
+		void deallocateAll() {
+			std::lock_guard<Lock> guard(lock);
+			allocator.deallocateAll();
+		}
+	};
+}
+
+#endif
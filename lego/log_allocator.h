@@ -3,7 +3,7 @@
 
 // Allocator that logs to cout whenever there's allocator and deallocation (for debugging purposes)
 #include "blk.h"
-
+#include "detail/owner_map.h"
 #include <iostream>
 
 namespace lego {
@@ -26,7 +26,9 @@ namespace lego {
 		Allocator allocator;
 		LogStrategy logStrategy;
 	public:
-		Blk allocate(size_t size, uint8_t alignment)
+		static constexpr bool ownsUnclaimed = detail::OwnsUnclaimed<Allocator>::value;
+
+		Blk allocate(size_t size, size_t alignment)
 		{
 			assert(size && alignment);
 
@@ -35,6 +37,15 @@ namespace lego {
 			return ret;
 		}
 
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+
+			Blk ret = allocator.allocateZeroed(size, alignment);
+			logStrategy.printAllocate(ret);
+			return ret;
+		}
+
 		void deallocate(Blk blk)
 		{
 			if (!blk)
@@ -50,6 +61,15 @@ namespace lego {
 			return allocator.owns(blk);
 		}
 
+		bool ownsClaimed(Blk blk) const {
+			return detail::ownsClaimed(allocator, blk);
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return allocator.goodSize(size);
+		}
+
 		void deallocateAll() noexcept {
 			allocator.deallocateAll();
 		}
@@ -8,7 +8,11 @@ namespace lego {
 	class NullAllocator
 	{
 	public:
-		Blk allocate(size_t size, uint8_t alignment) {
+		Blk allocate(size_t size, size_t alignment) {
+			return {};
+		}
+
+		Blk allocateZeroed(size_t, size_t) {
 			return {};
 		}
 
@@ -18,6 +22,11 @@ namespace lego {
 			return false;
 		}
 
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return size;
+		}
+
 		void deallocateAll() noexcept {}
 	};
 
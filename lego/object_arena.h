@@ -0,0 +1,138 @@
+#ifndef __LEGO_OBJECT_ARENA_H__
+#define __LEGO_OBJECT_ARENA_H__
+
+// Arena for whole graphs of objects that die together, e.g. everything a request needs.
+// create<T>() builds objects in the Arena (a LinearAllocator or anything else with deallocateAll()),
+// and reset() destroys them all in reverse order and rewinds the Arena in one go. Nothing is freed one by one.
+//
+// Objects that need their destructor run get a small header in front of them, which links them into a list:
+//
+// ---------------------------------------------------------------------
+// | next | destroy | object | int | int | next | destroy | object | ...
+// ---------------------------------------------------------------------
+//      ^                                     |
+//      +-------------------------------------+
+//
+// Trivially destructible objects (ints, PODs, string views...) get no header and cost nothing to reset.
+// create() returns nullptr when the Arena is out of memory, like the allocators do.
+//
+// The ObjectArena is an allocator too, so containers can take their memory from it
+// (deallocate() does nothing, the memory comes back on reset()).
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "blk.h"
+
+#include "detail/pointer.h"
+#include "linear_allocator.h"
+
+namespace lego {
+	template<class Arena>
+	class ObjectArena
+	{
+		struct Cleanup {
+			Cleanup* next;
+			void (*destroy)(Cleanup*);
+		};
+
+		// Where the object lives behind its header
+		template<class T>
+		constexpr static size_t objectOffset = detail::pointer::roundToAlignment(sizeof(Cleanup), alignof(T));
+
+		template<class T>
+		static void destroyObject(Cleanup* cleanup) noexcept {
+			reinterpret_cast<T*>(reinterpret_cast<char*>(cleanup) + objectOffset<T>)->~T();
+		}
+
+		Arena arena;
+
+		// The last object created comes first
+		Cleanup* cleanups = nullptr;
+
+	public:
+		ObjectArena() = default;
+		ObjectArena(const ObjectArena&) = delete;
+		ObjectArena& operator=(const ObjectArena&) = delete;
+
+		~ObjectArena() {
+			reset();
+		}
+
+		template<class T, class... Args>
+		T* create(Args&&... args) {
+			if constexpr (std::is_trivially_destructible<T>::value) {
+				Blk blk = arena.allocate(sizeof(T), alignof(T));
+				if (!blk)
+					return nullptr;
+				return new (blk.ptr) T(std::forward<Args>(args)...);
+			}
+			else {
+				constexpr size_t alignment = alignof(T) > alignof(Cleanup) ? alignof(T) : alignof(Cleanup);
+				Blk blk = arena.allocate(objectOffset<T> + sizeof(T), alignment);
+				if (!blk)
+					return nullptr;
+
+				T* ret = new (static_cast<char*>(blk.ptr) + objectOffset<T>) T(std::forward<Args>(args)...);
+
+				// Only once it's built, an object that threw must not be destroyed
+				Cleanup* cleanup = static_cast<Cleanup*>(blk.ptr);
+				cleanup->destroy = &destroyObject<T>;
+				cleanup->next = cleanups;
+				cleanups = cleanup;
+				return ret;
+			}
+		}
+
+		// Destroys every object, newest first, and gives all the memory back to the Arena
+		void reset() {
+			while (cleanups != nullptr) {
+				Cleanup* cleanup = cleanups;
+				cleanups = cleanup->next;
+				cleanup->destroy(cleanup);
+			}
+			arena.deallocateAll();
+		}
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+			return arena.allocate(size, alignment);
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+			return arena.allocateZeroed(size, alignment);
+		}
+
+		void deallocate(Blk blk)
+		{
+			// does nothing, the memory is given back on reset()
+		}
+
+		bool owns(Blk blk) const noexcept {
+			return arena.owns(blk);
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return arena.goodSize(size);
+		}
+
+		void deallocateAll() {
+			reset();
+		}
+	};
+
+
+	template<size_t Capacity>
+	using LocalObjectArena = ObjectArena<LocalLinearAllocator<Capacity>>;
+
+	template<size_t Capacity>
+	using HeapObjectArena = ObjectArena<HeapLinearAllocator<Capacity>>;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef __LEGO_OFFSET_PTR_H__
+#define __LEGO_OFFSET_PTR_H__
+
+// A pointer that stores the distance from itself to what it points to.
+// As long as both ends live in the same block of memory, it stays valid wherever that
+// memory gets mapped, e.g. shared memory mapped at different addresses in different processes.
+//
+// An offset of 1 is used as null, because pointing 1 byte into yourself is never useful.
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace lego {
+	template<typename T>
+	class OffsetPtr {
+		constexpr static intptr_t nullOffset = 1;
+		intptr_t offset = nullOffset;
+
+		void set(T* ptr) noexcept {
+			offset = ptr == nullptr ? nullOffset : reinterpret_cast<intptr_t>(ptr) - reinterpret_cast<intptr_t>(this);
+		}
+
+	public:
+		OffsetPtr() = default;
+		OffsetPtr(std::nullptr_t) noexcept {}
+		OffsetPtr(T* ptr) noexcept { set(ptr); }
+
+		// Copies have to be recalculated from their own address
+		OffsetPtr(const OffsetPtr& rhs) noexcept { set(rhs.get()); }
+		OffsetPtr& operator=(const OffsetPtr& rhs) noexcept {
+			set(rhs.get());
+			return *this;
+		}
+		OffsetPtr& operator=(T* ptr) noexcept {
+			set(ptr);
+			return *this;
+		}
+
+		T* get() const noexcept {
+			return offset == nullOffset ? nullptr : reinterpret_cast<T*>(reinterpret_cast<intptr_t>(this) + offset);
+		}
+
+		T* operator->() const noexcept {
+			return get();
+		}
+
+		std::add_lvalue_reference_t<T> operator*() const noexcept {
+			return *get();
+		}
+
+		std::add_lvalue_reference_t<T> operator[](size_t index) const noexcept {
+			return get()[index];
+		}
+
+		explicit operator bool() const noexcept {
+			return offset != nullOffset;
+		}
+
+		bool operator==(const OffsetPtr& rhs) const noexcept {
+			return get() == rhs.get();
+		}
+
+		bool operator!=(const OffsetPtr& rhs) const noexcept {
+			return get() != rhs.get();
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef __LEGO_PAGE_ALLOCATOR_H__
+#define __LEGO_PAGE_ALLOCATOR_H__
+
+// Allocator that gets whole pages straight from the OS (mmap / VirtualAlloc).
+// Sizes are rounded up to the page size.
+// Use it as the parent of big pools: the memory is page aligned and starts zeroed,
+// so trimming the pool actually gives pages back to the OS.
+#include <cassert>
+#include "blk.h"
+#include "detail/owner_map.h"
+#include "detail/pointer.h"
+#include "detail/virtual_memory.h"
+
+
+namespace lego {
+	class PageAllocator
+	{
+		static size_t roundToPage(size_t size) noexcept {
+			return detail::pointer::roundToAlignment(size, detail::virtual_memory::pageSize());
+		}
+	public:
+		// Every allocation gets pages of its own, fresh from the OS
+		static constexpr bool allocatesZeroed = true;
+
+		// Like HeapAllocator, it owns whatever no arena has claimed
+		static constexpr bool ownsUnclaimed = true;
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+
+			size = roundToPage(size);
+			void* ptr = detail::virtual_memory::allocate(size, alignment);
+			if (ptr == nullptr)
+				return {};
+
+			return { ptr, size };
+		}
+
+		// Nothing to clear
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			return allocate(size, alignment);
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			detail::virtual_memory::release(blk.ptr, roundToPage(blk.size));
+		}
+
+		// Anything no arena has claimed in the owner map
+		bool owns(Blk blk) const noexcept {
+			return detail::ownerOf(blk.ptr) == nullptr;
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return roundToPage(size);
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef __LEGO_PERSISTENT_LINEAR_ALLOCATOR_H__
+#define __LEGO_PERSISTENT_LINEAR_ALLOCATOR_H__
+
+// LinearAllocator whose memory is a memory-mapped file.
+// Build your data once, point the root at it and checkpoint().
+// Next time, constructing the allocator with the same file maps it back in:
+// nothing is parsed or copied, the pages are loaded as they are touched.
+//
+// The file can be mapped at a different address every time,
+// so pointers inside the arena must be OffsetPtrs (or offsets).
+// For the same reason, alignments above the page size only hold for the run that allocated them.
+//
+// -----------------------------------------------
+// | Header | data | data | data |               |
+// -----------------------------------------------
+//          ^ start               ^ current
+//
+// The magic in the Header is only there while the file matches its last checkpoint().
+// It's cleared as soon as the arena changes, and checkpoint() writes it after everything else is on disk,
+// so a run that crashes halfway through a build leaves a file that won't be restored.
+
+#include <cassert>
+#include <cstdint>
+#include "blk.h"
+
+#include "detail/mapped_file.h"
+#include "detail/pointer.h"
+#include "detail/zero_memory.h"
+
+namespace lego {
+	template<size_t Capacity>
+	class PersistentLinearAllocator
+	{
+		static_assert(Capacity != 0);
+
+		constexpr static uint64_t magic = 0x4c45474f41524e41; // "LEGOARNA"
+		constexpr static uint64_t nullOffset = UINT64_MAX;
+
+		// Everything we need to trust the file, checked once on open. magic is 0 while the data is being changed.
+		struct Header {
+			uint64_t magic;
+			uint64_t version;
+			uint64_t capacity;
+			uint64_t used;
+			uint64_t root;
+		};
+
+		constexpr static size_t dataOffset = (sizeof(Header) + alignof(max_align_t) - 1) / alignof(max_align_t) * alignof(max_align_t);
+
+		detail::MappedFile file;
+		Header* header = nullptr;
+		char* start = nullptr;
+		bool restored = false;
+
+		// The file no longer matches the last checkpoint, don't trust it until the next one
+		void beginChange() noexcept {
+			if (header->magic == 0)
+				return;
+			header->magic = 0;
+			file.flush(0, sizeof(Header));
+		}
+	public:
+		// 'version' is yours: bump it whenever the layout of what you store changes,
+		// and old files will be thrown away instead of misread.
+		PersistentLinearAllocator(const char* path, uint64_t version = 0) : file(path, dataOffset + Capacity)
+		{
+			header = static_cast<Header*>(file.data());
+			assert(header != nullptr);
+			start = reinterpret_cast<char*>(header) + dataOffset;
+
+			restored = file.reopened() &&
+				header->magic == magic &&
+				header->version == version &&
+				header->capacity == Capacity &&
+				header->used <= Capacity;
+
+			if (!restored) {
+				header->version = version;
+				header->capacity = Capacity;
+				header->used = 0;
+				header->root = nullOffset;
+				header->magic = 0;
+			}
+		}
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+			beginChange();
+
+			char* current = start + header->used;
+			size_t adjustment = detail::pointer::getAlignForwardDiff(current, alignment);
+
+			if (adjustment + size > Capacity - header->used) {
+				return {};
+			}
+
+			char* alignedAddress = current + adjustment;
+			header->used = (alignedAddress + size) - start;
+
+			return { alignedAddress, size };
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			Blk blk = allocate(size, alignment);
+			detail::zero(blk);
+			return blk;
+		}
+
+		void deallocate(Blk blk)
+		{
+			// does nothing
+		}
+
+		bool owns(Blk blk) const noexcept {
+			return blk.ptr >= start && blk.ptr < start + Capacity;
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return size;
+		}
+
+		void deallocateAll() {
+			beginChange();
+			header->used = 0;
+			header->root = nullOffset;
+		}
+
+		// Whether the constructor found a valid arena in the file
+		bool isRestored() const noexcept {
+			return restored;
+		}
+
+		// Where to start reading the data from after a restore
+		void setRoot(void* ptr) noexcept {
+			beginChange();
+			header->root = ptr == nullptr ? nullOffset : static_cast<char*>(ptr) - start;
+		}
+
+		void* getRoot() const noexcept {
+			return header->root == nullOffset ? nullptr : start + header->root;
+		}
+
+		// Makes sure everything so far is on disk, and only then marks the file as valid
+		bool checkpoint() noexcept {
+			if (!file.flush())
+				return false;
+			header->magic = magic;
+			return file.flush(0, sizeof(Header));
+		}
+	};
+}
+
+#endif
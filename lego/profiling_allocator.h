@@ -0,0 +1,396 @@
+#ifndef __LEGO_PROFILING_ALLOCATOR_H__
+#define __LEGO_PROFILING_ALLOCATOR_H__
+
+// Sampling heap profiler. Cheap enough to leave on in production, unlike LogAllocator.
+//
+// Every thread counts down the bytes it allocates and takes a sample when the count runs out.
+// The counts are drawn from an exponential distribution with a mean of SampleRate bytes,
+// so every byte has the same chance of being sampled, no matter how the allocations are sized.
+// A sample records the call stack and stands in for all the bytes it was picked from,
+// which makes the totals of a profile estimates of the real ones.
+//
+// Samples are kept until their block is freed, so there are two profiles:
+// - live: what is allocated right now, by call stack. Leaks grow here.
+// - cumulative: everything allocated since the start. Hot spots show up here.
+//
+// dumpFolded() writes "outer;inner bytes" lines for flamegraph.pl and friends,
+// dumpPprof() writes the heap profile text format that pprof reads (with both profiles in it).
+//
+// Blocks that were not sampled only cost a call and a countdown on allocate and a look at one cache line on deallocate.
+// The tables come straight from the OS, so the profiler never calls malloc on its own,
+// except when dumping. Parent must be thread safe if the profiler is used from several threads.
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "blk.h"
+
+#include "detail/owner_map.h"
+#include "detail/spin_lock.h"
+#include "detail/stack_trace.h"
+#include "detail/virtual_memory.h"
+
+namespace lego {
+	template<class Parent, size_t SampleRate = 512 * 1024, size_t MaxDepth = 32>
+	class ProfilingAllocator
+	{
+		static_assert(SampleRate != 0);
+		static_assert(MaxDepth != 0);
+
+		// Live samples are found by address, 8 to a bucket so that a lookup reads one cache line.
+		// A sample that finds its bucket full is dropped.
+		constexpr static size_t bucketSize = 8;
+		constexpr static size_t bucketCount = 2048;
+
+		// Distinct call stacks. Samples from new stacks are dropped once it's full.
+		constexpr static size_t maxStacks = 4096;
+
+		struct Stack {
+			bool used;
+			size_t hash;
+			size_t depth;
+			void* frames[MaxDepth];
+
+			// Estimates, samples are scaled up by how much they stand for
+			double allocatedObjects;
+			double allocatedBytes;
+			double liveObjects;
+			double liveBytes;
+		};
+
+		struct Sample {
+			uint32_t stack;
+			double objects;
+			double bytes;
+		};
+
+		struct alignas(64) Bucket {
+			std::atomic<void*> keys[bucketSize];
+		};
+
+		Parent parent;
+		Bucket* buckets = nullptr;
+		Sample* samples = nullptr;
+		Stack* stacks = nullptr;
+		size_t stackCount = 0;
+		size_t dropped = 0;
+		mutable detail::SpinLock lock;
+
+		constexpr static size_t bucketsBytes = bucketCount * sizeof(Bucket);
+		constexpr static size_t samplesBytes = bucketCount * bucketSize * sizeof(Sample);
+		constexpr static size_t stacksBytes = maxStacks * sizeof(Stack);
+
+		// Bytes this thread may still allocate before its next sample
+		struct Countdown {
+			size_t bytesLeft = 0;
+			uint64_t random = 0;
+		};
+
+		static Countdown& countdown() noexcept {
+			thread_local Countdown countdown;
+			return countdown;
+		}
+
+		// Exponential with a mean of SampleRate
+		static size_t nextCountdown(Countdown& countdown) noexcept {
+			if (countdown.random == 0)
+				countdown.random = reinterpret_cast<uintptr_t>(&countdown) | 1;
+
+			// xorshift64*, the top 53 bits make a double in (0, 1]
+			countdown.random ^= countdown.random >> 12;
+			countdown.random ^= countdown.random << 25;
+			countdown.random ^= countdown.random >> 27;
+			double uniform = static_cast<double>(((countdown.random * 0x2545F4914F6CDD1DULL) >> 11) + 1) / 9007199254740992.0;
+			return static_cast<size_t>(-std::log(uniform) * SampleRate) + 1;
+		}
+
+		// Whether this allocation is the one the countdown ran out on
+		static bool shouldSample(size_t size) noexcept {
+			Countdown& state = countdown();
+			if (state.random == 0)
+				state.bytesLeft = nextCountdown(state);
+			if (state.bytesLeft > size) {
+				state.bytesLeft -= size;
+				return false;
+			}
+			state.bytesLeft = nextCountdown(state);
+			return true;
+		}
+
+		static Bucket& bucketOf(Bucket* buckets, const void* ptr) noexcept {
+			uint64_t hash = (reinterpret_cast<uintptr_t>(ptr) >> 4) * 0x9E3779B97F4A7C15ULL;
+			return buckets[(hash >> 32) % bucketCount];
+		}
+
+		size_t sampleIndex(const Bucket& bucket, size_t slot) const noexcept {
+			return (&bucket - buckets) * bucketSize + slot;
+		}
+
+		static size_t hashFrames(void* const* frames, size_t depth) noexcept {
+			uint64_t hash = 14695981039346656037ULL;
+			for (size_t i = 0; i < depth; ++i) {
+				hash ^= reinterpret_cast<uintptr_t>(frames[i]);
+				hash *= 1099511628211ULL;
+			}
+			return static_cast<size_t>(hash);
+		}
+
+		// Finds or adds the stack, maxStacks if the table is full. Holds the lock.
+		size_t findStack(void* const* frames, size_t depth) noexcept {
+			size_t hash = hashFrames(frames, depth);
+			for (size_t probe = 0; probe < maxStacks; ++probe) {
+				Stack& stack = stacks[(hash + probe) % maxStacks];
+				if (!stack.used) {
+					if (stackCount * 4 >= maxStacks * 3)
+						return maxStacks;
+
+					stack.used = true;
+					stack.hash = hash;
+					stack.depth = depth;
+					memcpy(stack.frames, frames, depth * sizeof(void*));
+					++stackCount;
+					return (hash + probe) % maxStacks;
+				}
+				if (stack.hash == hash && stack.depth == depth && memcmp(stack.frames, frames, depth * sizeof(void*)) == 0)
+					return (hash + probe) % maxStacks;
+			}
+			return maxStacks;
+		}
+
+		// Only called straight from allocate() and allocateZeroed(), and none of them is inlined,
+		// so the stack always starts with record and the allocate that called it. Both are left out.
+		LEGO_NOINLINE void record(Blk blk) noexcept {
+			void* frames[MaxDepth];
+			size_t depth = detail::stack_trace::capture(frames, MaxDepth, 2);
+
+			// A sample stands for 1 / P(sampled) allocations like it, to keep the estimates unbiased
+			double probability = 1.0 - std::exp(-static_cast<double>(blk.size) / SampleRate);
+			double objects = 1.0 / probability;
+
+			std::lock_guard<detail::SpinLock> guard(lock);
+			size_t stackIndex = findStack(frames, depth);
+			Bucket& bucket = bucketOf(buckets, blk.ptr);
+			size_t slot = 0;
+			while (slot < bucketSize && bucket.keys[slot].load(std::memory_order_relaxed) != nullptr)
+				++slot;
+			if (stackIndex == maxStacks || slot == bucketSize) {
+				++dropped;
+				return;
+			}
+
+			Stack& stack = stacks[stackIndex];
+			stack.allocatedObjects += objects;
+			stack.allocatedBytes += objects * blk.size;
+			stack.liveObjects += objects;
+			stack.liveBytes += objects * blk.size;
+
+			Sample& sample = samples[sampleIndex(bucket, slot)];
+			sample.stack = static_cast<uint32_t>(stackIndex);
+			sample.objects = objects;
+			sample.bytes = objects * blk.size;
+
+			// Published last, deallocate() reads the key without the lock
+			bucket.keys[slot].store(blk.ptr, std::memory_order_release);
+		}
+
+		void forget(Blk blk) noexcept {
+			Bucket& bucket = bucketOf(buckets, blk.ptr);
+			for (size_t slot = 0; slot < bucketSize; ++slot) {
+				if (bucket.keys[slot].load(std::memory_order_acquire) != blk.ptr)
+					continue;
+
+				std::lock_guard<detail::SpinLock> guard(lock);
+				if (bucket.keys[slot].load(std::memory_order_relaxed) != blk.ptr)
+					return;
+
+				Sample& sample = samples[sampleIndex(bucket, slot)];
+				Stack& stack = stacks[sample.stack];
+				stack.liveObjects -= sample.objects;
+				stack.liveBytes -= sample.bytes;
+				bucket.keys[slot].store(nullptr, std::memory_order_relaxed);
+				return;
+			}
+		}
+
+	public:
+		static constexpr bool ownsUnclaimed = detail::OwnsUnclaimed<Parent>::value;
+
+		enum class Profile {
+			live,
+			cumulative
+		};
+
+		ProfilingAllocator() {
+			// Fresh pages are zero, which is an empty table
+			char* memory = static_cast<char*>(detail::virtual_memory::allocate(bucketsBytes + samplesBytes + stacksBytes));
+			assert(memory != nullptr);
+			buckets = reinterpret_cast<Bucket*>(memory);
+			samples = reinterpret_cast<Sample*>(memory + bucketsBytes);
+			stacks = reinterpret_cast<Stack*>(memory + bucketsBytes + samplesBytes);
+		}
+
+		ProfilingAllocator(const ProfilingAllocator&) = delete;
+		ProfilingAllocator& operator=(const ProfilingAllocator&) = delete;
+
+		~ProfilingAllocator() {
+			detail::virtual_memory::release(buckets, bucketsBytes + samplesBytes + stacksBytes);
+		}
+
+		// Out of line, so that the caller's frame is the first one that is kept
+		LEGO_NOINLINE Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+			Blk blk = parent.allocate(size, alignment);
+			if (blk && shouldSample(blk.size))
+				record(blk);
+			return blk;
+		}
+
+		LEGO_NOINLINE Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+			Blk blk = parent.allocateZeroed(size, alignment);
+			if (blk && shouldSample(blk.size))
+				record(blk);
+			return blk;
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			// Before the parent can hand the address out again
+			forget(blk);
+			parent.deallocate(blk);
+		}
+
+		bool owns(Blk blk) const noexcept {
+			return parent.owns(blk);
+		}
+
+		bool ownsClaimed(Blk blk) const {
+			return detail::ownsClaimed(parent, blk);
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return parent.goodSize(size);
+		}
+
+		void deallocateAll() {
+			{
+				std::lock_guard<detail::SpinLock> guard(lock);
+				for (size_t i = 0; i < bucketCount; ++i) {
+					for (auto& key : buckets[i].keys) {
+						key.store(nullptr, std::memory_order_relaxed);
+					}
+				}
+				for (size_t i = 0; i < maxStacks; ++i) {
+					stacks[i].liveObjects = 0;
+					stacks[i].liveBytes = 0;
+				}
+			}
+			parent.deallocateAll();
+		}
+
+		// Estimated bytes, over all call stacks
+		size_t totalBytes(Profile profile) const noexcept {
+			std::lock_guard<detail::SpinLock> guard(lock);
+			double ret = 0;
+			for (size_t i = 0; i < maxStacks; ++i) {
+				if (stacks[i].used)
+					ret += profile == Profile::live ? stacks[i].liveBytes : stacks[i].allocatedBytes;
+			}
+			return static_cast<size_t>(ret + 0.5);
+		}
+
+		// Samples that didn't fit in the tables
+		size_t droppedSamples() const noexcept {
+			std::lock_guard<detail::SpinLock> guard(lock);
+			return dropped;
+		}
+
+		// One line per call stack, outermost frame first: "main;parse;readFile 1048576"
+		void dumpFolded(std::ostream& out, Profile profile = Profile::live) const {
+			for (const Stack& stack : snapshot()) {
+				double bytes = profile == Profile::live ? stack.liveBytes : stack.allocatedBytes;
+				if (bytes < 0.5)
+					continue;
+
+				std::string names[MaxDepth];
+				detail::stack_trace::symbolize(stack.frames, stack.depth, [&](size_t i, const std::string& name) {
+					names[i] = name;
+				});
+
+				std::string line;
+				for (size_t i = stack.depth; i-- > 0;) {
+					line += names[i];
+					if (i != 0)
+						line += ';';
+				}
+				if (line.empty())
+					line = "[unknown]";
+				out << line << ' ' << static_cast<uint64_t>(bytes + 0.5) << '\n';
+			}
+		}
+
+		// The text format of gperftools' heap profiles:
+		//     heap profile: <live objects>: <live bytes> [<allocated objects>: <allocated bytes>] @ heap_v2/<rate>
+		//     <live objects>: <live bytes> [<allocated objects>: <allocated bytes>] @ 0x... 0x...
+		// followed by the memory map, so that pprof can find the symbols in the binaries.
+		void dumpPprof(std::ostream& out) const {
+			auto round = [](double value) { return static_cast<uint64_t>(value + 0.5); };
+
+			std::vector<Stack> stacks = snapshot();
+			double totals[4] = {};
+			for (const Stack& stack : stacks) {
+				totals[0] += stack.liveObjects;
+				totals[1] += stack.liveBytes;
+				totals[2] += stack.allocatedObjects;
+				totals[3] += stack.allocatedBytes;
+			}
+
+			out << "heap profile: " << round(totals[0]) << ": " << round(totals[1])
+				<< " [" << round(totals[2]) << ": " << round(totals[3]) << "] @ heap_v2/" << SampleRate << '\n';
+			for (const Stack& stack : stacks) {
+				out << round(stack.liveObjects) << ": " << round(stack.liveBytes)
+					<< " [" << round(stack.allocatedObjects) << ": " << round(stack.allocatedBytes) << "] @";
+				for (size_t i = 0; i < stack.depth; ++i) {
+					out << ' ' << detail::stack_trace::addressName(stack.frames[i]);
+				}
+				out << '\n';
+			}
+
+#ifdef __linux__
+			std::ifstream maps("/proc/self/maps");
+			if (maps) {
+				out << "\nMAPPED_LIBRARIES:\n" << maps.rdbuf();
+			}
+#endif
+		}
+
+	private:
+		// A copy to work on without holding the lock while symbolizing and writing.
+		// Allocated before taking the lock, the allocation may come back through us.
+		std::vector<Stack> snapshot() const {
+			std::vector<Stack> ret(maxStacks);
+			{
+				std::lock_guard<detail::SpinLock> guard(lock);
+				memcpy(ret.data(), stacks, stacksBytes);
+			}
+			ret.erase(std::remove_if(ret.begin(), ret.end(), [](const Stack& stack) { return !stack.used; }), ret.end());
+			return ret;
+		}
+	};
+}
+
+#endif
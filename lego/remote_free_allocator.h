@@ -0,0 +1,118 @@
+#ifndef __LEGO_REMOTE_FREE_ALLOCATOR_H__
+#define __LEGO_REMOTE_FREE_ALLOCATOR_H__
+
+// Lets any thread free blocks of an allocator that belongs to one thread.
+// Only the owner thread allocates and frees directly. Other threads push what they free
+// onto a lock-free list, and the owner hands those back to the allocator in one go
+// the next time it allocates.
+//
+// Blocks are at least as big as a RemoteBlock, because that's what we turn them into
+// while they wait on the list.
+//
+// The wrapped allocator's owns() is called from other threads,
+// which is fine for the usual range checks.
+
+#include <atomic>
+#include <cassert>
+#include "blk.h"
+
+#include "detail/owner_map.h"
+#include "detail/thread_index.h"
+
+namespace lego {
+	template<class Allocator>
+	class RemoteFreeAllocator
+	{
+		struct RemoteBlock {
+			RemoteBlock* next;
+			size_t size;
+		};
+
+		Allocator allocator;
+		size_t owner = detail::threadIndex();
+		std::atomic<RemoteBlock*> remoteFrees = { nullptr };
+	public:
+		static constexpr bool ownsUnclaimed = detail::OwnsUnclaimed<Allocator>::value;
+
+		~RemoteFreeAllocator() {
+			collectRemoteFrees();
+		}
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+			assert(isOwner());
+
+			if (remoteFrees.load(std::memory_order_relaxed) != nullptr)
+				collectRemoteFrees();
+
+			return allocator.allocate(size < sizeof(RemoteBlock) ? sizeof(RemoteBlock) : size,
+				alignment < alignof(RemoteBlock) ? alignof(RemoteBlock) : alignment);
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+			assert(isOwner());
+
+			if (remoteFrees.load(std::memory_order_relaxed) != nullptr)
+				collectRemoteFrees();
+
+			return allocator.allocateZeroed(size < sizeof(RemoteBlock) ? sizeof(RemoteBlock) : size,
+				alignment < alignof(RemoteBlock) ? alignof(RemoteBlock) : alignment);
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			assert(owns(blk));
+
+			if (isOwner()) {
+				allocator.deallocate(blk);
+				return;
+			}
+
+			// We are the only ones using this block now, so it can hold the list node
+			RemoteBlock* block = static_cast<RemoteBlock*>(blk.ptr);
+			block->size = blk.size;
+			block->next = remoteFrees.load(std::memory_order_relaxed);
+			while (!remoteFrees.compare_exchange_weak(block->next, block, std::memory_order_release));
+		}
+
+		bool owns(Blk blk) const noexcept {
+			return allocator.owns(blk);
+		}
+
+		bool ownsClaimed(Blk blk) const {
+			return detail::ownsClaimed(allocator, blk);
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return allocator.goodSize(size < sizeof(RemoteBlock) ? sizeof(RemoteBlock) : size);
+		}
+
+		// Hands everything other threads have freed back to the allocator. Owner only.
+		void collectRemoteFrees() noexcept {
+			RemoteBlock* itr = remoteFrees.exchange(nullptr, std::memory_order_acquire);
+			while (itr != nullptr) {
+				RemoteBlock* next = itr->next;
+				allocator.deallocate({ itr, itr->size });
+				itr = next;
+			}
+		}
+
+		bool isOwner() const noexcept {
+			return detail::threadIndex() == owner;
+		}
+
+		// Hands the allocator over to another thread, e.g. the one at 'index' in a ThreadHeapAllocator
+		void setOwner(size_t threadIndex) noexcept {
+			owner = threadIndex;
+		}
+	};
+}
+
+#endif
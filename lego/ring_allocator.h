@@ -0,0 +1,198 @@
+#ifndef __LEGO_RING_ALLOCATOR_H__
+#define __LEGO_RING_ALLOCATOR_H__
+
+// Allocator for blocks that are freed in about the order they were allocated, e.g. messages in a stream.
+// It allocates at the head like a LinearAllocator, frees from the tail, and wraps around when it reaches the end:
+//
+// ---------------------------------------------------------------------
+// | rec | rec |         | rec | rec (free) | rec | rec | skip |
+// ---------------------------------------------------------------------
+//             ^ head    ^ tail
+//
+// Every record starts with a Header that holds its size, so the tail can step from one record to the next.
+// A block that is freed before the ones in front of it is only marked: the tail moves past it
+// when everything before it is free too. So frees may come in any order, but memory only comes back in order.
+// A block that doesn't fit before the end leaves the rest as a 'skip' record and goes to the start.
+//
+// From the data, the Header is found through the 4 bytes right before it,
+// which hold the distance back to the Header (and are the Header itself when there is no padding):
+// ------------------------------------------
+// | size | offset | padding | offset | data |
+// ------------------------------------------
+
+#include <cassert>
+#include <cstdint>
+#include "blk.h"
+
+#include "detail/owner_map.h"
+#include "detail/pointer.h"
+#include "detail/zero_memory.h"
+#include "local_allocator.h"
+#include "heap_allocator.h"
+
+namespace lego {
+	template<size_t Capacity, class Allocator>
+	class RingAllocator
+	{
+		struct Header {
+			uint32_t size;
+			uint32_t offset;
+		};
+
+		// Records start and end at this granularity, so there is always room for the Header of a skip record
+		constexpr static size_t granularity = alignof(uint64_t);
+		constexpr static uint32_t freeBit = uint32_t(1) << 31;
+
+		static_assert(Capacity != 0 && Capacity % granularity == 0, "Capacity must be a multiple of 8");
+		static_assert(Capacity < freeBit, "Record sizes must fit in 31 bits");
+		static_assert(sizeof(Header) == granularity);
+
+		Allocator allocator;
+		Blk memory = {};
+		char* start = nullptr;
+		detail::OwnerRegistration registration;
+
+		// Offsets from start. head == tail is either empty or full, 'used' tells which.
+		size_t head = 0;
+		size_t tail = 0;
+		size_t used = 0;
+
+		Header* headerAt(size_t offset) const noexcept {
+			return reinterpret_cast<Header*>(start + offset);
+		}
+
+		// The record size for a block at 'offset', and where its data goes
+		size_t recordSize(size_t offset, size_t size, size_t alignment, char*& data) const noexcept {
+			data = detail::pointer::getAlignForward(start + offset + sizeof(Header), alignment);
+			return detail::pointer::roundToAlignment((data - (start + offset)) + size, granularity);
+		}
+
+		// Room at 'offset' without running into the tail or the end
+		size_t roomAt(size_t offset) const noexcept {
+			if (used != 0 && offset < tail)
+				return tail - offset;
+			if (used != 0 && offset == tail)
+				return 0;
+			return Capacity - offset;
+		}
+
+		// Steps the tail over every freed record in front of it
+		void advanceTail() noexcept {
+			while (used != 0) {
+				if (tail == Capacity)
+					tail = 0;
+
+				Header* header = headerAt(tail);
+				if (!(header->size & freeBit))
+					break;
+
+				size_t size = header->size & ~freeBit;
+				tail += size;
+				used -= size;
+			}
+
+			// Empty, so the next blocks get the whole ring in one piece
+			if (used == 0)
+				head = tail = 0;
+		}
+
+	public:
+		RingAllocator() {
+			memory = allocator.allocate(Capacity, alignof(max_align_t));
+			assert(memory);
+			start = static_cast<char*>(memory.ptr);
+			registration.assign(this, start, Capacity);
+		}
+
+		~RingAllocator() {
+			registration.reset();
+			allocator.deallocate(memory);
+		}
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+
+			if (head == Capacity)
+				head = 0;
+
+			char* data;
+			size_t total = recordSize(head, size, alignment, data);
+			if (total > roomAt(head)) {
+				// Only the start is left to try, and only if the tail isn't in the way there
+				if (head < tail || (used != 0 && head == tail))
+					return {};
+
+				size_t skipped = Capacity - head;
+				total = recordSize(0, size, alignment, data);
+				if (used == 0 || total > tail)
+					return {};
+
+				// The rest of the end is a record nobody uses, the tail just steps over it
+				headerAt(head)->size = static_cast<uint32_t>(skipped) | freeBit;
+				used += skipped;
+				head = 0;
+			}
+
+			Header* header = headerAt(head);
+			uint32_t offset = static_cast<uint32_t>(data - (start + head));
+			header->size = static_cast<uint32_t>(total);
+			header->offset = offset;
+			reinterpret_cast<uint32_t*>(data)[-1] = offset;
+
+			head += total;
+			used += total;
+			return { data, static_cast<size_t>(start + head - data) };
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			Blk blk = allocate(size, alignment);
+			detail::zero(blk);
+			return blk;
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			assert(owns(blk));
+
+			char* data = static_cast<char*>(blk.ptr);
+			Header* header = reinterpret_cast<Header*>(data - reinterpret_cast<uint32_t*>(data)[-1]);
+			assert(!(header->size & freeBit));
+			header->size |= freeBit;
+
+			if (reinterpret_cast<char*>(header) == start + (tail == Capacity ? 0 : tail))
+				advanceTail();
+		}
+
+		bool owns(Blk blk) const noexcept {
+			return blk.ptr >= start && blk.ptr < start + Capacity;
+		}
+
+		// How much an allocation of 'size' really gets (with alignments up to 8)
+		size_t goodSize(size_t size) const noexcept {
+			return detail::pointer::roundToAlignment(size, granularity);
+		}
+
+		void deallocateAll() noexcept {
+			head = tail = used = 0;
+		}
+
+		// Bytes between the tail and the head, headers, padding and freed records that the tail hasn't reached included
+		size_t usedBytes() const noexcept {
+			return used;
+		}
+	};
+
+
+	template<size_t Capacity>
+	using LocalRingAllocator = RingAllocator<Capacity, LocalAllocator<Capacity>>;
+
+	template<size_t Capacity>
+	using HeapRingAllocator = RingAllocator<Capacity, HeapAllocator>;
+}
+
+#endif
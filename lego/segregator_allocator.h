@@ -4,6 +4,8 @@
 #include <cassert>
 #include "blk.h"
 
+#include "detail/owner_map.h"
+
 
 namespace lego {
 	template <size_t Threshhold, class SmallAllocator, class BigAllocator>
@@ -12,7 +14,9 @@ namespace lego {
 		SmallAllocator smallAllocator;
 		BigAllocator bigAllocator;
 	public:
-		Blk allocate(size_t size, uint8_t alignment)
+		static constexpr bool ownsUnclaimed = detail::OwnsUnclaimed<SmallAllocator>::value || detail::OwnsUnclaimed<BigAllocator>::value;
+
+		Blk allocate(size_t size, size_t alignment)
 		{
 			assert(size && alignment);
 
@@ -24,12 +28,30 @@ namespace lego {
 			}
 		}
 
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+
+			if (size > Threshhold) {
+				return bigAllocator.allocateZeroed(size, alignment);
+			}
+			else {
+				return smallAllocator.allocateZeroed(size, alignment);
+			}
+		}
+
 		void deallocate(Blk blk) noexcept  // Use pointer if pointer is not a value_type*
 		{
 			if (!blk)
 				return;
 
-			if (smallAllocator.owns(blk))
+			// Straight to the owner if it registered, asking around otherwise
+			const void* owner = detail::ownerOf(blk.ptr);
+			if (detail::isWithin(smallAllocator, owner))
+				smallAllocator.deallocate(blk);
+			else if (detail::isWithin(bigAllocator, owner))
+				bigAllocator.deallocate(blk);
+			else if (detail::claims(smallAllocator, bigAllocator, blk))
 				smallAllocator.deallocate(blk);
 			else if (bigAllocator.owns(blk))
 				bigAllocator.deallocate(blk);
@@ -38,9 +60,27 @@ namespace lego {
 		}
 
 		bool owns(const Blk& blk) const {
+			const void* owner = detail::ownerOf(blk.ptr);
+			if (detail::isWithin(smallAllocator, owner))
+				return smallAllocator.owns(blk);
+			if (detail::isWithin(bigAllocator, owner))
+				return bigAllocator.owns(blk);
 			return smallAllocator.owns(blk) || bigAllocator.owns(blk);
 		}
 
+		// Like owns(), but leaves out what only a child that owns the unclaimed would take
+		bool ownsClaimed(const Blk& blk) const {
+			return detail::ownsClaimed(smallAllocator, blk) || detail::ownsClaimed(bigAllocator, blk);
+		}
+
+		// Sizes around the threshold are capped, so that asking for the good size doesn't move to the big allocator
+		size_t goodSize(size_t size) const noexcept {
+			if (size > Threshhold)
+				return bigAllocator.goodSize(size);
+			size_t ret = smallAllocator.goodSize(size);
+			return ret > Threshhold ? Threshhold : ret;
+		}
+
 
 
 	};
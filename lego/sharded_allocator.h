@@ -0,0 +1,214 @@
+#ifndef __LEGO_SHARDED_ALLOCATOR_H__
+#define __LEGO_SHARDED_ALLOCATOR_H__
+
+// N copies of an allocator, each behind its own lock. The step between LockedAllocator,
+// where every thread waits on one lock, and ThreadHeapAllocator, where nobody waits.
+// Any allocator works, e.g. a FreeListAllocator or a StackAllocator, none of them has to know about threads.
+//
+// A thread allocates from shard threadIndex() % N, and moves on to the next shards when that one is full.
+// Blocks go back to the shard they came from, found through the owner map or by asking each shard.
+//
+// Every shard counts how often its lock was taken, how often a thread had to wait for it,
+// and how long the lock was waited for and held. That shows where the contention is left.
+// The timing costs two clock reads per call.
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include "blk.h"
+
+#include "detail/owner_map.h"
+#include "detail/thread_index.h"
+
+namespace lego {
+	struct ShardStats {
+		uint64_t acquisitions;
+		uint64_t contended;
+		uint64_t waitNanoseconds;
+		uint64_t holdNanoseconds;
+	};
+
+	template<size_t N, class Allocator, class Lock = std::mutex>
+	class ShardedAllocator
+	{
+		static_assert(N != 0);
+
+		using Clock = std::chrono::steady_clock;
+
+		// Each on its own cache lines, so that the shards don't slow each other down
+		struct alignas(64) Shard {
+			Allocator allocator;
+			mutable Lock lock;
+
+			// Only written while holding the lock, read at any time
+			mutable std::atomic<uint64_t> acquisitions = { 0 };
+			mutable std::atomic<uint64_t> contended = { 0 };
+			mutable std::atomic<uint64_t> waitNanoseconds = { 0 };
+			mutable std::atomic<uint64_t> holdNanoseconds = { 0 };
+		};
+
+		static void add(std::atomic<uint64_t>& counter, uint64_t value) noexcept {
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
+		static uint64_t nanosecondsSince(Clock::time_point begin) noexcept {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+		}
+
+		// lock_guard that keeps the shard's books
+		class Guard {
+			const Shard& shard;
+			Clock::time_point acquired;
+		public:
+			explicit Guard(const Shard& shard) : shard(shard) {
+				if (shard.lock.try_lock()) {
+					acquired = Clock::now();
+				}
+				else {
+					Clock::time_point waiting = Clock::now();
+					shard.lock.lock();
+					acquired = Clock::now();
+					add(shard.contended, 1);
+					add(shard.waitNanoseconds, std::chrono::duration_cast<std::chrono::nanoseconds>(acquired - waiting).count());
+				}
+				add(shard.acquisitions, 1);
+			}
+
+			Guard(const Guard&) = delete;
+			Guard& operator=(const Guard&) = delete;
+
+			~Guard() {
+				add(shard.holdNanoseconds, nanosecondsSince(acquired));
+				shard.lock.unlock();
+			}
+		};
+
+		Shard shards[N];
+
+		static size_t homeShard() {
+			return detail::threadIndex() % N;
+		}
+
+		// The shard the block came from, N if nobody owns it.
+		// The probes still take the lock, because some owns() walk their lists (e.g. SlabCache's),
+		// but they are short and no Guard is used, so they don't count as acquisitions in the stats.
+		// Shards with e.g. a HeapAllocator inside all own the unclaimed, so one that has the block
+		// in an arena goes first, and the others only get what no shard has claimed.
+		size_t shardOf(Blk blk) const {
+			const void* owner = detail::ownerOf(blk.ptr);
+			if (detail::isWithin(shards, owner))
+				return (static_cast<const char*>(owner) - reinterpret_cast<const char*>(shards)) / sizeof(Shard);
+
+			size_t index = claimedShardOf(blk);
+			if (index != N || !ownsUnclaimed)
+				return index;
+
+			for (size_t i = 0; i < N; ++i) {
+				std::lock_guard<Lock> guard(shards[i].lock);
+				if (shards[i].allocator.owns(blk))
+					return i;
+			}
+			return N;
+		}
+
+		size_t claimedShardOf(Blk blk) const {
+			for (size_t i = 0; i < N; ++i) {
+				std::lock_guard<Lock> guard(shards[i].lock);
+				if (detail::ownsClaimed(shards[i].allocator, blk))
+					return i;
+			}
+			return N;
+		}
+
+		template<class Function>
+		Blk tryShards(Function&& function) {
+			size_t home = homeShard();
+			for (size_t i = 0; i < N; ++i) {
+				Shard& shard = shards[(home + i) % N];
+				Guard guard(shard);
+				Blk blk = function(shard.allocator);
+				if (blk)
+					return blk;
+			}
+			return {};
+		}
+
+	public:
+		static constexpr bool ownsUnclaimed = detail::OwnsUnclaimed<Allocator>::value;
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+			return tryShards([&](Allocator& allocator) { return allocator.allocate(size, alignment); });
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+			return tryShards([&](Allocator& allocator) { return allocator.allocateZeroed(size, alignment); });
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			size_t index = shardOf(blk);
+			assert(index != N);
+			if (index == N)
+				return;
+
+			Guard guard(shards[index]);
+			shards[index].allocator.deallocate(blk);
+		}
+
+		bool owns(Blk blk) const {
+			return shardOf(blk) != N;
+		}
+
+		bool ownsClaimed(Blk blk) const {
+			return claimedShardOf(blk) != N;
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return shards[0].allocator.goodSize(size);
+		}
+
+		void deallocateAll() {
+			for (auto& shard : shards) {
+				Guard guard(shard);
+				shard.allocator.deallocateAll();
+			}
+		}
+
+		ShardStats stats(size_t shard) const noexcept {
+			assert(shard < N);
+			const Shard& from = shards[shard];
+			return {
+				from.acquisitions.load(std::memory_order_relaxed),
+				from.contended.load(std::memory_order_relaxed),
+				from.waitNanoseconds.load(std::memory_order_relaxed),
+				from.holdNanoseconds.load(std::memory_order_relaxed)
+			};
+		}
+
+		void resetStats() {
+			for (auto& shard : shards) {
+				std::lock_guard<Lock> guard(shard.lock);
+				shard.acquisitions.store(0, std::memory_order_relaxed);
+				shard.contended.store(0, std::memory_order_relaxed);
+				shard.waitNanoseconds.store(0, std::memory_order_relaxed);
+				shard.holdNanoseconds.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		constexpr static size_t shardCount() noexcept {
+			return N;
+		}
+	};
+}
+
+#endif
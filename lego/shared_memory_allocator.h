@@ -0,0 +1,393 @@
+#ifndef __LEGO_SHARED_MEMORY_ALLOCATOR_H__
+#define __LEGO_SHARED_MEMORY_ALLOCATOR_H__
+
+// Allocators that live in named shared memory (shm_open / CreateFileMapping),
+// so that several processes can allocate from and free to the same pool.
+// Hand a block to another process by sending toOffset(blk.ptr) and turning it back with fromOffset().
+//
+// The bookkeeping lives inside the shared memory and only uses offsets,
+// because every process can map the memory at a different address.
+// Use OffsetPtr for pointers inside your own shared data.
+//
+// These own their memory and need a name, so they sit at the top of a composition
+// rather than being the parent of another allocator.
+//
+// SharedSlabAllocator is lock-free.
+// SharedFreeListAllocator takes a spin lock that lives in the shared memory.
+//
+// Nothing here survives a process that dies at the wrong moment:
+// - If the creator dies before the memory is set up, the others give up after 'timeout'.
+//   attached() is false then, and allocate() returns an empty Blk.
+// - If a process dies while it holds the SharedFreeListAllocator's lock, every other process
+//   that allocates or frees spins forever. The lock can't tell a dead holder from a slow one,
+//   and the free list may be half updated anyway. remove() the name and start over.
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include "blk.h"
+
+#include "detail/pointer.h"
+#include "detail/zero_memory.h"
+#include "detail/predef_freelist_strategies.h"
+#include "detail/shared_memory.h"
+#include "detail/spin_lock.h"
+
+namespace lego {
+	namespace detail {
+		// Everyone but the creator has to wait for the creator to set up the memory
+		enum SharedState : uint32_t {
+			Uninitialized = 0,
+			Ready = 1,
+		};
+
+		// nullptr if the memory couldn't be mapped, or the creator didn't set it up within 'timeout'
+		template<class Control>
+		static Control* attachShared(const SharedMemory& memory, uint64_t magic, std::chrono::milliseconds timeout) {
+			Control* control = static_cast<Control*>(memory.data());
+			if (control == nullptr)
+				return nullptr;
+
+			if (memory.created()) {
+				new (control) Control();
+				control->magic = magic;
+				return control;
+			}
+
+			auto deadline = std::chrono::steady_clock::now() + timeout;
+			while (control->state.load(std::memory_order_acquire) != Ready) {
+				if (std::chrono::steady_clock::now() > deadline)
+					return nullptr;
+				std::this_thread::yield();
+			}
+			assert(control->magic == magic);
+			return control;
+		}
+	}
+
+	template<size_t Capacity, size_t ObjectSize, size_t ObjectAlignment>
+	class SharedSlabAllocator
+	{
+		static_assert(Capacity != 0);
+		static_assert(Capacity < UINT32_MAX, "Capacity must fit in 32 bits");
+		static_assert(ObjectSize >= sizeof(uint32_t), "ObjectSize is too small to be contained by an offset");
+		static_assert(ObjectAlignment > 0, "ObjectAlignment is 0");
+
+		constexpr static uint64_t magic = 0x4c45474f534c4142; // "LEGOSLAB"
+		constexpr static uint32_t nullOffset = UINT32_MAX;
+
+		// Free objects hold the offset of the next one, so they need at least its alignment
+		constexpr static size_t slotAlignment = ObjectAlignment > alignof(uint32_t) ? ObjectAlignment : alignof(uint32_t);
+		constexpr static size_t stride = (ObjectSize + slotAlignment - 1) / slotAlignment * slotAlignment;
+
+		// The head of the freeList is tagged with a counter, so that a pop can't succeed
+		// on a head that was popped and pushed back in the meantime (ABA).
+		struct Control {
+			uint64_t magic;
+			std::atomic<uint32_t> state = { detail::Uninitialized };
+			std::atomic<uint64_t> freeList = { nullOffset };
+			std::atomic<uint32_t> untouched = { 0 };
+		};
+		static_assert(std::atomic<uint64_t>::is_always_lock_free, "SharedSlabAllocator needs lock-free 64 bit atomics");
+
+		constexpr static size_t dataOffset = (sizeof(Control) + slotAlignment - 1) / slotAlignment * slotAlignment;
+
+		detail::SharedMemory memory;
+		Control* control = nullptr;
+		char* start = nullptr;
+
+		std::atomic<uint32_t>& nextOf(uint32_t offset) const noexcept {
+			return *reinterpret_cast<std::atomic<uint32_t>*>(start + offset);
+		}
+
+		constexpr static uint64_t pack(uint64_t tag, uint32_t offset) noexcept {
+			return (tag << 32) | offset;
+		}
+
+	public:
+		SharedSlabAllocator(const char* name, std::chrono::milliseconds timeout = detail::attachTimeout) : memory(name, dataOffset + Capacity, timeout)
+		{
+			control = detail::attachShared<Control>(memory, magic, timeout);
+			if (control == nullptr)
+				return;
+			start = reinterpret_cast<char*>(control) + dataOffset;
+			control->state.store(detail::Ready, std::memory_order_release);
+		}
+
+		// False if the memory couldn't be mapped or was never set up, see the top of this file
+		bool attached() const noexcept {
+			return control != nullptr;
+		}
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size == ObjectSize);
+			assert(alignment == ObjectAlignment);
+			if (control == nullptr)
+				return {};
+
+			uint64_t head = control->freeList.load(std::memory_order_acquire);
+			while (static_cast<uint32_t>(head) != nullOffset) {
+				// If someone else pops this object first, 'next' may be garbage, but then the CAS fails anyway.
+				uint32_t next = nextOf(static_cast<uint32_t>(head)).load(std::memory_order_relaxed);
+				if (control->freeList.compare_exchange_weak(head, pack((head >> 32) + 1, next), std::memory_order_acquire))
+					return { start + static_cast<uint32_t>(head), size };
+			}
+
+			// Nothing has been freed, carve a new object
+			uint32_t untouched = control->untouched.load(std::memory_order_relaxed);
+			while (untouched + stride <= Capacity) {
+				if (control->untouched.compare_exchange_weak(untouched, static_cast<uint32_t>(untouched + stride), std::memory_order_relaxed))
+					return { start + untouched, size };
+			}
+
+			return {};
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			Blk blk = allocate(size, alignment);
+			detail::zero(blk);
+			return blk;
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			assert(owns(blk));
+
+			uint32_t offset = static_cast<uint32_t>(toOffset(blk.ptr));
+			uint64_t head = control->freeList.load(std::memory_order_relaxed);
+			do {
+				nextOf(offset).store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+			} while (!control->freeList.compare_exchange_weak(head, pack((head >> 32) + 1, offset), std::memory_order_release));
+		}
+
+		// Nothing is ours before we are attached, and start + Capacity would be arithmetic on nullptr
+		bool owns(Blk blk) const noexcept {
+			return start != nullptr && blk.ptr >= start && blk.ptr < start + Capacity;
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			assert(size <= ObjectSize);
+			return ObjectSize;
+		}
+
+		size_t toOffset(const void* ptr) const noexcept {
+			return static_cast<const char*>(ptr) - start;
+		}
+
+		void* fromOffset(size_t offset) const noexcept {
+			return start + offset;
+		}
+	};
+
+
+	template<size_t Capacity, class FitStrategy = detail::FirstFitStrategy>
+	class SharedFreeListAllocator
+	{
+		static_assert(Capacity != 0);
+
+		constexpr static uint64_t magic = 0x4c45474f46524545; // "LEGOFREE"
+		constexpr static uint64_t nullOffset = UINT64_MAX;
+
+		// Same layout as the FreeListAllocator, but with offsets from start instead of pointers
+		struct FreeBlock {
+			uint64_t size;
+			uint64_t next;
+		};
+
+		struct Header {
+			uint64_t size;
+			uint64_t adjustment;
+		};
+
+		struct Control {
+			uint64_t magic;
+			std::atomic<uint32_t> state = { detail::Uninitialized };
+			detail::SpinLock lock;
+			uint64_t freeList = 0;
+		};
+
+		constexpr static size_t granularity = alignof(max_align_t) > sizeof(FreeBlock) ? alignof(max_align_t) : sizeof(FreeBlock);
+		constexpr static size_t minBlockSize = sizeof(FreeBlock) > sizeof(Header) ? sizeof(FreeBlock) : sizeof(Header);
+		constexpr static size_t dataOffset = (sizeof(Control) + granularity - 1) / granularity * granularity;
+
+		detail::SharedMemory memory;
+		Control* control = nullptr;
+		char* start = nullptr;
+		FitStrategy fitStrategy;
+
+		FreeBlock* toBlock(uint64_t offset) const noexcept {
+			return offset == nullOffset ? nullptr : reinterpret_cast<FreeBlock*>(start + offset);
+		}
+
+		uint64_t toBlockOffset(FreeBlock* block) const noexcept {
+			return block == nullptr ? nullOffset : reinterpret_cast<char*>(block) - start;
+		}
+
+		class iterator {
+			FreeBlock* current;
+			const SharedFreeListAllocator* owner;
+		public:
+			iterator(FreeBlock* block, const SharedFreeListAllocator* owner = nullptr) : current(block), owner(owner) {}
+			iterator& operator++() {
+				current = owner->toBlock(current->next);
+				return (*this);
+			}
+
+			FreeBlock* operator*() {
+				return current;
+			}
+
+			bool operator==(const iterator& rhs) {
+				return this->current == rhs.current;
+			}
+			bool operator!=(const iterator& rhs) {
+				return this->current != rhs.current;
+			}
+		};
+
+	public:
+		SharedFreeListAllocator(const char* name, std::chrono::milliseconds timeout = detail::attachTimeout) : memory(name, dataOffset + Capacity, timeout)
+		{
+			control = detail::attachShared<Control>(memory, magic, timeout);
+			if (control == nullptr)
+				return;
+			start = reinterpret_cast<char*>(control) + dataOffset;
+
+			if (memory.created()) {
+				FreeBlock* block = reinterpret_cast<FreeBlock*>(start);
+				block->size = detail::pointer::getAlignBackward(Capacity, granularity);
+				block->next = nullOffset;
+				control->freeList = 0;
+			}
+			control->state.store(detail::Ready, std::memory_order_release);
+		}
+
+		// False if the memory couldn't be mapped or was never set up, see the top of this file
+		bool attached() const noexcept {
+			return control != nullptr;
+		}
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+			if (control == nullptr)
+				return {};
+
+			size_t totalSize = sizeof(Header) + detail::pointer::roundToAlignment(size, granularity);
+			size_t worstPadding = alignment > granularity ? alignment - granularity : 0;
+
+			std::lock_guard<detail::SpinLock> guard(control->lock);
+
+			auto [prev, itr] = fitStrategy.find(iterator(toBlock(control->freeList), this), iterator(nullptr, this), totalSize + worstPadding);
+			if ((*itr) == nullptr)
+				return {};
+
+			size_t adjustment = detail::pointer::getAlignForwardDiff(detail::pointer::add(*itr, sizeof(Header)), alignment);
+			totalSize += adjustment;
+
+			uint64_t nextBlock;
+			size_t remainingSize = (*itr)->size - totalSize;
+			if (remainingSize < minBlockSize) {
+				nextBlock = (*itr)->next;
+				totalSize = (*itr)->size;
+			}
+			else {
+				FreeBlock* split = reinterpret_cast<FreeBlock*>(detail::pointer::add(*itr, totalSize));
+				split->size = remainingSize;
+				split->next = (*itr)->next;
+				nextBlock = toBlockOffset(split);
+			}
+
+			if (*prev)
+				(*prev)->next = nextBlock;
+			else
+				control->freeList = nextBlock;
+
+			Header* header = reinterpret_cast<Header*>(detail::pointer::add(*itr, adjustment));
+			header->size = totalSize;
+			header->adjustment = adjustment;
+			return { header + 1, totalSize - adjustment - sizeof(Header) };
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			Blk blk = allocate(size, alignment);
+			detail::zero(blk);
+			return blk;
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			assert(owns(blk));
+
+			Header* header = reinterpret_cast<Header*>(blk.ptr) - 1;
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(detail::pointer::sub(header, header->adjustment));
+			uint64_t blockSize = header->size;
+			uint64_t blockOffset = toBlockOffset(block);
+
+			std::lock_guard<detail::SpinLock> guard(control->lock);
+
+			// Find the FreeBlocks around this one, the list is sorted by address
+			FreeBlock* prev = nullptr;
+			FreeBlock* itr = toBlock(control->freeList);
+			while (itr != nullptr && toBlockOffset(itr) < blockOffset + blockSize) {
+				prev = itr;
+				itr = toBlock(itr->next);
+			}
+
+			if (prev == nullptr) {
+				block->size = blockSize;
+				block->next = control->freeList;
+				control->freeList = blockOffset;
+				prev = block;
+			}
+			else if (toBlockOffset(prev) + prev->size == blockOffset) {
+				prev->size += blockSize;
+			}
+			else {
+				block->size = blockSize;
+				block->next = prev->next;
+				prev->next = blockOffset;
+				prev = block;
+			}
+
+			if (itr != nullptr && toBlockOffset(itr) == blockOffset + blockSize) {
+				prev->size += itr->size;
+				prev->next = itr->next;
+			}
+		}
+
+		bool owns(Blk blk) const noexcept {
+			return start != nullptr && blk.ptr >= start && blk.ptr < start + Capacity;
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return detail::pointer::roundToAlignment(size, granularity);
+		}
+
+		size_t toOffset(const void* ptr) const noexcept {
+			return static_cast<const char*>(ptr) - start;
+		}
+
+		void* fromOffset(size_t offset) const noexcept {
+			return start + offset;
+		}
+	};
+}
+
+#endif
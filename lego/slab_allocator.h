@@ -7,12 +7,15 @@
 #include <cassert>
 #include "blk.h"
 
+#include "detail/owner_map.h"
 #include "detail/pointer.h"
+#include "detail/virtual_memory.h"
+#include "detail/zero_memory.h"
 #include "local_allocator.h"
 #include "heap_allocator.h"
 
 namespace lego {
-	template<size_t Capacity, size_t ObjectSize, uint8_t ObjectAlignment, class Allocator>
+	template<size_t Capacity, size_t ObjectSize, size_t ObjectAlignment, class Allocator>
 	class SlabAllocator
 	{
 		static_assert(Capacity != 0);
@@ -20,6 +23,17 @@ namespace lego {
 		Blk memory = {};
 		void** freeList = nullptr;
 		char* start = nullptr;
+		detail::OwnerRegistration registration;
+
+		// Objects are carved lazily. Everything from 'untouched' onwards has not been handed out since the last reset,
+		// so we don't have to walk (and fault in) the whole slab to build the freeList.
+		char* untouched = nullptr;
+
+		// Highest point that has been handed out since the last trim.
+		// Objects above it are zero as long as the parent gave us zeroed memory.
+		char* dirtyEnd = nullptr;
+		size_t allocated = 0;
+		size_t trimThreshold = 0;
 	public:
 		SlabAllocator() {
 			static_assert(ObjectSize > 0, "ObjectSize is 0");
@@ -30,33 +44,56 @@ namespace lego {
 
 			assert(memory.ptr != nullptr);
 			start = reinterpret_cast<char*>(memory.ptr);
+			registration.assign(this, start, Capacity);
+
+			// Unless the parent says otherwise, assume all of it is dirty
+			dirtyEnd = detail::AllocatesZeroed<Allocator>::value ? start : start + Capacity;
 
 			deallocateAll();
 
 		}
 
 		~SlabAllocator() {
+			registration.reset();
 			allocator.deallocate(memory);
 		}
 
-		Blk allocate(size_t size, uint8_t alignment)
+		Blk allocate(size_t size, size_t alignment)
 		{
 			assert(size == ObjectSize);
 			assert(alignment == ObjectAlignment);
 
-			if (freeList == nullptr)
-				return {};
-
-			void* ret = reinterpret_cast<void*>(freeList);
+			void* ret;
+			if (freeList != nullptr) {
+				ret = reinterpret_cast<void*>(freeList);
 
-			// advance the freeList to next object
-			freeList = reinterpret_cast<void**>(*freeList);
+				// advance the freeList to next object
+				freeList = reinterpret_cast<void**>(*freeList);
+			}
+			else if (ObjectSize <= static_cast<size_t>(start + Capacity - untouched)) {
+				ret = untouched;
+				untouched += ObjectSize;
+				if (untouched > dirtyEnd)
+					dirtyEnd = untouched;
+			}
+			else {
+				return {};
+			}
 
-			//++allocated;
+			++allocated;
 
 			return { ret, size };
 		}
 
+		// Recycled objects are cleared, fresh ones above the high-water mark are not
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			char* clean = dirtyEnd;
+			Blk blk = allocate(size, alignment);
+			detail::zeroOutside(blk, clean, start + Capacity);
+			return blk;
+		}
+
 		void deallocate(Blk blk)
 		{
 			assert(blk.ptr != nullptr);
@@ -68,44 +105,117 @@ namespace lego {
 			*(reinterpret_cast<void**>(blk.ptr)) = freeList;
 			freeList = reinterpret_cast<void**>(blk.ptr);
 
-			//--allocated;
+			--allocated;
 
+			if (allocated == 0 && trimThreshold != 0 && static_cast<size_t>(dirtyEnd - start) >= trimThreshold)
+				trim();
 		}
 
 		bool owns(Blk blk) const noexcept {
 			return blk.ptr >= start && blk.ptr < start + Capacity;
 		}
 
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			assert(size <= ObjectSize);
+			return ObjectSize;
+		}
+
 		void deallocateAll() {
-			uint8_t adjustment = detail::pointer::getAlignForwardDiff(start, ObjectAlignment);
+			size_t adjustment = detail::pointer::getAlignForwardDiff(start, ObjectAlignment);
+
+			freeList = nullptr;
+			untouched = start + adjustment;
+			allocated = 0;
+		}
 
-			// save it as (void**)
-			freeList = reinterpret_cast<void**>(start + adjustment);
+		// Gives the whole pages that no object is using back to the OS.
+		// Once every object is free, the whole slab is reset and trimmed.
+		// Returns the number of bytes given back.
+		size_t trim() noexcept {
+			if (allocated == 0)
+				deallocateAll();
+
+			// The page that dirtyEnd is in is dirty as a whole
+			char* end = detail::pointer::getAlignForward(dirtyEnd, detail::virtual_memory::pageSize());
+			if (end > start + Capacity)
+				end = start + Capacity;
+
+			size_t ret = detail::virtual_memory::discardPagesWithin(untouched, end);
+
+			// Same as LinearAllocator: only move the mark down if everything above it was given back
+			char* first = detail::pointer::getAlignForward(untouched, detail::virtual_memory::pageSize());
+			if (first < dirtyEnd && first + ret >= dirtyEnd)
+				dirtyEnd = first;
+			return ret;
+		}
 
-			// Calculate the number of objects.
-			size_t objectNum = (reinterpret_cast<uintptr_t>(start + Capacity) - reinterpret_cast<uintptr_t>(this->start) + adjustment) / ObjectSize;
+		// Trims automatically when the last object is freed and at least 'bytes' have been used. 0 turns it off.
+		void setTrimThreshold(size_t bytes) noexcept {
+			trimThreshold = bytes;
+		}
 
 
-			void** itr = freeList;
-			for (size_t i = 0; i < objectNum - 1; ++i) {
-				// calculate and store the address of the next item
-				*itr = detail::pointer::add(itr, ObjectSize);
-				itr = reinterpret_cast<void**>(*itr);
-			}
+	};
+
+	// SlabAllocator only takes its own ObjectSize, a SegregatorAllocator hands out anything up to it.
+	// This one rounds every request up to ObjectSize, so size classes can be built out of slabs.
+	template<size_t Capacity, size_t ObjectSize, size_t ObjectAlignment, class Allocator>
+	class SizeClassAllocator
+	{
+		static_assert(ObjectSize % ObjectAlignment == 0, "Every object must stay aligned");
 
-			*itr = nullptr;
-			//allocated = 0;
+		SlabAllocator<Capacity, ObjectSize, ObjectAlignment, Allocator> slab;
+	public:
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size <= ObjectSize);
+			// Too strict for us, a FallbackAllocator behind takes it
+			if (alignment > ObjectAlignment)
+				return {};
+			return slab.allocate(ObjectSize, ObjectAlignment);
 		}
 
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			assert(size <= ObjectSize);
+			if (alignment > ObjectAlignment)
+				return {};
+			return slab.allocateZeroed(ObjectSize, ObjectAlignment);
+		}
+
+		void deallocate(Blk blk)
+		{
+			slab.deallocate(blk);
+		}
 
+		bool owns(Blk blk) const noexcept {
+			return slab.owns(blk);
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return slab.goodSize(size);
+		}
+
+		void deallocateAll() {
+			slab.deallocateAll();
+		}
+
+		size_t trim() noexcept {
+			return slab.trim();
+		}
 	};
 
 
-	template<size_t Capacity, size_t ObjectSize, uint8_t ObjectAlignment>
+	template<size_t Capacity, size_t ObjectSize, size_t ObjectAlignment>
 	using LocalSlabAllocator = SlabAllocator<Capacity, ObjectSize, ObjectAlignment, LocalAllocator<Capacity>>;
 
-	template<size_t Capacity, size_t ObjectSize, uint8_t ObjectAlignment>
+	template<size_t Capacity, size_t ObjectSize, size_t ObjectAlignment>
 	using HeapSlabAllocator = SlabAllocator<Capacity, ObjectSize, ObjectAlignment, HeapAllocator>;
+
+	template<size_t Capacity, size_t ObjectSize, size_t ObjectAlignment>
+	using HeapSizeClassAllocator = SizeClassAllocator<Capacity, ObjectSize, ObjectAlignment, HeapAllocator>;
 }
 
 #endif 
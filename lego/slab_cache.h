@@ -0,0 +1,324 @@
+#ifndef __LEGO_SLAB_CACHE_H__
+#define __LEGO_SLAB_CACHE_H__
+
+// Object pool that grows one slab at a time, instead of being sized for the peak like SlabAllocator.
+// Every slab is SlabSize bytes, aligned to SlabSize, and starts with its own header:
+// -------------------------------------------------
+// | Slab | object | object | object | ...         |
+// -------------------------------------------------
+// ^ aligned to SlabSize
+// so the slab of any object is found by masking its address.
+//
+// Slabs are kept on three lists:
+//   partial: some objects are in use. Ordered fullest first, and allocations come from the head,
+//            so live objects are packed into as few slabs (and pages) as possible.
+//   full:    every object is in use.
+//   empty:   nothing is in use. Up to maxEmptySlabs are kept around, the rest go back to the parent.
+
+#include <cassert>
+#include <cstdint>
+#include <initializer_list>
+#include "blk.h"
+
+#include "detail/owner_map.h"
+#include "detail/pointer.h"
+#include "detail/zero_memory.h"
+#include "heap_allocator.h"
+
+namespace lego {
+	template<size_t ObjectSize, size_t Alignment, size_t SlabSize, class Allocator>
+	class SlabCache
+	{
+		static_assert(ObjectSize >= sizeof(void*), "ObjectSize is too small to be contained by void*");
+		static_assert(detail::pointer::isPowerOfTwo(Alignment), "Alignment must be a power of 2");
+		static_assert(detail::pointer::isPowerOfTwo(SlabSize), "SlabSize must be a power of 2 so that slabs can be found by masking");
+
+		struct Slab {
+			Slab* prev;
+			Slab* next;
+			void** freeList;
+
+			// Objects are carved lazily, like in SlabAllocator
+			char* untouched;
+			size_t allocated;
+
+			// What the parent gave us, to give it back
+			Blk memory;
+
+			// Who the owner map had for this memory before us
+			const void* previousOwner;
+
+			// Set while everything from 'untouched' onwards is still zero
+			bool zeroed;
+		};
+
+		struct List {
+			Slab* head = nullptr;
+			size_t count = 0;
+		};
+
+		// Free objects hold the freeList pointer, so they need at least its alignment
+		constexpr static size_t slotAlignment = Alignment > alignof(void*) ? Alignment : alignof(void*);
+		constexpr static size_t stride = (ObjectSize + slotAlignment - 1) & ~(slotAlignment - 1);
+		constexpr static size_t firstObject = (sizeof(Slab) + slotAlignment - 1) & ~(slotAlignment - 1);
+		constexpr static size_t objectsPerSlab = SlabSize > firstObject ? (SlabSize - firstObject) / stride : 0;
+		static_assert(objectsPerSlab != 0, "SlabSize is too small to hold a single object");
+
+		Allocator allocator;
+		List partial;
+		List full;
+		List empty;
+		size_t maxEmptySlabs = 1;
+
+		static void push(List& list, Slab* slab) noexcept {
+			slab->prev = nullptr;
+			slab->next = list.head;
+			if (list.head != nullptr)
+				list.head->prev = slab;
+			list.head = slab;
+			++list.count;
+		}
+
+		static void remove(List& list, Slab* slab) noexcept {
+			if (slab->prev != nullptr)
+				slab->prev->next = slab->next;
+			else
+				list.head = slab->next;
+			if (slab->next != nullptr)
+				slab->next->prev = slab->prev;
+			--list.count;
+		}
+
+		// Moves a partial slab that just lost an object behind the slabs that are now fuller than it
+		void sink(Slab* slab) noexcept {
+			Slab* after = slab->next;
+			if (after == nullptr || after->allocated <= slab->allocated)
+				return;
+
+			remove(partial, slab);
+			while (after->next != nullptr && after->next->allocated > slab->allocated)
+				after = after->next;
+
+			slab->prev = after;
+			slab->next = after->next;
+			if (after->next != nullptr)
+				after->next->prev = slab;
+			after->next = slab;
+			++partial.count;
+		}
+
+		static Slab* toSlab(void* ptr) noexcept {
+			return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(ptr) & ~(SlabSize - 1));
+		}
+
+		static void reset(Slab* slab) noexcept {
+			slab->freeList = nullptr;
+			slab->untouched = reinterpret_cast<char*>(slab) + firstObject;
+			slab->allocated = 0;
+		}
+
+		Slab* createSlab() {
+			Blk memory = allocator.allocate(SlabSize, SlabSize);
+			if (!memory)
+				return nullptr;
+
+			// The parent must honour the alignment, or masking finds the wrong header
+			if (detail::pointer::getAlignForwardDiff(memory.ptr, SlabSize) != 0) {
+				assert(false);
+				allocator.deallocate(memory);
+				return nullptr;
+			}
+
+			Slab* slab = static_cast<Slab*>(memory.ptr);
+			reset(slab);
+			slab->memory = memory;
+			slab->zeroed = detail::AllocatesZeroed<Allocator>::value;
+			slab->previousOwner = detail::OwnerMap::instance().assign(slab, static_cast<char*>(memory.ptr) + memory.size, this);
+			return slab;
+		}
+
+		void releaseSlab(Slab* slab) {
+			Blk memory = slab->memory;
+			detail::OwnerMap::instance().release(memory.ptr, static_cast<char*>(memory.ptr) + memory.size, this, slab->previousOwner);
+			allocator.deallocate(memory);
+		}
+
+		void releaseAll(List& list) {
+			while (list.head != nullptr) {
+				Slab* slab = list.head;
+				remove(list, slab);
+				releaseSlab(slab);
+			}
+		}
+
+		// Takes an object from the fullest slab that still has room. 'clean' tells if it's known to be zero.
+		void* take(bool& clean) {
+			Slab* slab = partial.head;
+			if (slab == nullptr) {
+				slab = empty.head;
+				if (slab != nullptr)
+					remove(empty, slab);
+				else
+					slab = createSlab();
+
+				if (slab == nullptr)
+					return nullptr;
+				push(partial, slab);
+			}
+
+			void* ret;
+			if (slab->freeList != nullptr) {
+				ret = slab->freeList;
+				slab->freeList = reinterpret_cast<void**>(*slab->freeList);
+				clean = false;
+			}
+			else {
+				ret = slab->untouched;
+				slab->untouched += stride;
+				clean = slab->zeroed;
+			}
+
+			// It was the fullest partial slab, so it stays at the head until it's full
+			if (++slab->allocated == objectsPerSlab) {
+				remove(partial, slab);
+				push(full, slab);
+			}
+			return ret;
+		}
+
+	public:
+		SlabCache() = default;
+		SlabCache(const SlabCache&) = delete;
+		SlabCache& operator=(const SlabCache&) = delete;
+
+		~SlabCache() {
+			deallocateAll();
+		}
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && size <= ObjectSize);
+			assert(alignment && alignment <= Alignment);
+
+			bool clean;
+			void* ret = take(clean);
+			if (ret == nullptr)
+				return {};
+			return { ret, ObjectSize };
+		}
+
+		// Objects carved from fresh, zeroed slabs are not cleared again
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			assert(size && size <= ObjectSize);
+			assert(alignment && alignment <= Alignment);
+
+			bool clean;
+			void* ret = take(clean);
+			if (ret == nullptr)
+				return {};
+
+			Blk blk = { ret, ObjectSize };
+			if (!clean)
+				detail::zero(blk);
+			return blk;
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			assert(owns(blk));
+
+			Slab* slab = toSlab(blk.ptr);
+			*reinterpret_cast<void**>(blk.ptr) = slab->freeList;
+			slab->freeList = reinterpret_cast<void**>(blk.ptr);
+
+			if (slab->allocated-- == objectsPerSlab) {
+				// Nothing can be fuller than a slab that was just full
+				remove(full, slab);
+				if (slab->allocated == 0) {
+					push(empty, slab);
+				}
+				else {
+					push(partial, slab);
+					return;
+				}
+			}
+			else if (slab->allocated != 0) {
+				sink(slab);
+				return;
+			}
+			else {
+				remove(partial, slab);
+				push(empty, slab);
+			}
+
+			// The slab is empty. Start it over so it gets carved in order again.
+			reset(slab);
+			slab->zeroed = false;
+			if (empty.count > maxEmptySlabs) {
+				remove(empty, slab);
+				releaseSlab(slab);
+			}
+		}
+
+		// Slabs of a page or more are in the owner map. Smaller ones have to be searched for,
+		// the address alone can't tell if the header in front of it is ours.
+		bool owns(Blk blk) const noexcept {
+			Slab* slab = toSlab(blk.ptr);
+			if (detail::ownerOf(blk.ptr) == this)
+				return blk.ptr >= reinterpret_cast<char*>(slab) + firstObject;
+
+			for (const List* list : { &partial, &full, &empty }) {
+				for (Slab* itr = list->head; itr != nullptr; itr = itr->next) {
+					if (itr == slab)
+						return blk.ptr >= reinterpret_cast<char*>(slab) + firstObject;
+				}
+			}
+			return false;
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			assert(size <= ObjectSize);
+			return ObjectSize;
+		}
+
+		// Gives every slab back to the parent
+		void deallocateAll() {
+			releaseAll(partial);
+			releaseAll(full);
+			releaseAll(empty);
+		}
+
+		// Gives the empty slabs back to the parent.
+		// Returns the number of bytes given back.
+		size_t trim() {
+			size_t ret = empty.count * SlabSize;
+			releaseAll(empty);
+			return ret;
+		}
+
+		// How many empty slabs are kept for the next allocations. 0 gives them back right away.
+		void setMaxEmptySlabs(size_t count) {
+			maxEmptySlabs = count;
+			while (empty.count > maxEmptySlabs) {
+				Slab* slab = empty.head;
+				remove(empty, slab);
+				releaseSlab(slab);
+			}
+		}
+
+		size_t slabCount() const noexcept {
+			return partial.count + full.count + empty.count;
+		}
+	};
+
+
+	template<size_t ObjectSize, size_t Alignment, size_t SlabSize>
+	using HeapSlabCache = SlabCache<ObjectSize, Alignment, SlabSize, HeapAllocator>;
+}
+
+#endif
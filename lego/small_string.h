@@ -0,0 +1,186 @@
+#ifndef __LEGO_SMALL_STRING_H__
+#define __LEGO_SMALL_STRING_H__
+
+// String that keeps up to N - 1 characters (and the terminating zero) inside itself,
+// and only goes to Overflow when it gets longer. See SmallVector, which holds the characters.
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include "blk.h"
+
+#include "heap_allocator.h"
+#include "small_vector.h"
+
+namespace lego {
+	template<size_t N = 32, class Overflow = HeapAllocator>
+	class SmallString
+	{
+		static_assert(N > 1, "SmallString needs room for at least one character and the terminating zero");
+
+		// Always ends with a zero, which isn't part of the string
+		SmallVector<char, N, Overflow> characters;
+
+	public:
+		using value_type = char;
+		using size_type = size_t;
+		using iterator = char*;
+		using const_iterator = const char*;
+
+		constexpr static size_t npos = std::string_view::npos;
+
+		SmallString() {
+			characters.push_back('\0');
+		}
+
+		SmallString(std::string_view text) : SmallString() {
+			append(text);
+		}
+
+		SmallString(const char* text) : SmallString(std::string_view(text)) {}
+
+		SmallString(const char* text, size_t length) : SmallString(std::string_view(text, length)) {}
+
+		SmallString(const SmallString&) = default;
+		SmallString& operator=(const SmallString&) = default;
+
+		// The moved-from string is left empty, not without its zero
+		SmallString(SmallString&& other) noexcept(std::is_nothrow_move_constructible<SmallVector<char, N, Overflow>>::value)
+			: characters(std::move(other.characters)) {
+			other.characters.push_back('\0');
+		}
+
+		SmallString& operator=(SmallString&& other) noexcept(std::is_nothrow_move_assignable<SmallVector<char, N, Overflow>>::value) {
+			if (this != &other) {
+				characters = std::move(other.characters);
+				other.characters.push_back('\0');
+			}
+			return *this;
+		}
+
+		SmallString& operator=(std::string_view text) {
+			clear();
+			return append(text);
+		}
+
+		iterator begin() noexcept { return characters.data(); }
+		iterator end() noexcept { return characters.data() + size(); }
+		const_iterator begin() const noexcept { return characters.data(); }
+		const_iterator end() const noexcept { return characters.data() + size(); }
+
+		char& operator[](size_t index) noexcept {
+			assert(index < size());
+			return characters[index];
+		}
+
+		char operator[](size_t index) const noexcept {
+			assert(index < size());
+			return characters[index];
+		}
+
+		char* data() noexcept { return characters.data(); }
+		const char* data() const noexcept { return characters.data(); }
+		const char* c_str() const noexcept { return characters.data(); }
+
+		size_t size() const noexcept { return characters.size() - 1; }
+		size_t length() const noexcept { return size(); }
+		size_t capacity() const noexcept { return characters.capacity() - 1; }
+		bool empty() const noexcept { return size() == 0; }
+
+		// Whether the characters are still inside the string itself
+		bool isInline() const noexcept { return characters.isInline(); }
+
+		void reserve(size_t capacity) {
+			characters.reserve(capacity + 1);
+		}
+
+		void clear() noexcept {
+			characters.resize(1);
+			characters[0] = '\0';
+		}
+
+		void resize(size_t size, char fill = '\0') {
+			characters.back() = fill;
+			characters.resize(size + 1, fill);
+			characters.back() = '\0';
+		}
+
+		SmallString& append(std::string_view text) {
+			if (text.empty())
+				return *this;
+
+			// 'text' may point into this string, so don't let it move before it's copied
+			size_t oldSize = size();
+			if (text.data() >= characters.data() && text.data() < characters.data() + characters.size()) {
+				size_t offset = text.data() - characters.data();
+				reserve(oldSize + text.size());
+				text = std::string_view(characters.data() + offset, text.size());
+			}
+			else {
+				reserve(oldSize + text.size());
+			}
+			characters.resize(oldSize + text.size() + 1);
+			memmove(characters.data() + oldSize, text.data(), text.size());
+			characters.back() = '\0';
+			return *this;
+		}
+
+		SmallString& append(size_t count, char c) {
+			resize(size() + count, c);
+			return *this;
+		}
+
+		void push_back(char c) {
+			characters.back() = c;
+			characters.push_back('\0');
+		}
+
+		void pop_back() noexcept {
+			assert(!empty());
+			characters.pop_back();
+			characters.back() = '\0';
+		}
+
+		SmallString& operator+=(std::string_view text) {
+			return append(text);
+		}
+
+		SmallString& operator+=(char c) {
+			push_back(c);
+			return *this;
+		}
+
+		std::string_view view() const noexcept {
+			return std::string_view(data(), size());
+		}
+
+		operator std::string_view() const noexcept {
+			return view();
+		}
+
+		std::string str() const {
+			return std::string(data(), size());
+		}
+
+		size_t find(std::string_view text, size_t position = 0) const noexcept {
+			return view().find(text, position);
+		}
+
+		int compare(std::string_view text) const noexcept {
+			return view().compare(text);
+		}
+
+		friend bool operator==(const SmallString& lhs, std::string_view rhs) noexcept { return lhs.view() == rhs; }
+		friend bool operator!=(const SmallString& lhs, std::string_view rhs) noexcept { return lhs.view() != rhs; }
+		friend bool operator<(const SmallString& lhs, std::string_view rhs) noexcept { return lhs.view() < rhs; }
+
+		friend std::ostream& operator<<(std::ostream& out, const SmallString& string) {
+			return out << string.view();
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef __LEGO_SMALL_VECTOR_H__
+#define __LEGO_SMALL_VECTOR_H__
+
+// Vector that keeps its first N elements inside itself, and only goes to Overflow when it outgrows them.
+// Short-lived small collections never touch the heap this way.
+//
+// It's what FallbackAllocator<LocalAllocator<N>, HeapAllocator> does, but usable from a container:
+// STL containers copy their allocator and a LocalAllocator's array doesn't survive a move.
+// Here the vector knows which storage it's in, so moves do the right thing:
+// - inline elements are moved one by one into the other vector's own buffer
+// - a buffer from Overflow is just handed over, as long as Overflow has no state of its own (e.g. HeapAllocator).
+//   A stateful Overflow (e.g. a LinearAllocator) owns its buffers, so those elements are moved one by one too.
+//
+// Running out of memory throws std::bad_alloc, like the standard containers.
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "blk.h"
+
+#include "heap_allocator.h"
+
+namespace lego {
+	template<class T, size_t N, class Overflow = HeapAllocator>
+	class SmallVector : private Overflow
+	{
+		static_assert(N != 0, "Use a plain vector when nothing is kept inline");
+
+		// Without state, any instance of Overflow can free what another one allocated
+		constexpr static bool canStealBuffers = std::is_empty<Overflow>::value;
+
+		alignas(T) unsigned char buffer[N * sizeof(T)];
+		T* first = reinterpret_cast<T*>(buffer);
+		size_t count = 0;
+		size_t reserved = N;
+
+		// What Overflow gave us, empty while the elements are inline
+		Blk overflow = {};
+
+		T* inlineBuffer() noexcept {
+			return reinterpret_cast<T*>(buffer);
+		}
+
+		void destroyAll() noexcept {
+			std::destroy(first, first + count);
+			count = 0;
+		}
+
+		void releaseOverflow() noexcept {
+			if (overflow) {
+				Overflow::deallocate(overflow);
+				overflow = {};
+			}
+			first = inlineBuffer();
+			reserved = N;
+		}
+
+		// Moves everything into a buffer of at least 'capacity' elements
+		void grow(size_t capacity) {
+			Blk blk = Overflow::allocate(capacity * sizeof(T), alignof(T));
+			if (!blk)
+				throw std::bad_alloc();
+
+			T* elements = static_cast<T*>(blk.ptr);
+			std::uninitialized_move(first, first + count, elements);
+			std::destroy(first, first + count);
+			if (overflow)
+				Overflow::deallocate(overflow);
+
+			overflow = blk;
+			first = elements;
+			reserved = blk.size / sizeof(T);
+		}
+
+		void growFor(size_t size) {
+			if (size > reserved)
+				grow(std::max(size, reserved * 2));
+		}
+
+		// Takes other's elements, other is left empty
+		void take(SmallVector& other) {
+			if (canStealBuffers && other.overflow) {
+				first = other.first;
+				count = other.count;
+				reserved = other.reserved;
+				overflow = other.overflow;
+				other.overflow = {};
+				other.first = other.inlineBuffer();
+				other.count = 0;
+				other.reserved = N;
+				return;
+			}
+
+			reserve(other.count);
+			std::uninitialized_move(other.first, other.first + other.count, first);
+			count = other.count;
+			other.clear();
+		}
+
+	public:
+		using value_type = T;
+		using size_type = size_t;
+		using difference_type = ptrdiff_t;
+		using reference = T&;
+		using const_reference = const T&;
+		using pointer = T*;
+		using const_pointer = const T*;
+		using iterator = T*;
+		using const_iterator = const T*;
+		using reverse_iterator = std::reverse_iterator<iterator>;
+		using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+		SmallVector() noexcept {}
+
+		explicit SmallVector(size_t size) {
+			resize(size);
+		}
+
+		SmallVector(size_t size, const T& value) {
+			resize(size, value);
+		}
+
+		SmallVector(std::initializer_list<T> values) {
+			reserve(values.size());
+			std::uninitialized_copy(values.begin(), values.end(), first);
+			count = values.size();
+		}
+
+		SmallVector(const SmallVector& other) {
+			reserve(other.count);
+			std::uninitialized_copy(other.first, other.first + other.count, first);
+			count = other.count;
+		}
+
+		SmallVector(SmallVector&& other) noexcept(canStealBuffers && std::is_nothrow_move_constructible<T>::value) {
+			take(other);
+		}
+
+		~SmallVector() {
+			destroyAll();
+			releaseOverflow();
+		}
+
+		SmallVector& operator=(const SmallVector& other) {
+			if (this != &other)
+				assign(other.begin(), other.end());
+			return *this;
+		}
+
+		SmallVector& operator=(SmallVector&& other) noexcept(canStealBuffers && std::is_nothrow_move_constructible<T>::value) {
+			if (this == &other)
+				return *this;
+
+			destroyAll();
+			if (canStealBuffers && other.overflow)
+				releaseOverflow();
+			take(other);
+			return *this;
+		}
+
+		template<class Iterator>
+		void assign(Iterator begin, Iterator end) {
+			clear();
+			for (; begin != end; ++begin) {
+				push_back(*begin);
+			}
+		}
+
+		iterator begin() noexcept { return first; }
+		iterator end() noexcept { return first + count; }
+		const_iterator begin() const noexcept { return first; }
+		const_iterator end() const noexcept { return first + count; }
+		const_iterator cbegin() const noexcept { return first; }
+		const_iterator cend() const noexcept { return first + count; }
+		reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+		reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+		const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+		const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
+
+		T& operator[](size_t index) noexcept {
+			assert(index < count);
+			return first[index];
+		}
+
+		const T& operator[](size_t index) const noexcept {
+			assert(index < count);
+			return first[index];
+		}
+
+		T& front() noexcept { return (*this)[0]; }
+		const T& front() const noexcept { return (*this)[0]; }
+		T& back() noexcept { return (*this)[count - 1]; }
+		const T& back() const noexcept { return (*this)[count - 1]; }
+
+		T* data() noexcept { return first; }
+		const T* data() const noexcept { return first; }
+
+		size_t size() const noexcept { return count; }
+		size_t capacity() const noexcept { return reserved; }
+		bool empty() const noexcept { return count == 0; }
+
+		// Whether the elements are still inside the vector itself
+		bool isInline() const noexcept { return !overflow; }
+
+		void reserve(size_t capacity) {
+			if (capacity > reserved)
+				grow(capacity);
+		}
+
+		// Moves the elements back inline if they fit, or into a buffer that fits them
+		void shrink_to_fit() {
+			if (!overflow || count == reserved)
+				return;
+
+			if (count > N) {
+				grow(count);
+				return;
+			}
+
+			T* elements = inlineBuffer();
+			std::uninitialized_move(first, first + count, elements);
+			std::destroy(first, first + count);
+			releaseOverflow();
+		}
+
+		template<class... Args>
+		T& emplace_back(Args&&... args) {
+			if (count == reserved) {
+				// The argument may live in the vector, so build the new element before moving the others
+				T value(std::forward<Args>(args)...);
+				growFor(count + 1);
+				new (first + count) T(std::move(value));
+			}
+			else {
+				new (first + count) T(std::forward<Args>(args)...);
+			}
+			return first[count++];
+		}
+
+		void push_back(const T& value) {
+			emplace_back(value);
+		}
+
+		void push_back(T&& value) {
+			emplace_back(std::move(value));
+		}
+
+		void pop_back() noexcept {
+			assert(count != 0);
+			first[--count].~T();
+		}
+
+		template<class... Args>
+		iterator emplace(const_iterator position, Args&&... args) {
+			size_t index = position - first;
+			assert(index <= count);
+			emplace_back(std::forward<Args>(args)...);
+			std::rotate(first + index, first + count - 1, first + count);
+			return first + index;
+		}
+
+		iterator insert(const_iterator position, const T& value) {
+			return emplace(position, value);
+		}
+
+		iterator insert(const_iterator position, T&& value) {
+			return emplace(position, std::move(value));
+		}
+
+		iterator erase(const_iterator position) {
+			return erase(position, position + 1);
+		}
+
+		iterator erase(const_iterator begin, const_iterator end) {
+			T* from = first + (begin - first);
+			T* to = first + (end - first);
+			assert(from <= to && to <= first + count);
+			T* newEnd = std::move(to, first + count, from);
+			std::destroy(newEnd, first + count);
+			count = newEnd - first;
+			return from;
+		}
+
+		void resize(size_t size) {
+			if (size < count) {
+				erase(begin() + size, end());
+				return;
+			}
+			reserve(size);
+			std::uninitialized_value_construct(first + count, first + size);
+			count = size;
+		}
+
+		void resize(size_t size, const T& value) {
+			if (size < count) {
+				erase(begin() + size, end());
+				return;
+			}
+			reserve(size);
+			std::uninitialized_fill(first + count, first + size, value);
+			count = size;
+		}
+
+		// Keeps the buffer, like std::vector
+		void clear() noexcept {
+			destroyAll();
+		}
+
+		bool operator==(const SmallVector& rhs) const {
+			return std::equal(begin(), end(), rhs.begin(), rhs.end());
+		}
+
+		bool operator!=(const SmallVector& rhs) const {
+			return !(*this == rhs);
+		}
+	};
+}
+
+#endif
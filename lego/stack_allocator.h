@@ -3,11 +3,16 @@
 
 
 #include <cassert>
+#include <cstring>
 #include "blk.h"
+#include "detail/owner_map.h"
 #include "detail/pointer.h"
+#include "detail/virtual_memory.h"
+#include "detail/zero_memory.h"
 
 #include "local_allocator.h"
 #include "heap_allocator.h"
+#include "virtual_allocator.h"
 
 namespace lego {
 	// The Stack Base needs to be freed in the reverse order of its allocation.
@@ -15,54 +20,132 @@ namespace lego {
 	// there will be a Header metadata allocd at the bottom of the given memory.
 	// 
 	// The Header will store the space between each data (due to how alignment works)
+	// Most adjustments fit in a single byte. Bigger ones (e.g. page alignment) store 
+	// the escape value 'largeAdjustment' in the Header, and the real adjustment in a size_t right above it.
 	// ----------------------------------------------------------------------------------------- 
 	// | data | | data | data | | | data |                         |header|header|header|header| 
 	// -----------------------------------------------------------------------------------------
 	//        ^^^ space
 	// ^ start                           ^ current                 ^metaDataCurrent            ^ end
 	//
+	// With a parent that commits on demand (e.g. VirtualAllocator), both ends are committed as they grow towards each other:
+	// the data upwards from start, and the headers downwards from the end. What lies in between is only reserved.
+	// -----------------------------------------------------------------------------------------
+	// | data | data |  committed  |            reserved only             | committed |header|
+	// -----------------------------------------------------------------------------------------
+	//               ^ current    ^ dataCommittedEnd      metadataCommittedBegin ^     ^ metadataCurrent
+	//
 
 	template <size_t Capacity, class Allocator>
 	class StackAllocator {
 		static_assert(Capacity != 0);
-		// The adjustment value should not be bigger than uint8_t 
 		struct Header {
 			uint8_t adjustment;
 		};
+		constexpr static uint8_t largeAdjustment = UINT8_MAX;
 		Allocator allocator;
 		Blk memoryBlock = {};
 		char* start = nullptr;
+		detail::OwnerRegistration registration;
 		char* current = nullptr;
 		char* metadataCurrent = nullptr; // Pointer to the start of metadata of headers
+
+		// Everything outside [dataCommittedEnd, metadataCommittedBegin) is usable.
+		// Parents that don't commit on demand give us all of it up front, so both cover everything.
+		constexpr static bool commitsOnDemand = detail::CommitsOnDemand<Allocator>::value;
+		char* dataCommittedEnd = nullptr;
+		char* metadataCommittedBegin = nullptr;
+		size_t retainedBytes = 1024 * 1024;
+
+		// Commits the pages from the committed data up to 'end'
+		bool commitDataUpTo(char* end) noexcept {
+			if constexpr (commitsOnDemand) {
+				// The pages beyond metadataCommittedBegin are already committed for the headers
+				char* newEnd = detail::pointer::getAlignForward(end, Allocator::commitGranularity);
+				if (newEnd > metadataCommittedBegin)
+					newEnd = metadataCommittedBegin;
+				if (!allocator.commit(dataCommittedEnd, newEnd - dataCommittedEnd))
+					return false;
+
+				dataCommittedEnd = newEnd;
+				registration.grow(dataCommittedEnd - start);
+				return true;
+			}
+			else {
+				return false;
+			}
+		}
+
+		// Commits the pages from the committed headers down to 'begin'
+		bool commitMetadataDownTo(char* begin) noexcept {
+			if constexpr (commitsOnDemand) {
+				char* newBegin = detail::pointer::getAlignBackward(begin, Allocator::commitGranularity);
+				if (newBegin < dataCommittedEnd)
+					newBegin = dataCommittedEnd;
+				if (!allocator.commit(newBegin, metadataCommittedBegin - newBegin))
+					return false;
+
+				metadataCommittedBegin = newBegin;
+				return true;
+			}
+			else {
+				return false;
+			}
+		}
 	public:
 		StackAllocator()
 		{
 			memoryBlock = allocator.allocate(Capacity, alignof(max_align_t));
 			assert(memoryBlock);
 			start = reinterpret_cast<char*>(memoryBlock.ptr);
+
+			// Nothing is committed yet, so the owner map only takes the data pages in as they are
+			if constexpr (commitsOnDemand) {
+				dataCommittedEnd = start;
+				metadataCommittedBegin = detail::pointer::getAlignForward(start + Capacity, detail::virtual_memory::pageSize());
+			}
+			else {
+				dataCommittedEnd = start + Capacity;
+				metadataCommittedBegin = start;
+			}
+			registration.assign(this, start, dataCommittedEnd - start);
 			deallocateAll();
 		}
 
 		~StackAllocator()
 		{
+			registration.reset();
 			allocator.deallocate(memoryBlock);
 		}
 
-		Blk allocate(size_t size, uint8_t alignment) noexcept
+		Blk allocate(size_t size, size_t alignment) noexcept
 		{
 			assert(size != 0);
 			assert(alignment != 0);
 
-			uint8_t adjustment = detail::pointer::getAlignForwardDiff(current, alignment);
+			size_t adjustment = detail::pointer::getAlignForwardDiff(current, alignment);
+			size_t metadataSize = sizeof(Header) + (adjustment >= largeAdjustment ? sizeof(size_t) : 0);
 
 			// Make sure that there is space to alloc 
-			if (current + adjustment + size > metadataCurrent - sizeof(Header)) {
+			size_t available = metadataCurrent - current;
+			if (available < metadataSize || adjustment + size > available - metadataSize) {
+				return {};
+			}
+			if (metadataCurrent - metadataSize < metadataCommittedBegin && !commitMetadataDownTo(metadataCurrent - metadataSize)) {
+				return {};
+			}
+			if (current + adjustment + size > dataCommittedEnd && !commitDataUpTo(current + adjustment + size)) {
 				return {};
 			}
 
 			// alloc for header
+			if (adjustment >= largeAdjustment) {
+				// metadata is only byte aligned, so copy the big adjustment in
+				this->metadataCurrent -= sizeof(size_t);
+				std::memcpy(this->metadataCurrent, &adjustment, sizeof(size_t));
+			}
 			this->metadataCurrent -= sizeof(Header);
-			reinterpret_cast<Header*>(this->metadataCurrent)->adjustment = adjustment;
+			reinterpret_cast<Header*>(this->metadataCurrent)->adjustment = adjustment >= largeAdjustment ? largeAdjustment : static_cast<uint8_t>(adjustment);
 
 			// alloc for data, just like linear allocation
 			char* alignedAddress = this->current + adjustment;
@@ -77,6 +160,18 @@ namespace lego {
 			return blk.ptr >= start && blk.ptr < start + Capacity;
 		}
 
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return size;
+		}
+
+
+		Blk allocateZeroed(size_t size, size_t alignment) noexcept
+		{
+			Blk blk = allocate(size, alignment);
+			detail::zero(blk);
+			return blk;
+		}
 
 		void deallocate(Blk blk)  noexcept
 		{
@@ -86,10 +181,16 @@ namespace lego {
 			assert(owns(blk));
 
 			// When you free, get the adjustment from the current Header to know how much to fall back 
-			this->current = reinterpret_cast<char*>(blk.ptr) - reinterpret_cast<Header*>(this->metadataCurrent)->adjustment;
+			size_t adjustment = reinterpret_cast<Header*>(this->metadataCurrent)->adjustment;
 
 			// And move the metadataCurrent forward
 			this->metadataCurrent += sizeof(Header);
+			if (adjustment == largeAdjustment) {
+				std::memcpy(&adjustment, this->metadataCurrent, sizeof(size_t));
+				this->metadataCurrent += sizeof(size_t);
+			}
+
+			this->current = reinterpret_cast<char*>(blk.ptr) - adjustment;
 		}
 
 		void deallocateAll() noexcept {
@@ -98,6 +199,56 @@ namespace lego {
 			// Make sure the metadata starts at an piece of memory that it aligns to.
 			// From here on, our Headers will be contiguously lined up :)
 			this->metadataCurrent = detail::pointer::getAlignBackward(start + Capacity, alignof(Header));
+
+			if constexpr (commitsOnDemand)
+				decommitAbove(retainedBytes);
+		}
+
+		// With a parent that commits on demand: decommits what isn't in use beyond the first 'bytes' of data,
+		// and beyond the last 'bytes' of headers. Returns the number of bytes given back.
+		size_t decommitAbove(size_t bytes) noexcept {
+			if constexpr (commitsOnDemand) {
+				size_t pageSize = detail::virtual_memory::pageSize();
+				size_t ret = 0;
+
+				size_t kept = bytes > static_cast<size_t>(current - start) ? bytes : current - start;
+				if (kept < static_cast<size_t>(dataCommittedEnd - start)) {
+					char* mark = detail::pointer::getAlignForward(start + kept, pageSize);
+					if (mark < dataCommittedEnd) {
+						allocator.decommit(mark, dataCommittedEnd - mark);
+						ret += dataCommittedEnd - mark;
+						dataCommittedEnd = mark;
+					}
+				}
+
+				char* end = detail::pointer::getAlignForward(start + Capacity, pageSize);
+				kept = bytes > static_cast<size_t>(end - metadataCurrent) ? bytes : end - metadataCurrent;
+				if (kept < static_cast<size_t>(end - metadataCommittedBegin)) {
+					char* mark = detail::pointer::getAlignBackward(end - kept, pageSize);
+					if (mark > metadataCommittedBegin) {
+						allocator.decommit(metadataCommittedBegin, mark - metadataCommittedBegin);
+						ret += mark - metadataCommittedBegin;
+						metadataCommittedBegin = mark;
+					}
+				}
+				return ret;
+			}
+			else {
+				return 0;
+			}
+		}
+
+		// How much deallocateAll() keeps committed at either end, 1MB by default
+		void setRetainedBytes(size_t bytes) noexcept {
+			retainedBytes = bytes;
+		}
+
+		// What is usable without committing more. All of it if the parent doesn't commit on demand.
+		size_t committedBytes() const noexcept {
+			if constexpr (commitsOnDemand)
+				return (dataCommittedEnd - start) + (detail::pointer::getAlignForward(start + Capacity, detail::virtual_memory::pageSize()) - metadataCommittedBegin);
+			else
+				return Capacity;
 		}
 
 
@@ -109,6 +260,9 @@ namespace lego {
 	template<size_t Capacity>
 	using HeapStackAllocator = StackAllocator<Capacity, HeapAllocator>;
 
+	template<size_t Capacity>
+	using VirtualStackAllocator = StackAllocator<Capacity, VirtualAllocator>;
+
 }
 
 
@@ -5,7 +5,24 @@
 // https://howardhinnant.github.io/allocator_boilerplate.html
 // For use in STL containers. Kind of an adaptor for the rest of the allocators.
 
+#include <cstddef>
+#include <memory>
+#include "blk.h"
+
 namespace lego {
+	// What allocate_at_least() returns: the memory and how many objects really fit in it.
+	// Containers that know about it (C++23) use the extra room as capacity instead of wasting it.
+#ifdef __cpp_lib_allocate_at_least
+	template<typename Pointer>
+	using allocation_result = std::allocation_result<Pointer>;
+#else
+	template<typename Pointer>
+	struct allocation_result {
+		Pointer ptr;
+		size_t count;
+	};
+#endif
+
 	template<typename T, class Allocator>
 	class STLAdapter : private Allocator
 	{
@@ -20,9 +37,15 @@ namespace lego {
 			return static_cast<value_type*>(Allocator::allocate(size * sizeof(value_type), alignof(value_type)).ptr);
 		}
 
+		allocation_result<value_type*> allocate_at_least(size_t size)
+		{
+			Blk blk = Allocator::allocate(size * sizeof(value_type), alignof(value_type));
+			return { static_cast<value_type*>(blk.ptr), blk.size / sizeof(value_type) };
+		}
+
 		void deallocate(value_type* p, size_t size) noexcept 
 		{
-			Allocator::deallocate({ p, size });
+			Allocator::deallocate({ p, size * sizeof(value_type) });
 		}
 
 	};
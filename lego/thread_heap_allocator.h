@@ -0,0 +1,127 @@
+#ifndef __LEGO_THREAD_HEAP_ALLOCATOR_H__
+#define __LEGO_THREAD_HEAP_ALLOCATOR_H__
+
+// One Allocator per thread, so that threads never wait on each other.
+// A thread allocates from its own heap. Freeing goes back to whichever heap owns the block:
+// directly if it's ours, through that heap's remote free list if it's another thread's.
+//
+// Threads are numbered with detail::threadIndex(), and the first MaxThreads of them get a heap each.
+// When a thread exits, the next new thread takes over its heap.
+// Threads beyond MaxThreads share one more heap behind a lock, so they work, just not as fast.
+// If the heaps register with the owner map, the owning heap is found without asking each one.
+
+#include <cassert>
+#include "blk.h"
+
+#include "detail/owner_map.h"
+#include "detail/thread_index.h"
+#include "locked_allocator.h"
+#include "remote_free_allocator.h"
+
+namespace lego {
+	template<size_t MaxThreads, class Allocator>
+	class ThreadHeapAllocator
+	{
+		static_assert(MaxThreads != 0);
+
+		RemoteFreeAllocator<Allocator> heaps[MaxThreads];
+		LockedAllocator<Allocator> overflow;
+
+		// heapOf() answers with an index into heaps, or one of these
+		constexpr static size_t overflowIndex = MaxThreads;
+		constexpr static size_t unknownIndex = MaxThreads + 1;
+
+		// The heap the owner map says the block is in
+		size_t heapOf(const void* ptr) const noexcept {
+			const void* owner = detail::ownerOf(ptr);
+			if (detail::isWithin(heaps, owner))
+				return (static_cast<const char*>(owner) - reinterpret_cast<const char*>(heaps)) / sizeof(heaps[0]);
+			if (detail::isWithin(overflow, owner))
+				return overflowIndex;
+			return unknownIndex;
+		}
+
+		// Same, by asking every heap. Heaps that own the unclaimed (e.g. with a HeapAllocator inside)
+		// would all say yes, so the one that has the block in an arena goes first.
+		size_t searchHeapOf(Blk blk) const noexcept {
+			for (size_t i = 0; i < MaxThreads; ++i) {
+				if (detail::ownsClaimed(heaps[i], blk))
+					return i;
+			}
+			if (detail::ownsClaimed(overflow, blk))
+				return overflowIndex;
+			if (!ownsUnclaimed)
+				return unknownIndex;
+
+			for (size_t i = 0; i < MaxThreads; ++i) {
+				if (heaps[i].owns(blk))
+					return i;
+			}
+			return overflow.owns(blk) ? overflowIndex : unknownIndex;
+		}
+	public:
+		static constexpr bool ownsUnclaimed = detail::OwnsUnclaimed<Allocator>::value;
+
+		ThreadHeapAllocator() {
+			for (size_t i = 0; i < MaxThreads; ++i) {
+				heaps[i].setOwner(i);
+			}
+		}
+
+		Blk allocate(size_t size, size_t alignment)
+		{
+			size_t index = detail::threadIndex();
+			if (index >= MaxThreads)
+				return overflow.allocate(size, alignment);
+			return heaps[index].allocate(size, alignment);
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			size_t index = detail::threadIndex();
+			if (index >= MaxThreads)
+				return overflow.allocateZeroed(size, alignment);
+			return heaps[index].allocateZeroed(size, alignment);
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			size_t index = heapOf(blk.ptr);
+			if (index == unknownIndex)
+				index = searchHeapOf(blk);
+			assert(index != unknownIndex);
+
+			if (index == overflowIndex)
+				overflow.deallocate(blk);
+			else if (index != unknownIndex)
+				heaps[index].deallocate(blk);
+		}
+
+		bool owns(Blk blk) const noexcept {
+			size_t index = heapOf(blk.ptr);
+			if (index == overflowIndex)
+				return overflow.owns(blk);
+			if (index != unknownIndex)
+				return heaps[index].owns(blk);
+			return searchHeapOf(blk) != unknownIndex;
+		}
+
+		bool ownsClaimed(Blk blk) const noexcept {
+			for (size_t i = 0; i < MaxThreads; ++i) {
+				if (detail::ownsClaimed(heaps[i], blk))
+					return true;
+			}
+			return detail::ownsClaimed(overflow, blk);
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return heaps[0].goodSize(size);
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef __LEGO_VIRTUAL_ALLOCATOR_H__
+#define __LEGO_VIRTUAL_ALLOCATOR_H__
+
+// Allocator that only reserves address space (PROT_NONE / MEM_RESERVE), and leaves it to the arena on top
+// to commit the pages as it reaches them. So an arena can reserve e.g. 64GB up front, pay only for what it touches,
+// and grow in place without ever chaining or moving:
+//
+// ------------------------------------------------------------------------
+// | committed          |                reserved only                    |
+// ------------------------------------------------------------------------
+// ^ start    ^ current ^ committedEnd                                    ^ start + Capacity
+//
+// Arenas that see commitsOnDemand (LinearAllocator, StackAllocator) commit as they grow,
+// and decommit what lies above their retained bytes on deallocateAll().
+// Any other allocator gets unusable memory from it, so only use it below those.
+#include <cassert>
+#include <type_traits>
+#include "blk.h"
+#include "detail/owner_map.h"
+#include "detail/pointer.h"
+#include "detail/virtual_memory.h"
+
+
+namespace lego {
+	namespace detail {
+		// Parents that hand out reserved memory declare
+		//     static constexpr bool commitsOnDemand = true;
+		// and the arenas on top commit() the pages before they use them.
+		template<class Allocator, class = void>
+		struct CommitsOnDemand : std::false_type {};
+
+		template<class Allocator>
+		struct CommitsOnDemand<Allocator, std::void_t<decltype(Allocator::commitsOnDemand)>> : std::bool_constant<Allocator::commitsOnDemand> {};
+	}
+
+	class VirtualAllocator
+	{
+		static size_t roundToPage(size_t size) noexcept {
+			return detail::pointer::roundToAlignment(size, detail::virtual_memory::pageSize());
+		}
+	public:
+		static constexpr bool commitsOnDemand = true;
+
+		// Committed pages start out zeroed, and so do the ones that were decommitted and committed again
+		static constexpr bool allocatesZeroed = true;
+
+		// Arenas commit at least this much at a time, so growing doesn't take a system call per page
+		static constexpr size_t commitGranularity = 64 * 1024;
+
+		// Same as PageAllocator
+		static constexpr bool ownsUnclaimed = true;
+
+		// Reserves whole pages, none of them usable yet
+		Blk allocate(size_t size, size_t alignment)
+		{
+			assert(size && alignment);
+
+			size = roundToPage(size);
+			void* ptr = detail::virtual_memory::reserve(size, alignment);
+			if (ptr == nullptr)
+				return {};
+
+			return { ptr, size };
+		}
+
+		Blk allocateZeroed(size_t size, size_t alignment)
+		{
+			return allocate(size, alignment);
+		}
+
+		void deallocate(Blk blk)
+		{
+			if (!blk)
+				return;
+
+			detail::virtual_memory::release(blk.ptr, roundToPage(blk.size));
+		}
+
+		// Makes [ptr, ptr + size) usable. Both must be page aligned.
+		bool commit(void* ptr, size_t size) noexcept {
+			return size == 0 || detail::virtual_memory::commit(ptr, size);
+		}
+
+		// Gives [ptr, ptr + size) back to the OS. It stays reserved, and must be committed again before it's used.
+		void decommit(void* ptr, size_t size) noexcept {
+			if (size != 0)
+				detail::virtual_memory::decommit(ptr, size);
+		}
+
+		// Anything no arena has claimed in the owner map
+		bool owns(Blk blk) const noexcept {
+			return detail::ownerOf(blk.ptr) == nullptr;
+		}
+
+		// How much an allocation of 'size' really gets
+		size_t goodSize(size_t size) const noexcept {
+			return roundToPage(size);
+		}
+	};
+}
+
+#endif
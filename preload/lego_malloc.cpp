@@ -0,0 +1,270 @@
+// Replaces malloc/free/operator new and friends with a lego composition,
+// so that lego can run under programs that know nothing about it:
+//
+//     g++ -std=c++17 -O2 -shared -fPIC -o liblego_malloc.so preload/lego_malloc.cpp
+//     LD_PRELOAD=./liblego_malloc.so ./some_program
+//
+// Linux/glibc only. Everything is behind one spin lock, it's meant for measuring
+// compositions under real programs, not for being the fastest malloc around.
+//
+// lego allocators need the size back on deallocate, and free() doesn't give it to us.
+// So every block starts with a Header that remembers the Blk it came from:
+// ----------------------------------------
+// | padding | Header | user data         |
+// ----------------------------------------
+// ^ blk.ptr          ^ returned to the user
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <malloc.h>
+#include <pthread.h>
+
+#include "../lego/blk.h"
+#include "../lego/detail/pointer.h"
+#include "../lego/detail/spin_lock.h"
+#include "../lego/page_allocator.h"
+#include "../lego/slab_allocator.h"
+#include "../lego/freelist_allocator.h"
+#include "../lego/fallback_allocator.h"
+#include "../lego/segregator_allocator.h"
+#include "../lego/null_allocator.h"
+
+using namespace lego;
+
+namespace {
+	template<size_t ObjectSize, size_t Capacity>
+	using SizeClass = SizeClassAllocator<Capacity, ObjectSize, alignof(max_align_t), PageAllocator>;
+
+	using Small = SegregatorAllocator<64,
+		SegregatorAllocator<32, SizeClass<32, 4 * 1024 * 1024>, SizeClass<64, 4 * 1024 * 1024>>,
+		SegregatorAllocator<128, SizeClass<128, 4 * 1024 * 1024>, SizeClass<256, 4 * 1024 * 1024>>>;
+
+	// Small sizes go to the slabs, and to the free list once their slab is full.
+	// Everything in here knows exactly which memory it owns.
+	using Pools = FallbackAllocator<
+		SegregatorAllocator<256, Small, NullAllocator>,
+		FreeListAllocator<64 * 1024 * 1024, PageAllocator, detail::FirstFitStrategy>>;
+
+	// PageAllocator owns whatever no arena has claimed, the composites ask it last when a block is freed.
+	// Everything gets its memory from the OS directly, going through HeapAllocator would call ourselves.
+	using Composition = SegregatorAllocator<256 * 1024,
+		FallbackAllocator<Pools, PageAllocator>,
+		PageAllocator>;
+
+	struct Header {
+		void* base;
+		size_t size;
+	};
+	static_assert(sizeof(Header) % alignof(max_align_t) == 0, "Header must keep the user data aligned");
+
+	detail::SpinLock lock;
+	alignas(Composition) char storage[sizeof(Composition)];
+	Composition* composition = nullptr;
+
+	// A child of fork() only has the thread that forked. If another thread held the lock at that moment,
+	// nobody would ever release it in the child. So fork() waits for the lock, and both sides let go of it.
+	struct ForkHandlers {
+		ForkHandlers() {
+			pthread_atfork([]() { lock.lock(); }, []() { lock.unlock(); }, []() { lock.unlock(); });
+		}
+	} forkHandlers;
+
+	// We may be called before any static constructor has run, so build the composition on first use
+	Composition& getComposition() {
+		if (composition == nullptr)
+			composition = new (storage) Composition();
+		return *composition;
+	}
+
+	Header* toHeader(void* ptr) {
+		return static_cast<Header*>(ptr) - 1;
+	}
+
+	// 'zeroed' lets the composition skip clearing memory it knows is zero (e.g. fresh pages)
+	void* allocate(size_t size, size_t alignment, bool zeroed = false) {
+		if (alignment < alignof(max_align_t))
+			alignment = alignof(max_align_t);
+
+		// Every Blk we get is aligned to max_align_t, anything above that needs room to move forward
+		size_t padding = alignment - alignof(max_align_t);
+		if (size > SIZE_MAX - sizeof(Header) - padding)
+			return nullptr;
+
+		Blk blk;
+		{
+			std::lock_guard<detail::SpinLock> guard(lock);
+			if (zeroed)
+				blk = getComposition().allocateZeroed(size + sizeof(Header) + padding, alignof(max_align_t));
+			else
+				blk = getComposition().allocate(size + sizeof(Header) + padding, alignof(max_align_t));
+		}
+		if (!blk)
+			return nullptr;
+
+		void* ret = detail::pointer::getAlignForward(static_cast<char*>(blk.ptr) + sizeof(Header), alignment);
+		Header* header = toHeader(ret);
+		header->base = blk.ptr;
+		header->size = blk.size;
+		return ret;
+	}
+
+	void deallocate(void* ptr) {
+		if (ptr == nullptr)
+			return;
+
+		Header* header = toHeader(ptr);
+		std::lock_guard<detail::SpinLock> guard(lock);
+		getComposition().deallocate({ header->base, header->size });
+	}
+
+	size_t usableSize(void* ptr) {
+		if (ptr == nullptr)
+			return 0;
+
+		Header* header = toHeader(ptr);
+		return static_cast<char*>(header->base) + header->size - static_cast<char*>(ptr);
+	}
+
+	void* allocateOrThrow(size_t size, size_t alignment) {
+		void* ret = allocate(size ? size : 1, alignment);
+		if (ret == nullptr)
+			throw std::bad_alloc();
+		return ret;
+	}
+
+	// The C functions tell why they failed through errno
+	void* allocateOrSetErrno(size_t size, size_t alignment, bool zeroed = false) {
+		void* ret = allocate(size ? size : 1, alignment, zeroed);
+		if (ret == nullptr)
+			errno = ENOMEM;
+		return ret;
+	}
+}
+
+// glibc declares these as noexcept in C++, so we have to match
+extern "C" {
+	void* malloc(size_t size) noexcept {
+		return allocateOrSetErrno(size, alignof(max_align_t));
+	}
+
+	void free(void* ptr) noexcept {
+		deallocate(ptr);
+	}
+
+	void* calloc(size_t count, size_t size) noexcept {
+		if (size != 0 && count > SIZE_MAX / size) {
+			errno = ENOMEM;
+			return nullptr;
+		}
+
+		size_t bytes = count * size;
+		return allocateOrSetErrno(bytes, alignof(max_align_t), true);
+	}
+
+	void* realloc(void* ptr, size_t size) noexcept {
+		if (ptr == nullptr)
+			return malloc(size);
+
+		if (size == 0) {
+			free(ptr);
+			return nullptr;
+		}
+
+		// The block is often bigger than what was asked for
+		size_t oldSize = usableSize(ptr);
+		if (size <= oldSize)
+			return ptr;
+
+		void* ret = malloc(size);
+		if (ret != nullptr) {
+			memcpy(ret, ptr, oldSize);
+			free(ptr);
+		}
+		return ret;
+	}
+
+	int posix_memalign(void** result, size_t alignment, size_t size) noexcept {
+		if (!detail::pointer::isPowerOfTwo(alignment) || alignment % sizeof(void*) != 0)
+			return EINVAL;
+
+		void* ret = allocate(size ? size : 1, alignment);
+		if (ret == nullptr)
+			return ENOMEM;
+
+		*result = ret;
+		return 0;
+	}
+
+	void* aligned_alloc(size_t alignment, size_t size) noexcept {
+		if (!detail::pointer::isPowerOfTwo(alignment)) {
+			errno = EINVAL;
+			return nullptr;
+		}
+		return allocateOrSetErrno(size, alignment);
+	}
+
+	void* memalign(size_t alignment, size_t size) noexcept {
+		return aligned_alloc(alignment, size);
+	}
+
+	void* valloc(size_t size) noexcept {
+		return allocateOrSetErrno(size, detail::virtual_memory::pageSize());
+	}
+
+	void* pvalloc(size_t size) noexcept {
+		size_t pageSize = detail::virtual_memory::pageSize();
+		return allocateOrSetErrno(detail::pointer::roundToAlignment(size ? size : 1, pageSize), pageSize);
+	}
+
+	size_t malloc_usable_size(void* ptr) noexcept {
+		return usableSize(ptr);
+	}
+}
+
+void* operator new(size_t size) {
+	return allocateOrThrow(size, alignof(max_align_t));
+}
+
+void* operator new[](size_t size) {
+	return allocateOrThrow(size, alignof(max_align_t));
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	return allocate(size ? size : 1, alignof(max_align_t));
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+	return allocate(size ? size : 1, alignof(max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+	return allocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+	return allocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	return allocate(size ? size : 1, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	return allocate(size ? size : 1, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, size_t) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { deallocate(ptr); }
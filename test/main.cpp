@@ -1,6 +1,17 @@
 #include <iostream>
+#include <cmath>
+#include <cstring>
 #include <vector>
 #include <list>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <string>
+#include <random>
+#include <sstream>
 #include "../lego/heap_allocator.h"
 #include "../lego/null_allocator.h"
 #include "../lego/stl_adapter.h"
@@ -8,9 +19,30 @@
 #include "../lego/log_allocator.h"
 #include "../lego/stack_allocator.h"
 #include "../lego/linear_allocator.h"
+#include "../lego/atomic_linear_allocator.h"
 #include "../lego/segregator_allocator.h"
 #include "../lego/freelist_allocator.h"
+#include "../lego/compact_freelist_allocator.h"
 #include "../lego/slab_allocator.h"
+#include "../lego/slab_cache.h"
+#include "../lego/buddy_allocator.h"
+#include "../lego/thread_heap_allocator.h"
+#include "../lego/locked_allocator.h"
+#include "../lego/sharded_allocator.h"
+#include "../lego/epoch_allocator.h"
+#include "../lego/handle_pool.h"
+#include "../lego/profiling_allocator.h"
+#include "../lego/latency_probe_allocator.h"
+#include "../lego/small_vector.h"
+#include "../lego/small_string.h"
+#include "../lego/object_arena.h"
+#include "../lego/buffer_pool.h"
+#include "../lego/ring_allocator.h"
+#include "../lego/page_allocator.h"
+#include "../lego/virtual_allocator.h"
+#include "../lego/shared_memory_allocator.h"
+#include "../lego/offset_ptr.h"
+#include "../lego/persistent_linear_allocator.h"
 
 using namespace std;
 using namespace lego;
@@ -161,6 +193,47 @@ void TestLinearAllocator() {
 	cout << "Testing deallocateAll integrity..." << (!expectNullBlk && allocatesSuccess ? "YES" : "NO") << endl;
 	cout << endl;
 }
+void TestAtomicLinearAllocator() {
+	cout << "=== Testing AtomicLinear allocator" << endl;
+	constexpr int threadCount = 8;
+	constexpr int allocationCount = 1000;
+	using Allocator = HeapAtomicLinearAllocator<threadCount * allocationCount * 16>;
+	Allocator allocator;
+
+	// Every thread allocates at the same time. None of the blocks should overlap.
+	vector<Blk> blks[threadCount];
+	vector<thread> threads;
+	for (int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&, t]() {
+			for (int i = 0; i < allocationCount; ++i) {
+				blks[t].push_back(allocator.allocate(1 + (i % 16), 16));
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	vector<Blk> all;
+	for (auto& list : blks) {
+		all.insert(all.end(), list.begin(), list.end());
+	}
+	sort(all.begin(), all.end(), [](const Blk& lhs, const Blk& rhs) { return lhs.ptr < rhs.ptr; });
+	bool green = true;
+	for (size_t i = 0; i < all.size(); ++i) {
+		if (!all[i] || reinterpret_cast<uintptr_t>(all[i].ptr) % 16 != 0)
+			green = false;
+		if (i > 0 && (char*)all[i - 1].ptr + all[i - 1].size > (char*)all[i].ptr)
+			green = false;
+	}
+	green = green && !allocator.allocate(1, 16);
+	cout << "Testing allocate integrity..." << (green ? "YES" : "NO") << endl;
+
+	allocator.deallocateAll();
+	cout << "Testing deallocateAll integrity..." << (allocator.allocate(1, 16) == Blk(all.front().ptr, 1) ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
 void TestSegregatorAllocator() {
 	cout << "=== Testing SegregatorAllocator" << endl;
 	using Allocator = SegregatorAllocator<4,
@@ -258,6 +331,37 @@ void TestFreeListBestFitAllocator() {
 	cout << blk5.ptr << endl;
 }
 
+void TestCompactFreeListAllocator() {
+	cout << "=== Testing CompactFreeListAllocator" << endl;
+
+	using Allocator = LocalFirstFitCompactFreeListAllocator<1000>;
+	Allocator allocator;
+
+	// A 4-byte object should only cost a 4-byte Header
+	auto blk1 = allocator.allocate(4, 4);
+	auto blk2 = allocator.allocate(4, 4);
+	auto blk3 = allocator.allocate(4, 4);
+	cout << "Testing header size integrity..." << ((char*)blk2.ptr - (char*)blk1.ptr == 8 ? "YES" : "NO") << endl;
+
+	// Over-aligned objects record their padding
+	auto blk4 = allocator.allocate(4, 64);
+	auto blk5 = allocator.allocate(10, 2);
+	cout << "Testing alignment integrity..." << (reinterpret_cast<uintptr_t>(blk4.ptr) % 64 == 0 ? "YES" : "NO") << endl;
+
+	allocator.deallocate(blk2);
+	auto blk6 = allocator.allocate(4, 4);
+	bool green = blk6 == blk2;
+
+	allocator.deallocate(blk4);
+	allocator.deallocate(blk1);
+	allocator.deallocate(blk5);
+	allocator.deallocate(blk3);
+	allocator.deallocate(blk6);
+	green = green && allocator.allocate(4, 4) == blk1;
+	cout << "Testing deallocate integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
 void TestSlabAllocator() {
 	cout << "=== Testing SlabAllocator" << endl;
 	using Allocator = SlabAllocator<1000, 25, 4, LocalAllocator<1000>>;
@@ -266,15 +370,1281 @@ void TestSlabAllocator() {
 
 }
 
+void TestSizeClassAllocator() {
+	cout << "=== Testing SizeClassAllocator" << endl;
+	// Any size up to the class goes, the way a segregator hands them out
+	using Allocator = SegregatorAllocator<32, HeapSizeClassAllocator<4096, 32, 16>, HeapSizeClassAllocator<4096, 64, 16>>;
+	Allocator allocator;
+	Blk small = allocator.allocate(10, 8);
+	Blk big = allocator.allocate(33, 16);
+	bool green = small.size == 32 && big.size == 64 && allocator.owns(small) && allocator.owns(big);
+	green = green && allocator.goodSize(20) == 32 && allocator.goodSize(40) == 64;
+	allocator.deallocate(small);
+	allocator.deallocate(big);
+	green = green && allocator.allocate(32, 16).ptr == small.ptr;
+	cout << "Testing rounding integrity..." << (green ? "YES" : "NO") << endl;
+
+	// A stricter alignment than the class has goes on to the fallback, like in the composed size classes
+	FallbackAllocator<HeapSizeClassAllocator<4096, 32, 16>, HeapAllocator> fallback;
+	Blk aligned = fallback.allocate(32, 64);
+	Blk zeroed = fallback.allocateZeroed(32, 64);
+	green = aligned && (uintptr_t)aligned.ptr % 64 == 0 && zeroed && (uintptr_t)zeroed.ptr % 64 == 0 && *(char*)zeroed.ptr == 0;
+	green = green && !HeapSizeClassAllocator<4096, 32, 16>().allocate(32, 64);
+	fallback.deallocate(aligned);
+	fallback.deallocate(zeroed);
+	cout << "Testing alignment fallback integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestSlabCache() {
+	cout << "=== Testing SlabCache" << endl;
+	constexpr size_t slabSize = 4096;
+	HeapSlabCache<48, 16, slabSize> cache;
+
+	// Grows past a single slab
+	vector<Blk> blks;
+	for (int i = 0; i < 1000; ++i) {
+		auto blk = cache.allocate(48, 16);
+		memset(blk.ptr, 'A', blk.size);
+		blks.push_back(blk);
+	}
+	bool green = all_of(blks.begin(), blks.end(), [&](Blk blk) { return cache.owns(blk) && (uintptr_t)blk.ptr % 16 == 0; });
+	green = green && cache.slabCount() > 1;
+	cout << "Testing grow integrity..." << (green ? "YES" : "NO") << endl;
+
+	// Free most of the first slab and a little of the second.
+	// The next allocation must go to the second one, which is fuller.
+	auto slabOf = [](Blk blk) { return (uintptr_t)blk.ptr & ~(slabSize - 1); };
+	size_t perSlab = count_if(blks.begin(), blks.end(), [&](Blk blk) { return slabOf(blk) == slabOf(blks[0]); });
+	vector<Blk> first(blks.begin(), blks.begin() + perSlab);
+	vector<Blk> second(blks.begin() + perSlab, blks.begin() + 2 * perSlab);
+	for (size_t i = 0; i < perSlab - 1; ++i) {
+		cache.deallocate(first[i]);
+	}
+	cache.deallocate(second[0]);
+	cache.deallocate(second[1]);
+	auto blk = cache.allocate(48, 16);
+	green = slabOf(blk) == slabOf(second[0]);
+	cout << "Testing fullest first integrity..." << (green ? "YES" : "NO") << endl;
+
+	// Only one empty slab is kept once everything is freed
+	cache.deallocate(blk);
+	for (size_t i = 2 * perSlab; i < blks.size(); ++i) {
+		cache.deallocate(blks[i]);
+	}
+	for (size_t i = 2; i < perSlab; ++i) {
+		cache.deallocate(second[i]);
+	}
+	cache.deallocate(first[perSlab - 1]);
+	cout << "Testing release integrity..." << (cache.slabCount() == 1 && cache.trim() == slabSize && cache.slabCount() == 0 ? "YES" : "NO") << endl;
+
+	// Objects with a smaller alignment than a pointer still hold the freeList pointer aligned
+	HeapSlabCache<12, 4, slabSize> packed;
+	Blk a = packed.allocate(12, 4);
+	Blk b = packed.allocate(12, 4);
+	Blk c = packed.allocate(12, 4);
+	green = (uintptr_t)a.ptr % alignof(void*) == 0 && (uintptr_t)b.ptr % alignof(void*) == 0;
+	packed.deallocate(a);
+	packed.deallocate(b);
+	green = green && packed.allocate(12, 4).ptr == b.ptr && packed.allocate(12, 4).ptr == a.ptr;
+	packed.deallocate(a);
+	packed.deallocate(b);
+	packed.deallocate(c);
+	cout << "Testing small alignment integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestBuddyAllocator() {
+	cout << "=== Testing BuddyAllocator" << endl;
+	constexpr size_t capacity = 1 << 16;
+	HeapBuddyAllocator<capacity, 64> buddy;
+
+	// Blocks are powers of 2, aligned to their size
+	vector<Blk> blks;
+	for (size_t size : { 1, 64, 65, 100, 1000, 4096, 5000, 64, 300 }) {
+		blks.push_back(buddy.allocate(size, 8));
+	}
+	bool green = all_of(blks.begin(), blks.end(), [&](Blk blk) {
+		return blk && detail::pointer::isPowerOfTwo(blk.size) && (uintptr_t)blk.ptr % blk.size == 0 && buddy.goodSize(blk.size) == blk.size;
+	});
+	green = green && buddy.allocate(10, 4096).size == 4096 && buddy.goodSize(65) == 128;
+	cout << "Testing split integrity..." << (green ? "YES" : "NO") << endl;
+
+	// Once everything is back, it merges into the one block it started with
+	buddy.deallocateAll();
+	blks.clear();
+	for (Blk blk = buddy.allocate(200, 8); blk; blk = buddy.allocate(200, 8)) {
+		blks.push_back(blk);
+	}
+	green = blks.size() == capacity / 256;
+	std::mt19937 random(42);
+	shuffle(blks.begin(), blks.end(), random);
+	for (auto& blk : blks) {
+		buddy.deallocate({ blk.ptr, 200 });
+	}
+	auto whole = buddy.allocate(capacity, 8);
+	green = green && whole.size == capacity && !buddy.allocate(1, 1);
+	buddy.deallocate(whole);
+	cout << "Testing merge integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestThreadHeapAllocator() {
+	cout << "=== Testing ThreadHeapAllocator" << endl;
+	// Each thread only has room for 100 objects, so the producer can only keep going
+	// if what the consumer frees makes it back to the producer's heap.
+	using Allocator = ThreadHeapAllocator<8, HeapSlabAllocator<100 * 64, 64, 16>>;
+	Allocator allocator;
+	constexpr int messageCount = 1000;
+
+	mutex queueMutex;
+	deque<Blk> queue;
+	thread producer([&]() {
+		for (int i = 0; i < messageCount; ++i) {
+			Blk blk;
+			while (!(blk = allocator.allocate(64, 16))) {
+				this_thread::yield();
+			}
+			*(int*)blk.ptr = i;
+			lock_guard<mutex> guard(queueMutex);
+			queue.push_back(blk);
+		}
+	});
+
+	bool green = true;
+	thread consumer([&]() {
+		for (int i = 0; i < messageCount;) {
+			Blk blk;
+			{
+				lock_guard<mutex> guard(queueMutex);
+				if (queue.empty())
+					continue;
+				blk = queue.front();
+				queue.pop_front();
+			}
+			if (*(int*)blk.ptr != i++)
+				green = false;
+			allocator.deallocate(blk);
+		}
+	});
+
+	producer.join();
+	consumer.join();
+	cout << "Testing remote free integrity..." << (green ? "YES" : "NO") << endl;
+
+	// Three threads are alive at once, so at least two of them are beyond the one heap and share the overflow
+	ThreadHeapAllocator<1, HeapSlabAllocator<100 * 64, 64, 16>> small;
+	green = true;
+	thread outer([&]() {
+		Blk inner;
+		thread([&]() {
+			inner = small.allocate(64, 16);
+			if (inner)
+				*(int*)inner.ptr = 42;
+		}).join();
+		green = inner && *(int*)inner.ptr == 42 && small.owns(inner);
+		small.deallocate(inner);
+
+		Blk blk = small.allocateZeroed(64, 16);
+		green = green && blk && *(int*)blk.ptr == 0 && small.owns(blk);
+		small.deallocate(blk);
+	});
+	small.deallocate(small.allocate(64, 16));
+	outer.join();
+	cout << "Testing overflow heap integrity..." << (green ? "YES" : "NO") << endl;
+
+	// Every heap owns the unclaimed through its HeapAllocator, so a block in the overflow's stack must not go to the first heap.
+	// Two threads are alive at once, so at least one of them allocates from the overflow.
+	ThreadHeapAllocator<1, FallbackAllocator<HeapStackAllocator<256>, HeapAllocator>> composites;
+	Blk stackBlks[2];
+	atomic<int> allocated = { 0 };
+	atomic<bool> done = { false };
+	auto holder = [&](int t) {
+		stackBlks[t] = composites.allocate(16, 16);
+		++allocated;
+		while (!done)
+			this_thread::yield();
+	};
+	thread first(holder, 0), second(holder, 1);
+	while (allocated != 2)
+		this_thread::yield();
+	green = stackBlks[0] && stackBlks[1] && composites.owns(stackBlks[0]) && composites.owns(stackBlks[1]);
+	composites.deallocate(stackBlks[1]);
+	composites.deallocate(stackBlks[0]);
+	done = true;
+	first.join();
+	second.join();
+	cout << "Testing composite heaps integrity..." << (green ? "YES" : "NO") << endl;
+
+	// A thread_local built before the thread's first allocation is destroyed after the thread's number went back.
+	// What it frees must not go in as if it were the owner, a new thread may have that number by now.
+	static ThreadHeapAllocator<8, HeapSlabAllocator<100 * 64, 64, 16>>* exiting;
+	static atomic<size_t> indexAtExit;
+	struct LateFree {
+		Blk blk;
+		~LateFree() {
+			indexAtExit = detail::threadIndex();
+			exiting->deallocate(blk);
+		}
+	};
+	exiting = &allocator;
+	thread([]() {
+		thread_local LateFree late;
+		late.blk = exiting->allocate(64, 16);
+	}).join();
+	cout << "Testing thread exit integrity..." << (indexAtExit == detail::exitedThreadIndex ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestLockedAllocator() {
+	cout << "=== Testing LockedAllocator" << endl;
+	LockedAllocator<HeapFirstFitFreeListAllocator<1 << 20>> allocator;
+
+	// Every thread fills its blocks with its own byte, any overlap shows up as a wrong byte
+	atomic<bool> green = { true };
+	vector<thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&, t]() {
+			vector<Blk> blks;
+			for (int i = 0; i < 1000; ++i) {
+				auto blk = allocator.allocate(16 + i % 100, 16);
+				memset(blk.ptr, 'A' + t, blk.size);
+				blks.push_back(blk);
+				if (i % 3 == 0) {
+					if (!all_of((char*)blks.front().ptr, (char*)blks.front().ptr + blks.front().size, [&](char c) { return c == 'A' + t; }))
+						green = false;
+					allocator.deallocate(blks.front());
+					blks.erase(blks.begin());
+				}
+			}
+			for (auto& blk : blks) {
+				allocator.deallocate(blk);
+			}
+		});
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	cout << "Testing concurrent integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestShardedAllocator() {
+	cout << "=== Testing ShardedAllocator" << endl;
+	using Allocator = ShardedAllocator<4, HeapFirstFitFreeListAllocator<1 << 20>>;
+	Allocator allocator;
+
+	// Every thread fills its blocks with its own byte, and the main thread frees them all,
+	// so most blocks go back to a shard that isn't the freeing thread's
+	constexpr int threadCount = 8;
+	vector<Blk> blks[threadCount];
+	vector<thread> threads;
+	for (int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&, t]() {
+			for (int i = 0; i < 1000; ++i) {
+				auto blk = allocator.allocate(16 + i % 100, 16);
+				memset(blk.ptr, 'A' + t, blk.size);
+				blks[t].push_back(blk);
+			}
+		});
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	bool green = true;
+	for (int t = 0; t < threadCount; ++t) {
+		for (auto& blk : blks[t]) {
+			green = green && allocator.owns(blk) && all_of((char*)blk.ptr, (char*)blk.ptr + blk.size, [&](char c) { return c == 'A' + t; });
+			allocator.deallocate(blk);
+		}
+	}
+	cout << "Testing concurrent integrity..." << (green ? "YES" : "NO") << endl;
+
+	uint64_t acquisitions = 0;
+	for (size_t i = 0; i < Allocator::shardCount(); ++i) {
+		acquisitions += allocator.stats(i).acquisitions;
+	}
+	cout << "Testing stats integrity..." << (acquisitions >= 2 * threadCount * 1000 ? "YES" : "NO") << endl;
+
+	// A full shard spills over to the next one
+	ShardedAllocator<2, HeapStackAllocator<256>> stacks;
+	vector<Blk> stackBlks;
+	for (Blk blk; (blk = stacks.allocate(16, 16));) {
+		stackBlks.push_back(blk);
+	}
+	green = stackBlks.size() * 16 > 256;
+
+	// The stacks are too small for the owner map, so the shards are asked. That doesn't count as taking their locks.
+	auto stackAcquisitions = [&]() { return stacks.stats(0).acquisitions + stacks.stats(1).acquisitions; };
+	uint64_t before = stackAcquisitions();
+	for (auto itr = stackBlks.rbegin(); itr != stackBlks.rend(); ++itr) {
+		stacks.deallocate(*itr);
+	}
+	green = green && stackAcquisitions() - before == stackBlks.size();
+	cout << "Testing spill integrity..." << (green ? "YES" : "NO") << endl;
+
+	// Every shard owns the unclaimed through its heap, so a block from the second shard's stack
+	// must not be sent to the first shard's heap. Threads stay alive so their indices aren't handed out again.
+	ShardedAllocator<2, FallbackAllocator<HeapStackAllocator<256>, HeapAllocator>> composites;
+	Blk fromShard[2];
+	atomic<bool> done = { false };
+	vector<thread> holders;
+	for (int t = 0; t < 8 && !(fromShard[0] && fromShard[1]); ++t) {
+		atomic<bool> allocated = { false };
+		holders.emplace_back([&]() {
+			uint64_t before = composites.stats(0).acquisitions;
+			Blk blk = composites.allocate(16, 16);
+			Blk& slot = fromShard[composites.stats(0).acquisitions != before ? 0 : 1];
+			if (!slot)
+				slot = blk;
+			else
+				composites.deallocate(blk);
+			allocated = true;
+			while (!done)
+				this_thread::yield();
+		});
+		while (!allocated)
+			this_thread::yield();
+	}
+	green = fromShard[0] && fromShard[1] && composites.owns(fromShard[0]) && composites.owns(fromShard[1]);
+	composites.deallocate(fromShard[1]);
+	composites.deallocate(fromShard[0]);
+	done = true;
+	for (auto& t : holders) {
+		t.join();
+	}
+	cout << "Testing composite shards integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestEpochAllocator() {
+	cout << "=== Testing EpochAllocator" << endl;
+	// Counts what really gets freed, shared by every instance
+	struct CountingAllocator {
+		static atomic<size_t>& freed() {
+			static atomic<size_t> count = { 0 };
+			return count;
+		}
+		static atomic<bool>& outOfMemory() {
+			static atomic<bool> flag = { false };
+			return flag;
+		}
+		HeapAllocator heap;
+		Blk allocate(size_t size, size_t alignment) { return outOfMemory() ? Blk() : heap.allocate(size, alignment); }
+		void deallocate(Blk blk) { ++freed(); heap.deallocate(blk); }
+		bool owns(Blk blk) const noexcept { return true; }
+		size_t goodSize(size_t size) const noexcept { return size; }
+	};
+
+	// A block retired while someone is pinned stays alive until they let go
+	{
+		EpochAllocator<CountingAllocator> allocator;
+		atomic<int> step = { 0 };
+		thread reader([&]() {
+			auto guard = allocator.pin();
+			step = 1;
+			while (step != 2);
+		});
+		while (step != 1);
+
+		allocator.retire(allocator.allocate(64, 16));
+		for (int i = 0; i < 10; ++i) {
+			allocator.collect();
+		}
+		bool green = CountingAllocator::freed() == 0;
+		step = 2;
+		reader.join();
+		for (int i = 0; i < 10; ++i) {
+			allocator.collect();
+		}
+		// The block, and the bag that listed it
+		green = green && CountingAllocator::freed() == 2;
+		cout << "Testing deferred free integrity..." << (green ? "YES" : "NO") << endl;
+	}
+
+	// A lock-free stack, freeing popped nodes too early shows up as a use after free
+	struct Node {
+		Node* next;
+		size_t value;
+	};
+	EpochAllocator<LockedAllocator<HeapAllocator>> allocator;
+	atomic<Node*> head = { nullptr };
+	atomic<size_t> popped = { 0 };
+	vector<thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&]() {
+			for (size_t i = 0; i < 10000; ++i) {
+				auto guard = allocator.pin();
+				Node* node = static_cast<Node*>(allocator.allocate(sizeof(Node), alignof(Node)).ptr);
+				node->value = i;
+				node->next = head.load();
+				while (!head.compare_exchange_weak(node->next, node));
+
+				Node* top = head.load();
+				while (top != nullptr && !head.compare_exchange_weak(top, top->next));
+				if (top != nullptr) {
+					allocator.retire({ top, sizeof(Node) });
+					++popped;
+				}
+			}
+			allocator.collect();
+		});
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	cout << "Testing lock-free stack integrity..." << (popped == 40000 && head == nullptr ? "YES" : "NO") << endl;
+
+	// No memory for a Bag: freed right away when we aren't pinned, handed back when we are
+	{
+		EpochAllocator<CountingAllocator> counting;
+		size_t before = CountingAllocator::freed();
+		Blk first = counting.allocate(64, 16);
+		Blk second = counting.allocate(64, 16);
+		CountingAllocator::outOfMemory() = true;
+		bool green = counting.retire(first) && CountingAllocator::freed() == before + 1;
+		{
+			auto guard = counting.pin();
+			green = green && !counting.retire(second) && CountingAllocator::freed() == before + 1;
+		}
+		CountingAllocator::outOfMemory() = false;
+		green = green && counting.retire(second);
+		cout << "Testing out of memory integrity..." << (green ? "YES" : "NO") << endl;
+	}
+
+	// Four threads are alive at once, so at least three share the overflow slot.
+	// What they retire still waits for the reader.
+	{
+		size_t before = CountingAllocator::freed();
+		bool green = true;
+		{
+			EpochAllocator<CountingAllocator, 1> counting;
+			atomic<int> step = { 0 };
+			thread reader([&]() {
+				auto guard = counting.pin();
+				step = 1;
+				while (step != 2);
+			});
+			while (step != 1);
+
+			thread([&]() {
+				thread([&]() {
+					auto guard = counting.pin();
+					counting.retire(counting.allocate(64, 16));
+				}).join();
+				for (int i = 0; i < 10; ++i) {
+					counting.collect();
+				}
+				green = CountingAllocator::freed() == before;
+			}).join();
+			step = 2;
+			reader.join();
+		}
+		// The block, and the bag that listed it
+		green = green && CountingAllocator::freed() == before + 2;
+		cout << "Testing overflow slot integrity..." << (green ? "YES" : "NO") << endl;
+	}
+	cout << endl;
+}
+
+void TestHandlePool() {
+	cout << "=== Testing HandlePool" << endl;
+	HeapHandlePool<string, 100> pool;
+	vector<HeapHandlePool<string, 100>::Handle> handles;
+	for (int i = 0; i < 100; ++i) {
+		handles.push_back(pool.create(to_string(i) + " is long enough to live on the heap"));
+	}
+	bool green = !pool.create("full") && pool.size() == 100;
+
+	// Every other one leaves a hole, and its handle goes stale
+	for (int i = 0; i < 100; i += 2) {
+		pool.destroy(handles[i]);
+	}
+	green = green && pool.get(handles[0]) == nullptr && pool.holes() == 50;
+
+	// A few at a time, until the holes are gone
+	int calls = 0;
+	while (pool.holes() != 0 && calls++ < 100) {
+		pool.compact(8);
+	}
+	green = green && calls > 1 && pool.holes() == 0 && pool.size() == 50;
+	for (int i = 1; i < 100; i += 2) {
+		green = green && *pool.get(handles[i]) == to_string(i) + " is long enough to live on the heap";
+	}
+
+	// The objects kept their order
+	int expected = 1;
+	pool.forEach([&](string& value) {
+		green = green && value == to_string(expected) + " is long enough to live on the heap";
+		expected += 2;
+	});
+	cout << "Testing compaction integrity..." << (green ? "YES" : "NO") << endl;
+
+	// The last freed entry is reused with a new generation
+	auto reused = pool.create("reused");
+	green = handles[98] != reused && pool.get(handles[98]) == nullptr && *pool.get(reused) == "reused";
+	cout << "Testing stale handle integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+// Out of line, and counting after the call keeps it from being a tail call, so that its frame shows up in the profile
+volatile size_t profiledAllocations = 0;
+#ifdef _MSC_VER
+__declspec(noinline)
+#else
+__attribute__((noinline))
+#endif
+Blk allocateForProfile(ProfilingAllocator<HeapAllocator, 4096>& allocator) {
+	Blk blk = allocator.allocate(1000, 16);
+	profiledAllocations = profiledAllocations + 1;
+	return blk;
+}
+
+void TestProfilingAllocator() {
+	cout << "=== Testing ProfilingAllocator" << endl;
+	ProfilingAllocator<HeapAllocator, 4096> allocator;
+
+	// 2MB allocated, half of it still live. With a sample every 4KB the estimates land within a few percent.
+	vector<Blk> blks;
+	for (int i = 0; i < 2000; ++i) {
+		blks.push_back(allocateForProfile(allocator));
+	}
+	for (size_t i = 0; i < blks.size(); i += 2) {
+		allocator.deallocate(blks[i]);
+	}
+	using Profile = decltype(allocator)::Profile;
+	double live = (double)allocator.totalBytes(Profile::live);
+	double cumulative = (double)allocator.totalBytes(Profile::cumulative);
+	bool green = fabs(live - 1000000) < 250000 && fabs(cumulative - 2000000) < 500000 && allocator.droppedSamples() == 0;
+	cout << "Testing estimate integrity..." << (green ? "YES" : "NO") << endl;
+
+	// The folded lines add up to the same total
+	ostringstream folded;
+	allocator.dumpFolded(folded);
+	istringstream lines(folded.str());
+	string line;
+	double sum = 0;
+	while (getline(lines, line)) {
+		sum += stod(line.substr(line.rfind(' ') + 1));
+	}
+	ostringstream pprof;
+	allocator.dumpPprof(pprof);
+	green = fabs(sum - live) < 100 && pprof.str().rfind("heap profile: ", 0) == 0;
+	cout << "Testing dump integrity..." << (green ? "YES" : "NO") << endl;
+
+	// No frame of the profiler's own is left, every stack starts in allocateForProfile.
+	// Without -rdynamic the frames are addresses, so it's a return address somewhere behind its start.
+	lines = istringstream(folded.str());
+	green = !folded.str().empty();
+	while (getline(lines, line)) {
+		string inner = line.substr(0, line.rfind(' '));
+		inner = inner.substr(inner.rfind(';') + 1);
+		uintptr_t address = inner.rfind("0x", 0) == 0 ? stoull(inner, nullptr, 16) : 0;
+		uintptr_t begin = (uintptr_t)&allocateForProfile;
+		green = green && (inner.rfind("allocateForProfile", 0) == 0 || (address > begin && address < begin + 1024));
+	}
+	cout << "Testing innermost frame integrity..." << (green ? "YES" : "NO") << endl;
+
+	for (size_t i = 1; i < blks.size(); i += 2) {
+		allocator.deallocate(blks[i]);
+	}
+	cout << "Testing deallocate integrity..." << (allocator.totalBytes(Profile::live) == 0 ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+// HeapAllocator that counts its allocations. Still an empty class, so SmallVector may hand its buffers over.
+struct CountingHeapAllocator : HeapAllocator {
+	static size_t& allocations() {
+		static size_t count = 0;
+		return count;
+	}
+	Blk allocate(size_t size, size_t alignment) {
+		++allocations();
+		return HeapAllocator::allocate(size, alignment);
+	}
+};
+
+// Stalls on every 100th allocation, like a parent refill would
+class StallingHeapAllocator : public HeapAllocator {
+	size_t calls = 0;
+public:
+	Blk allocate(size_t size, size_t alignment) {
+		if (++calls % 100 == 0) {
+			auto from = chrono::steady_clock::now();
+			while (chrono::steady_clock::now() - from < chrono::microseconds(200)) {
+			}
+		}
+		return HeapAllocator::allocate(size, alignment);
+	}
+};
+
+void TestLatencyProbeAllocator() {
+	cout << "=== Testing LatencyProbeAllocator" << endl;
+	using Probe = LatencyProbeAllocator<StallingHeapAllocator>;
+	Probe probe;
+	vector<Blk> blks;
+	for (int i = 0; i < 1000; ++i) {
+		blks.push_back(probe.allocate(64, 16));
+	}
+	for (auto& blk : blks) {
+		probe.deallocate(blk);
+	}
+
+	// The stalls are 1% of the calls: invisible at p50 and p99, all of p99.9
+	LatencySummary allocations = probe.summary(Probe::Operation::allocate);
+	LatencySummary deallocations = probe.summary(Probe::Operation::deallocate);
+	bool green = allocations.count == 1000 && deallocations.count == 1000;
+	green = green && allocations.p50 < 100000 && allocations.p99 < 100000 && allocations.p999 >= 150000;
+	green = green && allocations.p50 <= allocations.p90 && allocations.p999 <= allocations.max;
+	green = green && allocations.mean > allocations.p50 && deallocations.max < 150000;
+	green = green && probe.summary(Probe::Operation::allocate, detail::threadIndex()).count == 1000;
+	cout << "Testing percentile integrity..." << (green ? "YES" : "NO") << endl;
+
+	ostringstream table, histogram;
+	probe.dump(table);
+	probe.dumpHistogram(histogram, Probe::Operation::allocate);
+	green = table.str().find("deallocate") != string::npos && histogram.str().size() > 0;
+	probe.reset();
+	green = green && probe.summary(Probe::Operation::allocate).count == 0 && probe.percentile(Probe::Operation::allocate, 99) == 0;
+	cout << "Testing export integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestSmallVector() {
+	cout << "=== Testing SmallVector" << endl;
+	SmallVector<string, 4, CountingHeapAllocator> vec;
+	for (int i = 0; i < 4; ++i) {
+		vec.push_back(to_string(i));
+	}
+	bool green = vec.isInline() && CountingHeapAllocator::allocations() == 0;
+	vec.push_back(vec.front());
+	green = green && !vec.isInline() && CountingHeapAllocator::allocations() == 1 && vec.size() == 5;
+	green = green && vec[0] == "0" && vec[3] == "3" && vec[4] == "0";
+	cout << "Testing overflow integrity..." << (green ? "YES" : "NO") << endl;
+
+	// A heap buffer changes hands, inline elements are moved over
+	const string* buffer = vec.data();
+	auto moved = std::move(vec);
+	green = moved.data() == buffer && moved.size() == 5 && vec.empty() && vec.isInline();
+	SmallVector<string, 4, CountingHeapAllocator> small = { "a", "b" };
+	auto movedSmall = std::move(small);
+	green = green && movedSmall.isInline() && movedSmall.size() == 2 && movedSmall[1] == "b" && small.empty();
+
+	// Buffers of a stateful Overflow stay with the vector that owns them
+	SmallVector<int, 2, HeapLinearAllocator<1024>> linear;
+	for (int i = 0; i < 10; ++i) {
+		linear.push_back(i);
+	}
+	auto movedLinear = std::move(linear);
+	green = green && movedLinear.data() != linear.data() && movedLinear.size() == 10 && movedLinear[9] == 9;
+	cout << "Testing move integrity..." << (green ? "YES" : "NO") << endl;
+
+	SmallVector<int, 8> numbers = { 1, 2, 3 };
+	numbers.insert(numbers.begin() + 1, 9);
+	numbers.erase(numbers.begin());
+	green = numbers == SmallVector<int, 8>{ 9, 2, 3 };
+	for (int i = 0; i < 20; ++i) {
+		numbers.push_back(i);
+	}
+	numbers.resize(4);
+	numbers.shrink_to_fit();
+	green = green && numbers.isInline() && numbers == SmallVector<int, 8>{ 9, 2, 3, 0 };
+	cout << "Testing insert/erase integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestSmallString() {
+	cout << "=== Testing SmallString" << endl;
+	SmallString<16> text = "hello";
+	bool green = text.isInline() && text == "hello" && text.size() == 5 && text.c_str()[5] == '\0';
+	text += ", world";
+	text.append(text);
+	green = green && !text.isInline() && text == "hello, worldhello, world" && strlen(text.c_str()) == text.size();
+	cout << "Testing append integrity..." << (green ? "YES" : "NO") << endl;
+
+	auto moved = std::move(text);
+	green = moved == "hello, worldhello, world" && text.empty() && text.c_str()[0] == '\0';
+	moved.resize(5);
+	moved.push_back('!');
+	green = green && moved == "hello!" && moved.find("lo") == 3;
+	cout << "Testing move integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestObjectArena() {
+	cout << "=== Testing ObjectArena" << endl;
+	// Logs the order the objects go in
+	struct Tracked {
+		vector<int>& log;
+		int id;
+		string name;
+		Tracked(vector<int>& log, int id) : log(log), id(id), name(100, 'A' + id) {}
+		~Tracked() { log.push_back(id); }
+	};
+
+	vector<int> log;
+	HeapObjectArena<4096> arena;
+	for (int i = 0; i < 3; ++i) {
+		arena.create<Tracked>(log, i);
+	}
+
+	// No header for objects without a destructor to run
+	int* first = arena.create<int>(1);
+	int* second = arena.create<int>(2);
+	bool green = second == first + 1 && *first == 1 && *second == 2;
+	cout << "Testing create integrity..." << (green ? "YES" : "NO") << endl;
+
+	arena.reset();
+	green = log == vector<int>{ 2, 1, 0 } && arena.create<int>(3) != nullptr;
+	cout << "Testing reset integrity..." << (green ? "YES" : "NO") << endl;
+
+	// Out of memory gives nullptr, whatever fit is still destroyed
+	log.clear();
+	{
+		LocalObjectArena<512> small;
+		int created = 0;
+		while (small.create<Tracked>(log, created) != nullptr) {
+			++created;
+		}
+		green = created > 0 && log.empty();
+	}
+	green = green && !log.empty() && log.front() == (int)log.size() - 1;
+	cout << "Testing destructor integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestBufferPool() {
+	cout << "=== Testing BufferPool" << endl;
+	HeapBufferPool<1024, 4> pool;
+	vector<Buffer> buffers;
+	for (Buffer buffer; (buffer = pool.acquire());) {
+		buffers.push_back(buffer);
+	}
+	bool green = buffers.size() == 4 && pool.outstandingBuffers() == 4;
+
+	// Slices keep the buffer alive after the Buffer that filled it is gone
+	Buffer message = buffers[0];
+	buffers.clear();
+	const char text[] = "header:payload";
+	memcpy(message.data(), text, sizeof(text) - 1);
+	message.truncate(sizeof(text) - 1);
+	Buffer header = message.slice(0, 7);
+	Buffer payload = message.slice(7);
+	message = Buffer();
+	green = green && pool.outstandingBuffers() == 1 && header.useCount() == 2;
+	green = green && string(payload.data(), payload.size()) == "payload";
+	cout << "Testing slice integrity..." << (green ? "YES" : "NO") << endl;
+
+	// Laid out for writev, and consumed bit by bit like partial writes do
+	BufferChain<> chain;
+	chain.append(payload);
+	chain.append(header);
+	const iovec* vectors = chain.iovecs();
+	green = chain.count() == 2 && chain.size() == 14 && vectors[0].iov_base == payload.data() && vectors[1].iov_len == 7;
+	chain.consume(9);
+	green = green && chain.count() == 1 && string(chain[0].data(), chain[0].size()) == "ader:";
+	chain.clear();
+	header = Buffer();
+	payload = Buffer();
+	green = green && pool.outstandingBuffers() == 0 && pool.acquire();
+	cout << "Testing iovec integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestRingAllocator() {
+	cout << "=== Testing RingAllocator" << endl;
+	HeapRingAllocator<4096> ring;
+
+	// A stream of messages of all sizes through a ring that holds only a few of them, so it wraps all the time
+	mt19937 random(7);
+	deque<pair<Blk, unsigned char>> messages;
+	bool green = true;
+	unsigned char id = 0;
+	for (int i = 0; i < 20000 && green; ++i) {
+		size_t size = 1 + random() % 700;
+		Blk blk = ring.allocate(size, i % 5 == 0 ? 64 : 8);
+		while (!blk && !messages.empty()) {
+			// Full, the oldest message is done
+			auto& oldest = messages.front();
+			auto bytes = static_cast<unsigned char*>(oldest.first.ptr);
+			green = green && all_of(bytes, bytes + oldest.first.size, [&](unsigned char b) { return b == oldest.second; });
+			ring.deallocate(oldest.first);
+			messages.pop_front();
+			blk = ring.allocate(size, i % 5 == 0 ? 64 : 8);
+		}
+		green = green && blk && blk.size >= size && ring.owns(blk);
+		memset(blk.ptr, ++id, blk.size);
+		messages.emplace_back(blk, id);
+	}
+	for (auto& message : messages) {
+		ring.deallocate(message.first);
+	}
+	green = green && ring.usedBytes() == 0;
+	cout << "Testing FIFO integrity..." << (green ? "YES" : "NO") << endl;
+
+	// A message freed early only gives its memory back once the ones before it are gone
+	Blk first = ring.allocate(1000, 8);
+	Blk second = ring.allocate(1000, 8);
+	Blk third = ring.allocate(1000, 8);
+	ring.deallocate(second);
+	size_t used = ring.usedBytes();
+	ring.deallocate(third);
+	green = ring.usedBytes() == used;
+	ring.deallocate(first);
+	green = green && ring.usedBytes() == 0 && ring.allocate(4000, 8);
+	ring.deallocateAll();
+	cout << "Testing out of order integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestOverAlignedAllocations() {
+	cout << "=== Testing over-aligned allocations" << endl;
+	// Alignments bigger than 255 used to be truncated by uint8_t
+	auto isAligned = [](Blk blk, size_t alignment) {
+		return blk && reinterpret_cast<uintptr_t>(blk.ptr) % alignment == 0;
+	};
+
+	HeapAllocator heap;
+	auto heapBlk = heap.allocate(100, 4096);
+	cout << "Testing HeapAllocator integrity..." << (isAligned(heapBlk, 4096) ? "YES" : "NO") << endl;
+	heap.deallocate(heapBlk);
+
+	HeapLinearAllocator<20000> linear;
+	linear.allocate(1, 1);
+	cout << "Testing LinearAllocator integrity..." << (isAligned(linear.allocate(100, 4096), 4096) ? "YES" : "NO") << endl;
+
+	HeapStackAllocator<20000> stack;
+	auto stackBlk1 = stack.allocate(1, 1);
+	auto stackBlk2 = stack.allocate(100, 4096);
+	auto stackBlk3 = stack.allocate(100, 1024);
+	bool green = isAligned(stackBlk2, 4096) && isAligned(stackBlk3, 1024);
+	stack.deallocate(stackBlk3);
+	stack.deallocate(stackBlk2);
+	green = green && stack.allocate(1, 1).ptr == (char*)stackBlk1.ptr + 1;
+	cout << "Testing StackAllocator integrity..." << (green ? "YES" : "NO") << endl;
+
+	LocalFirstFitFreeListAllocator<20000> freeList;
+	auto freeListBlk1 = freeList.allocate(4, 4);
+	auto freeListBlk2 = freeList.allocate(100, 4096);
+	auto freeListBlk3 = freeList.allocate(100, 256);
+	green = isAligned(freeListBlk2, 4096) && isAligned(freeListBlk3, 256);
+	freeList.deallocate(freeListBlk2);
+	freeList.deallocate(freeListBlk3);
+	freeList.deallocate(freeListBlk1);
+	green = green && freeList.allocate(4, 4) == freeListBlk1;
+	cout << "Testing FreeListAllocator integrity..." << (green ? "YES" : "NO") << endl;
+
+	HeapSlabAllocator<20000, 512, 512> slab;
+	cout << "Testing SlabAllocator integrity..." << (isAligned(slab.allocate(512, 512), 512) ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestTrim() {
+	cout << "=== Testing trim" << endl;
+	constexpr size_t capacity = 1 << 20;
+
+	LinearAllocator<capacity, PageAllocator> linear;
+	auto linearBlk = linear.allocate(capacity / 2, 16);
+	memset(linearBlk.ptr, 'A', linearBlk.size);
+	linear.deallocateAll();
+	bool green = linear.trim() >= capacity / 2 - 4096 && *((char*)linearBlk.ptr + 8192) == 0;
+	green = green && linear.trim() == 0;
+	cout << "Testing LinearAllocator integrity..." << (green ? "YES" : "NO") << endl;
+
+	FreeListAllocator<capacity, PageAllocator, detail::FirstFitStrategy> freeList;
+	auto freeListBlk1 = freeList.allocate(100, 16);
+	auto freeListBlk2 = freeList.allocate(capacity / 2, 16);
+	memset(freeListBlk2.ptr, 'A', freeListBlk2.size);
+	freeList.deallocate(freeListBlk2);
+	green = freeList.trim() >= capacity - 8192 && freeList.trim() == 0;
+	freeListBlk2 = freeList.allocate(capacity / 2, 16);
+	green = green && freeListBlk2 && *((char*)freeListBlk2.ptr + 8192) == 0;
+	freeList.deallocate(freeListBlk1);
+	freeList.deallocate(freeListBlk2);
+	cout << "Testing FreeListAllocator integrity..." << (green ? "YES" : "NO") << endl;
+
+	SlabAllocator<capacity, 64, 64, PageAllocator> slab;
+	vector<Blk> blks;
+	for (Blk blk = slab.allocate(64, 64); blk; blk = slab.allocate(64, 64)) {
+		memset(blk.ptr, 'A', blk.size);
+		blks.push_back(blk);
+	}
+	green = blks.size() == capacity / 64;
+	for (auto& blk : blks) {
+		slab.deallocate(blk);
+	}
+	green = green && slab.trim() == capacity && slab.allocate(64, 64) == blks.front();
+	cout << "Testing SlabAllocator integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestVirtualArenas() {
+	cout << "=== Testing reserve-and-commit arenas" << endl;
+	// Way more than the machine has, only what's touched is committed
+	constexpr size_t capacity = sizeof(void*) == 8 ? size_t(1) << 36 : size_t(1) << 30;
+	constexpr size_t megabyte = 1024 * 1024;
+
+	VirtualLinearAllocator<capacity> linear;
+	bool green = linear.committedBytes() == 0 && linear.owns(linear.allocate(1, 1));
+	Blk first = linear.allocate(8 * megabyte, 16);
+	memset(first.ptr, 'A', first.size);
+	Blk second = linear.allocate(8 * megabyte, 4096);
+	memset(second.ptr, 'B', second.size);
+	green = green && first && second && linear.committedBytes() >= 16 * megabyte && linear.committedBytes() < 17 * megabyte;
+	green = green && detail::ownerOf(second.ptr) == &linear && *static_cast<char*>(first.ptr) == 'A';
+
+	// Only the retained bytes stay, and what comes back is zeroed
+	linear.deallocateAll();
+	green = green && linear.committedBytes() == megabyte;
+	Blk zeroed = linear.allocate(16 * megabyte, 16);
+	green = green && zeroed && *(static_cast<char*>(zeroed.ptr) + 2 * megabyte) == 0;
+	linear.setRetainedBytes(0);
+	linear.deallocateAll();
+	green = green && linear.committedBytes() == 0;
+	cout << "Testing LinearAllocator integrity..." << (green ? "YES" : "NO") << endl;
+
+	// The headers grow down from the end of the reservation, the data up from the start
+	VirtualStackAllocator<capacity> stack;
+	vector<Blk> blks;
+	for (size_t i = 0; i < 100000; ++i) {
+		Blk blk = stack.allocate(64 + i % 64, 8);
+		if (!blk)
+			break;
+		memset(blk.ptr, static_cast<int>(i), blk.size);
+		blks.push_back(blk);
+	}
+	green = blks.size() == 100000 && stack.committedBytes() < 16 * megabyte;
+	while (!blks.empty()) {
+		green = green && *static_cast<unsigned char*>(blks.back().ptr) == static_cast<unsigned char>(blks.size() - 1);
+		stack.deallocate(blks.back());
+		blks.pop_back();
+	}
+	stack.setRetainedBytes(0);
+	stack.deallocateAll();
+	green = green && stack.committedBytes() == 0 && stack.allocate(100, 16);
+	cout << "Testing StackAllocator integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestSharedMemoryAllocators() {
+	cout << "=== Testing SharedMemory allocators" << endl;
+	// Opening the same name twice maps the same memory at two different addresses,
+	// just like two processes would.
+#ifdef _WIN32
+	const char* slabName = "Local\\lego_test_slab";
+	const char* freeListName = "Local\\lego_test_freelist";
+#else
+	const char* slabName = "/lego_test_slab";
+	const char* freeListName = "/lego_test_freelist";
+#endif
+	detail::SharedMemory::remove(slabName);
+	detail::SharedMemory::remove(freeListName);
+
+	{
+		using Allocator = SharedSlabAllocator<1000, 16, 8>;
+		Allocator producer(slabName);
+		Allocator consumer(slabName);
+
+		auto blk = producer.allocate(16, 8);
+		strcpy((char*)blk.ptr, "hello");
+		void* received = consumer.fromOffset(producer.toOffset(blk.ptr));
+		bool green = received != blk.ptr && strcmp((char*)received, "hello") == 0;
+		consumer.deallocate({ received, 16 });
+		green = green && producer.allocate(16, 8) == blk;
+		cout << "Testing SharedSlabAllocator integrity..." << (green ? "YES" : "NO") << endl;
+	}
+
+	{
+		using Allocator = SharedFreeListAllocator<1000>;
+		Allocator producer(freeListName);
+		Allocator consumer(freeListName);
+
+		// A linked list that is valid in both mappings
+		struct Node {
+			int value;
+			OffsetPtr<Node> next;
+		};
+		Node* first = new (producer.allocate(sizeof(Node), alignof(Node)).ptr) Node{ 1, nullptr };
+		first->next = new (producer.allocate(sizeof(Node), alignof(Node)).ptr) Node{ 2, nullptr };
+
+		Node* received = static_cast<Node*>(consumer.fromOffset(producer.toOffset(first)));
+		bool green = received != first && received->value == 1 && received->next->value == 2 && !received->next->next;
+		consumer.deallocate({ received->next.get(), sizeof(Node) });
+		consumer.deallocate({ received, sizeof(Node) });
+		green = green && producer.allocate(4, 4).ptr == first;
+		cout << "Testing SharedFreeListAllocator integrity..." << (green ? "YES" : "NO") << endl;
+	}
+
+	detail::SharedMemory::remove(slabName);
+	detail::SharedMemory::remove(freeListName);
+
+	{
+		// A creator that dies before it sets the memory up, the others give up instead of waiting forever
+		detail::SharedMemory dead(slabName, 4096);
+		SharedSlabAllocator<1000, 16, 8> late(slabName, std::chrono::milliseconds(20));
+		char object[16];
+		bool green = dead.created() && !late.attached() && !late.allocate(16, 8) && !late.owns({ object, 16 });
+		cout << "Testing SharedMemory attach timeout integrity..." << (green ? "YES" : "NO") << endl;
+	}
+
+	detail::SharedMemory::remove(slabName);
+	cout << endl;
+}
+
+void TestPersistentLinearAllocator() {
+	cout << "=== Testing PersistentLinearAllocator" << endl;
+	using Allocator = PersistentLinearAllocator<4096>;
+	const char* path = "lego_test_arena.bin";
+	std::remove(path);
+
+	struct Node {
+		int value;
+		OffsetPtr<Node> next;
+	};
+
+	{
+		Allocator allocator(path, 1);
+		bool green = !allocator.isRestored();
+		Node* head = nullptr;
+		for (int i = 0; i < 10; ++i) {
+			head = new (allocator.allocate(sizeof(Node), alignof(Node)).ptr) Node{ i, head };
+		}
+		allocator.setRoot(head);
+		green = green && allocator.checkpoint();
+		cout << "Testing checkpoint integrity..." << (green ? "YES" : "NO") << endl;
+	}
+
+	{
+		Allocator allocator(path, 1);
+		bool green = allocator.isRestored();
+		int expected = 9;
+		for (Node* itr = static_cast<Node*>(allocator.getRoot()); itr != nullptr; itr = itr->next.get()) {
+			if (itr->value != expected--)
+				green = false;
+		}
+		green = green && expected == -1;
+
+		// Allocations carry on after the restored data
+		Node* node = static_cast<Node*>(allocator.allocate(sizeof(Node), alignof(Node)).ptr);
+		green = green && node > allocator.getRoot();
+		cout << "Testing restore integrity..." << (green ? "YES" : "NO") << endl;
+	}
+
+	{
+		// A different version throws the old data away
+		Allocator allocator(path, 2);
+		cout << "Testing version integrity..." << (!allocator.isRestored() && allocator.getRoot() == nullptr ? "YES" : "NO") << endl;
+	}
+
+	{
+		// The run above never checkpointed, as if it had crashed halfway through a build
+		Allocator allocator(path, 2);
+		bool green = !allocator.isRestored();
+		allocator.setRoot(allocator.allocate(sizeof(Node), alignof(Node)).ptr);
+		green = green && allocator.checkpoint();
+
+		// Changes after a restore invalidate the file until the next checkpoint too
+		Allocator restored(path, 2);
+		green = green && restored.isRestored();
+		restored.allocate(sizeof(Node), alignof(Node));
+		Allocator crashed(path, 2);
+		green = green && !crashed.isRestored();
+		cout << "Testing crash integrity..." << (green ? "YES" : "NO") << endl;
+	}
+
+	std::remove(path);
+	cout << endl;
+}
+
+void TestGoodSize() {
+	cout << "=== Testing goodSize" << endl;
+	// The Blk must say how much is really usable, and goodSize must predict it
+	LocalFirstFitFreeListAllocator<2000> freeList;
+	auto freeListBlk = freeList.allocate(13, 1);
+	bool green = freeListBlk.size == freeList.goodSize(13) && freeListBlk.size >= 13;
+	memset(freeListBlk.ptr, 'A', freeListBlk.size);
+	freeList.deallocate(freeListBlk);
+	cout << "Testing FreeListAllocator integrity..." << (green ? "YES" : "NO") << endl;
+
+	LocalFirstFitCompactFreeListAllocator<2000> compact;
+	auto compactBlk = compact.allocate(13, 1);
+	green = compactBlk.size == compact.goodSize(13) && compactBlk.size == 16;
+	compact.deallocate(compactBlk);
+	cout << "Testing CompactFreeListAllocator integrity..." << (green ? "YES" : "NO") << endl;
+
+	PageAllocator pages;
+	auto pageBlk = pages.allocate(100, 16);
+	green = pageBlk.size == detail::virtual_memory::pageSize() && pages.goodSize(100) == pageBlk.size;
+	memset(pageBlk.ptr, 'A', pageBlk.size);
+	pages.deallocate(pageBlk);
+	cout << "Testing PageAllocator integrity..." << (green ? "YES" : "NO") << endl;
+
+	SegregatorAllocator<32, LocalFirstFitFreeListAllocator<2000>, HeapAllocator> segregator;
+	cout << "Testing SegregatorAllocator integrity..." << (segregator.goodSize(30) == 32 && segregator.goodSize(33) == 33 ? "YES" : "NO") << endl;
+
+	// A vector asking for 3 ints gets 4 from a 16 byte granularity
+	STLAdapter<int, LocalFirstFitFreeListAllocator<2000>> adapter;
+	auto result = adapter.allocate_at_least(3);
+	green = result.ptr != nullptr && result.count == 4;
+	adapter.deallocate(result.ptr, result.count);
+	cout << "Testing allocate_at_least integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestAllocateZeroed() {
+	cout << "=== Testing allocateZeroed" << endl;
+	auto isZero = [](Blk blk) {
+		return blk && all_of((char*)blk.ptr, (char*)blk.ptr + blk.size, [](char c) { return c == 0; });
+	};
+	constexpr size_t capacity = 1 << 20;
+
+	// Dirty everything first, so that only the allocators that really clear pass
+	HeapLinearAllocator<capacity> linear;
+	auto linearBlk = linear.allocate(capacity / 2, 16);
+	memset(linearBlk.ptr, 'A', linearBlk.size);
+	linear.deallocateAll();
+	cout << "Testing LinearAllocator integrity..." << (isZero(linear.allocateZeroed(capacity / 2 + 100, 16)) ? "YES" : "NO") << endl;
+
+	// Below the high-water mark is cleared, above the trim is left alone
+	LinearAllocator<capacity, PageAllocator> pageLinear;
+	linearBlk = pageLinear.allocate(100, 16);
+	memset(linearBlk.ptr, 'A', linearBlk.size);
+	bool green = isZero(pageLinear.allocateZeroed(capacity / 2, 16));
+	pageLinear.deallocateAll();
+	pageLinear.trim();
+	green = green && isZero(pageLinear.allocateZeroed(capacity / 2, 16));
+	cout << "Testing LinearAllocator over pages integrity..." << (green ? "YES" : "NO") << endl;
+
+	FreeListAllocator<capacity, PageAllocator, detail::FirstFitStrategy> freeList;
+	auto freeListBlk = freeList.allocate(capacity / 2, 16);
+	memset(freeListBlk.ptr, 'A', freeListBlk.size);
+	freeList.deallocate(freeListBlk);
+	green = isZero(freeList.allocateZeroed(capacity / 4, 16));
+	freeList.trim();
+	green = green && isZero(freeList.allocateZeroed(capacity / 4, 16));
+	cout << "Testing FreeListAllocator integrity..." << (green ? "YES" : "NO") << endl;
+
+	SlabAllocator<capacity, 64, 64, PageAllocator> slab;
+	auto slabBlk = slab.allocate(64, 64);
+	memset(slabBlk.ptr, 'A', slabBlk.size);
+	slab.deallocate(slabBlk);
+	green = isZero(slab.allocateZeroed(64, 64)) && isZero(slab.allocateZeroed(64, 64));
+	cout << "Testing SlabAllocator integrity..." << (green ? "YES" : "NO") << endl;
+
+	FallbackAllocator<LocalStackAllocator<64>, HeapAllocator> fallback;
+	auto heapBlk = fallback.allocateZeroed(1000, 16);
+	auto alignedBlk = fallback.allocateZeroed(4000, 4096);
+	green = isZero(heapBlk) && isZero(alignedBlk);
+	fallback.deallocate(alignedBlk);
+	fallback.deallocate(heapBlk);
+	cout << "Testing HeapAllocator integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
+void TestOwnership() {
+	cout << "=== Testing ownership lookup" << endl;
+	constexpr size_t capacity = 1 << 20;
+
+	// The heap comes first and used to claim everything, so big blocks went to free()
+	using Pool = FreeListAllocator<capacity, PageAllocator, detail::FirstFitStrategy>;
+	SegregatorAllocator<64, HeapAllocator, Pool> segregator;
+	vector<Blk> blks;
+	for (int i = 0; i < 100; ++i) {
+		blks.push_back(segregator.allocate(i % 2 ? 32 : 1000, 16));
+	}
+	bool green = true;
+	for (auto& blk : blks) {
+		bool big = blk.size > 64;
+		green = green && segregator.owns(blk) && HeapAllocator().owns(blk) != big;
+		segregator.deallocate(blk);
+	}
+	cout << "Testing Segregator dispatch integrity..." << (green ? "YES" : "NO") << endl;
+
+	// An arena the heap gave memory to only registers its whole pages, the blocks in its first and last page
+	// look unclaimed. They used to go to free() too. Fill the pool, so there are blocks at both ends.
+	SegregatorAllocator<64, HeapAllocator, HeapFirstFitFreeListAllocator<capacity>> heapFirst;
+	blks.clear();
+	for (Blk blk; (blk = heapFirst.allocate(1000, 16));) {
+		blks.push_back(blk);
+		blks.push_back(heapFirst.allocate(32, 16));
+	}
+	green = blks.size() > 2;
+	for (auto& blk : blks) {
+		green = green && heapFirst.owns(blk);
+		heapFirst.deallocate(blk);
+	}
+
+	// Wrappers pass on that the heap only owns what is unclaimed
+	SegregatorAllocator<64, LockedAllocator<HeapAllocator>, FallbackAllocator<HeapFirstFitFreeListAllocator<capacity>, NullAllocator>> wrapped;
+	Blk edge = wrapped.allocate(100, 16);
+	green = green && edge && wrapped.owns(edge);
+	wrapped.deallocate(edge);
+	cout << "Testing heap-first dispatch integrity..." << (green ? "YES" : "NO") << endl;
+
+	// Arenas inside arenas hand their pages back to the outer one when they go
+	PageAllocator pages;
+	Blk outer = pages.allocate(capacity, 16);
+	Blk inner = { (char*)outer.ptr + capacity / 4, capacity / 2 };
+	int outerOwner, innerOwner;
+	{
+		detail::OwnerRegistration outerRegistration;
+		outerRegistration.assign(&outerOwner, outer.ptr, outer.size);
+		{
+			detail::OwnerRegistration innerRegistration;
+			innerRegistration.assign(&innerOwner, inner.ptr, inner.size);
+			green = detail::ownerOf(inner.ptr) == &innerOwner && detail::ownerOf(outer.ptr) == &outerOwner;
+		}
+		green = green && detail::ownerOf(inner.ptr) == &outerOwner && !pages.owns(inner);
+	}
+	green = green && detail::ownerOf(inner.ptr) == nullptr && pages.owns(inner);
+	pages.deallocate(outer);
+	cout << "Testing nested registration integrity..." << (green ? "YES" : "NO") << endl;
+
+	// Blocks freed on another thread go straight to the heap they came from
+	ThreadHeapAllocator<16, Pool> threadHeap;
+	Blk blk;
+	thread([&]() { blk = threadHeap.allocate(100, 16); }).join();
+	green = threadHeap.owns(blk);
+	threadHeap.deallocate(blk);
+	thread([&]() { green = green && threadHeap.allocate(100, 16).ptr == blk.ptr; }).join();
+	cout << "Testing ThreadHeap dispatch integrity..." << (green ? "YES" : "NO") << endl;
+	cout << endl;
+}
+
 int main() {
 	TestSTLOnVector();
 	TestSTLOnList();
 	TestFallbackLocalHeap();
 	TestStackAllocator();
 	TestLinearAllocator();
+	TestAtomicLinearAllocator();
 	TestSegregatorAllocator();
 	TestFreeListAllocator();
 	TestFreeListFirstFitAllocator();
 	TestFreeListBestFitAllocator();
+	TestCompactFreeListAllocator();
 	TestSlabAllocator();
+	TestSizeClassAllocator();
+	TestSlabCache();
+	TestBuddyAllocator();
+	TestThreadHeapAllocator();
+	TestLockedAllocator();
+	TestShardedAllocator();
+	TestEpochAllocator();
+	TestHandlePool();
+	TestProfilingAllocator();
+	TestLatencyProbeAllocator();
+	TestSmallVector();
+	TestSmallString();
+	TestObjectArena();
+	TestBufferPool();
+	TestRingAllocator();
+	TestOverAlignedAllocations();
+	TestTrim();
+	TestVirtualArenas();
+	TestSharedMemoryAllocators();
+	TestPersistentLinearAllocator();
+	TestGoodSize();
+	TestAllocateZeroed();
+	TestOwnership();
 }
\ No newline at end of file
@@ -0,0 +1,631 @@
+// Proposes a lego composition for a workload, from an allocation trace or a size histogram,
+// and writes it out as a header with a type alias:
+//
+//     g++ -std=c++17 -O2 -o lego_compose tools/compose.cpp
+//     ./lego_compose [options] trace.log > composed_allocator.h
+//
+// The input is either
+//   a trace, as LogAllocator prints it:   Allocating: 48 @ 0x55d0c3a0
+//                                         Deallocating: 48 @ 0x55d0c3a0
+//   or a histogram, one size per line:    <size> <count> [<peak live count>]
+//                                         Without the peak, all of them are taken to be live at once.
+// Lines starting with # are skipped.
+//
+// Small sizes are split into size classes of slabs. The classes are picked so that as few bytes as possible
+// are lost to rounding requests up to their class. Every slab is sized for the live objects of its class,
+// and the medium sizes share a free list arena sized the same way. What doesn't fit goes to the heap:
+//
+//   FallbackAllocator<
+//       SegregatorAllocator<biggest class, size classes, SegregatorAllocator<arena limit, free list arena, NullAllocator>>,
+//       HeapAllocator>
+//
+// HeapAllocator owns whatever no arena has claimed. Composites only give it a block that none of its siblings owns,
+// so the heap can sit anywhere, but as the last resort it's asked last anyway.
+// The header goes to stdout, and the estimates to stderr (and into the header's comment):
+//   hit rate:  how many allocations the slabs and the arena serve, without going to the heap.
+//              A trace is replayed against the composition. A histogram has no order, so it assumes the peaks are right.
+//   overhead:  bytes lost to rounding up to the size classes, and memory reserved beyond the peak of live bytes.
+//
+// Options:
+//   --name <Name>          name of the alias (ComposedAllocator)
+//   --classes <n>          most size classes to use (8)
+//   --small <bytes>        biggest size that goes to a slab (1024)
+//   --arena <bytes>        biggest size that goes to the free list arena, 0 for no arena (262144)
+//   --coverage <fraction>  share of the time the live objects must fit (1, sized for the peak). Traces only.
+//   --headroom <factor>    capacity over the live objects it's sized for (1.25)
+//   --alignment <bytes>    alignment every allocation asks for (16)
+//   --include <path>       where the generated header includes the lego headers from (lego/)
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+	struct Options {
+		std::string name = "ComposedAllocator";
+		size_t classes = 8;
+		size_t small = 1024;
+		size_t arena = 256 * 1024;
+		double coverage = 1.0;
+		double headroom = 1.25;
+		size_t alignment = 16;
+		std::string include = "lego/";
+		std::string input;
+	};
+
+	struct Event {
+		bool allocate;
+		size_t size;
+		uint64_t ptr;
+	};
+
+	struct SizeStats {
+		size_t requests = 0;
+		size_t peakLive = 0;
+	};
+
+	// What we read, either as a trace or as a histogram
+	struct Workload {
+		std::vector<Event> trace;
+		std::map<size_t, SizeStats> sizes;
+		bool isTrace = false;
+	};
+
+	struct SizeClass {
+		size_t objectSize = 0;
+		size_t requests = 0;
+		size_t peakLive = 0;
+		size_t liveTarget = 0;
+		size_t capacity = 0;
+	};
+
+	struct Estimates {
+		size_t slabHits = 0;
+		size_t arenaHits = 0;
+		size_t heapHits = 0;
+		double roundingWaste = 0;
+		double slabBytes = 0;
+		size_t peakPooledBytes = 0;
+		size_t reservedBytes = 0;
+	};
+
+	constexpr size_t pageSize = 4096;
+	constexpr size_t arenaGranularity = 64 * 1024;
+
+	size_t roundUp(size_t value, size_t alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// The class a size needs at least. SlabAllocator needs room for its free list pointer in every object.
+	size_t classSizeOf(size_t size, const Options& options) {
+		return roundUp(std::max(size, 2 * sizeof(void*)), options.alignment);
+	}
+
+	// What a block takes in the free list arena, which needs a header in front of every block
+	size_t arenaFootprint(size_t size, const Options& options) {
+		return roundUp(size, options.alignment) + options.alignment;
+	}
+
+	bool readWorkload(const std::string& path, Workload& workload) {
+		std::ifstream file(path);
+		if (!file) {
+			fprintf(stderr, "Can't open %s\n", path.c_str());
+			return false;
+		}
+
+		std::string line;
+		size_t lineNumber = 0;
+		while (std::getline(file, line)) {
+			++lineNumber;
+			if (line.empty() || line[0] == '#')
+				continue;
+
+			bool allocate = line.compare(0, 11, "Allocating:") == 0;
+			if (allocate || line.compare(0, 13, "Deallocating:") == 0) {
+				const char* text = line.c_str() + (allocate ? 11 : 13);
+				char* end;
+				Event event = { allocate, strtoull(text, &end, 10), 0 };
+				const char* at = strchr(end, '@');
+				if (at != nullptr)
+					event.ptr = strtoull(at + 1, nullptr, 16);
+
+				// Failed allocations are logged with a null pointer
+				if (event.ptr != 0)
+					workload.trace.push_back(event);
+				workload.isTrace = true;
+				continue;
+			}
+
+			std::istringstream fields(line);
+			size_t size = 0, count = 0, peakLive = 0;
+			if (!(fields >> size >> count) || size == 0) {
+				fprintf(stderr, "%s:%zu: expected a trace line or '<size> <count> [<peak live count>]'\n", path.c_str(), lineNumber);
+				return false;
+			}
+			if (!(fields >> peakLive))
+				peakLive = count;
+
+			SizeStats& stats = workload.sizes[size];
+			stats.requests += count;
+			stats.peakLive += peakLive;
+		}
+
+		if (workload.isTrace && !workload.sizes.empty()) {
+			fprintf(stderr, "%s mixes trace lines and histogram lines\n", path.c_str());
+			return false;
+		}
+
+		for (const Event& event : workload.trace) {
+			if (event.allocate)
+				++workload.sizes[event.size].requests;
+		}
+		return true;
+	}
+
+	// Splits the (rounded up) small sizes into at most 'count' classes, so that the fewest bytes are lost to rounding.
+	// A class holds a range of sizes, and takes the biggest one as its object size:
+	//     cost[i][j] = sum of requests[k] * (size[j] - size[k]) for k in i..j
+	// Best splits are found for every prefix, one class more at a time.
+	std::vector<SizeClass> pickClasses(const Workload& workload, const Options& options) {
+		std::map<size_t, size_t> requests;
+		for (const auto& size : workload.sizes) {
+			size_t classSize = classSizeOf(size.first, options);
+			if (classSize <= options.small)
+				requests[classSize] += size.second.requests;
+		}
+
+		std::vector<size_t> sizes;
+		std::vector<double> weights;
+		for (const auto& size : requests) {
+			sizes.push_back(size.first);
+			weights.push_back(static_cast<double>(size.second));
+		}
+
+		size_t n = sizes.size();
+		if (n == 0 || options.classes == 0)
+			return {};
+
+		// Prefix sums make every cost O(1)
+		std::vector<double> count(n + 1, 0), bytes(n + 1, 0);
+		for (size_t i = 0; i < n; ++i) {
+			count[i + 1] = count[i] + weights[i];
+			bytes[i + 1] = bytes[i] + weights[i] * sizes[i];
+		}
+		auto cost = [&](size_t first, size_t last) {
+			return (count[last + 1] - count[first]) * sizes[last] - (bytes[last + 1] - bytes[first]);
+		};
+
+		// best[k][j]: the least waste for sizes 0..j in k + 1 classes, and where the last class starts
+		size_t maxClasses = std::min(options.classes, n);
+		constexpr double infinity = std::numeric_limits<double>::infinity();
+		std::vector<std::vector<double>> best(maxClasses, std::vector<double>(n, infinity));
+		std::vector<std::vector<size_t>> split(maxClasses, std::vector<size_t>(n, 0));
+		for (size_t j = 0; j < n; ++j) {
+			best[0][j] = cost(0, j);
+		}
+		for (size_t k = 1; k < maxClasses; ++k) {
+			for (size_t j = k; j < n; ++j) {
+				for (size_t i = k; i <= j; ++i) {
+					double waste = best[k - 1][i - 1] + cost(i, j);
+					if (waste < best[k][j]) {
+						best[k][j] = waste;
+						split[k][j] = i;
+					}
+				}
+			}
+		}
+
+		// More classes never waste more, so take them all
+		std::vector<SizeClass> ret(maxClasses);
+		size_t last = n - 1;
+		for (size_t k = maxClasses; k-- > 0;) {
+			size_t first = k == 0 ? 0 : split[k][last];
+			ret[k].objectSize = sizes[last];
+			last = first - 1;
+		}
+		return ret;
+	}
+
+	// The class that serves 'size', or -1 if it's too big for all of them
+	int classOf(const std::vector<SizeClass>& classes, size_t size, const Options& options) {
+		size_t classSize = classSizeOf(size, options);
+		auto found = std::lower_bound(classes.begin(), classes.end(), classSize,
+			[](const SizeClass& sizeClass, size_t size) { return sizeClass.objectSize < size; });
+		return found == classes.end() ? -1 : static_cast<int>(found - classes.begin());
+	}
+
+	// The smallest count that covers the live count at the given share of the allocations
+	size_t coveringLiveCount(const std::vector<size_t>& liveCounts, size_t allocations, double coverage) {
+		size_t needed = static_cast<size_t>(std::ceil(coverage * allocations));
+		size_t covered = 0;
+		for (size_t live = 0; live < liveCounts.size(); ++live) {
+			covered += liveCounts[live];
+			if (covered >= needed)
+				return live + 1;
+		}
+		return liveCounts.size();
+	}
+
+	// Runs the trace against the classes and the arena. With 'sizing', they are taken to be endless,
+	// and the live objects they must hold are measured instead.
+	Estimates replay(const Workload& workload, std::vector<SizeClass>& classes, size_t& arenaCapacity, bool sizing, const Options& options) {
+		enum class Tier { slab, arena, heap };
+		struct Live {
+			Tier tier;
+			int sizeClass;
+			size_t size;
+		};
+
+		Estimates ret;
+		std::unordered_map<uint64_t, Live> live;
+		std::vector<size_t> liveObjects(classes.size(), 0);
+		std::vector<std::vector<size_t>> liveCounts(classes.size());
+		std::vector<size_t> arenaLiveBytes;
+		size_t arenaAllocations = 0;
+		size_t arenaLive = 0;
+		size_t pooledLive = 0;
+
+		auto release = [&](const Live& blk) {
+			if (blk.tier == Tier::slab) {
+				--liveObjects[blk.sizeClass];
+				pooledLive -= blk.size;
+			}
+			else if (blk.tier == Tier::arena) {
+				arenaLive -= arenaFootprint(blk.size, options);
+				pooledLive -= blk.size;
+			}
+		};
+
+		for (const Event& event : workload.trace) {
+			auto found = live.find(event.ptr);
+			if (!event.allocate) {
+				if (found != live.end()) {
+					release(found->second);
+					live.erase(found);
+				}
+				continue;
+			}
+
+			// A free that isn't in the trace
+			if (found != live.end())
+				release(found->second);
+
+			Live blk = { Tier::heap, classOf(classes, event.size, options), event.size };
+			if (blk.sizeClass >= 0) {
+				SizeClass& sizeClass = classes[blk.sizeClass];
+				size_t& objects = liveObjects[blk.sizeClass];
+				if (sizing) {
+					auto& counts = liveCounts[blk.sizeClass];
+					if (counts.size() <= objects)
+						counts.resize(objects + 1, 0);
+					++counts[objects];
+				}
+				if (sizing || objects < sizeClass.capacity / sizeClass.objectSize) {
+					blk.tier = Tier::slab;
+					++objects;
+					sizeClass.peakLive = std::max(sizeClass.peakLive, objects);
+					ret.roundingWaste += static_cast<double>(sizeClass.objectSize - event.size);
+					ret.slabBytes += static_cast<double>(event.size);
+				}
+			}
+			else if (event.size <= options.arena) {
+				size_t footprint = arenaFootprint(event.size, options);
+				if (sizing) {
+					++arenaAllocations;
+					arenaLiveBytes.push_back(arenaLive + footprint);
+				}
+				if (sizing || arenaLive + footprint <= arenaCapacity) {
+					blk.tier = Tier::arena;
+					arenaLive += footprint;
+				}
+			}
+
+			if (blk.tier == Tier::slab) {
+				++ret.slabHits;
+			}
+			else if (blk.tier == Tier::arena) {
+				++ret.arenaHits;
+			}
+			else {
+				++ret.heapHits;
+			}
+			if (blk.tier != Tier::heap) {
+				pooledLive += blk.size;
+				ret.peakPooledBytes = std::max(ret.peakPooledBytes, pooledLive);
+			}
+			live[event.ptr] = blk;
+		}
+
+		if (sizing) {
+			for (size_t i = 0; i < classes.size(); ++i) {
+				SizeClass& sizeClass = classes[i];
+				sizeClass.liveTarget = coveringLiveCount(liveCounts[i], sizeClass.requests, options.coverage);
+			}
+
+			// The bytes the arena must hold at the given share of its allocations
+			std::sort(arenaLiveBytes.begin(), arenaLiveBytes.end());
+			arenaCapacity = 0;
+			if (!arenaLiveBytes.empty()) {
+				size_t index = static_cast<size_t>(std::ceil(options.coverage * arenaAllocations));
+				arenaCapacity = arenaLiveBytes[std::min(std::max(index, size_t(1)), arenaLiveBytes.size()) - 1];
+			}
+		}
+		return ret;
+	}
+
+	// Without an order, every size is assumed to peak at the same time
+	Estimates estimateHistogram(const Workload& workload, std::vector<SizeClass>& classes, size_t& arenaCapacity, const Options& options) {
+		Estimates ret;
+		size_t arenaLive = 0;
+		for (const auto& entry : workload.sizes) {
+			size_t size = entry.first;
+			const SizeStats& stats = entry.second;
+			int sizeClass = classOf(classes, size, options);
+			if (sizeClass >= 0) {
+				classes[sizeClass].peakLive += stats.peakLive;
+				ret.slabHits += stats.requests;
+				ret.roundingWaste += static_cast<double>(stats.requests) * (classes[sizeClass].objectSize - size);
+				ret.slabBytes += static_cast<double>(stats.requests) * size;
+				ret.peakPooledBytes += stats.peakLive * size;
+			}
+			else if (size <= options.arena) {
+				arenaLive += stats.peakLive * arenaFootprint(size, options);
+				ret.arenaHits += stats.requests;
+				ret.peakPooledBytes += stats.peakLive * size;
+			}
+			else {
+				ret.heapHits += stats.requests;
+			}
+		}
+
+		for (SizeClass& sizeClass : classes) {
+			sizeClass.liveTarget = sizeClass.peakLive;
+		}
+		arenaCapacity = arenaLive;
+		return ret;
+	}
+
+	void sizeCapacities(std::vector<SizeClass>& classes, size_t& arenaCapacity, const Options& options) {
+		for (SizeClass& sizeClass : classes) {
+			size_t objects = static_cast<size_t>(std::ceil(sizeClass.liveTarget * options.headroom));
+			sizeClass.capacity = roundUp(std::max(objects, size_t(1)) * sizeClass.objectSize, pageSize);
+		}
+		if (arenaCapacity != 0)
+			arenaCapacity = roundUp(static_cast<size_t>(std::ceil(arenaCapacity * options.headroom)), arenaGranularity);
+	}
+
+	// A template type, printed on one line if it's short enough and nested otherwise
+	struct Type {
+		std::string name;
+		std::vector<std::string> values;
+		std::vector<Type> types;
+	};
+
+	std::string print(const Type& type, size_t indent) {
+		std::string ret = type.name;
+		if (type.values.empty() && type.types.empty())
+			return ret;
+
+		bool nested = std::any_of(type.types.begin(), type.types.end(), [](const Type& child) { return !child.types.empty(); });
+		ret += '<';
+		for (size_t i = 0; i < type.values.size(); ++i) {
+			ret += (i == 0 ? "" : ", ") + type.values[i];
+		}
+		for (size_t i = 0; i < type.types.size(); ++i) {
+			if (nested)
+				ret += (i == 0 && type.values.empty() ? "\n" : ",\n") + std::string(indent + 1, '\t');
+			else if (i != 0 || !type.values.empty())
+				ret += ", ";
+			ret += print(type.types[i], indent + 1);
+		}
+		return ret + '>';
+	}
+
+	// Segregators split the classes in halves, so finding a class takes log(classes) compares
+	Type classTree(const std::vector<SizeClass>& classes, size_t first, size_t last, const Options& options) {
+		if (first == last) {
+			const SizeClass& sizeClass = classes[first];
+			return { "HeapSizeClassAllocator",
+				{ std::to_string(sizeClass.capacity), std::to_string(sizeClass.objectSize), std::to_string(options.alignment) }, {} };
+		}
+		size_t middle = (first + last) / 2;
+		return { "SegregatorAllocator", { std::to_string(classes[middle].objectSize) },
+			{ classTree(classes, first, middle, options), classTree(classes, middle + 1, last, options) } };
+	}
+
+	Type composition(const std::vector<SizeClass>& classes, size_t arenaCapacity, const Options& options) {
+		Type heap = { "HeapAllocator", {}, {} };
+		Type big = { "NullAllocator", {}, {} };
+		if (arenaCapacity != 0) {
+			Type arena = { "HeapFirstFitFreeListAllocator", { std::to_string(arenaCapacity) }, {} };
+			big = { "SegregatorAllocator", { std::to_string(options.arena) }, { arena, big } };
+		}
+
+		Type pools = big;
+		if (!classes.empty())
+			pools = { "SegregatorAllocator", { std::to_string(classes.back().objectSize) }, { classTree(classes, 0, classes.size() - 1, options), big } };
+		if (classes.empty() && arenaCapacity == 0)
+			return heap;
+		return { "FallbackAllocator", {}, { pools, heap } };
+	}
+
+	std::string percent(size_t part, size_t total) {
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%.1f%%", total == 0 ? 0.0 : 100.0 * part / total);
+		return buffer;
+	}
+
+	std::string megabytes(size_t bytes) {
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%.2f MB", bytes / (1024.0 * 1024.0));
+		return buffer;
+	}
+
+	std::string report(const Workload& workload, const std::vector<SizeClass>& classes, size_t arenaCapacity,
+		const Estimates& estimates) {
+		size_t allocations = estimates.slabHits + estimates.arenaHits + estimates.heapHits;
+		size_t frees = std::count_if(workload.trace.begin(), workload.trace.end(), [](const Event& event) { return !event.allocate; });
+		std::ostringstream out;
+		char line[128];
+		if (workload.isTrace)
+			out << "From a trace of " << allocations << " allocations and " << frees << " frees.\n";
+		else
+			out << "From a histogram of " << allocations << " allocations.\n";
+		out << "\n";
+
+		snprintf(line, sizeof(line), "%10s %10s %12s %12s\n", "class", "requests", "sized for", "capacity");
+		out << line;
+		for (const SizeClass& sizeClass : classes) {
+			snprintf(line, sizeof(line), "%10zu %10s %12zu %12zu\n", sizeClass.objectSize,
+				percent(sizeClass.requests, allocations).c_str(), sizeClass.liveTarget, sizeClass.capacity);
+			out << line;
+		}
+		if (arenaCapacity != 0) {
+			snprintf(line, sizeof(line), "%10s %10s %12s %12zu\n", "arena", percent(estimates.arenaHits, allocations).c_str(), "", arenaCapacity);
+			out << line;
+		}
+		out << "\n";
+
+		out << "Slabs serve " << percent(estimates.slabHits, allocations) << " of the allocations, the arena "
+			<< percent(estimates.arenaHits, allocations) << " and the heap " << percent(estimates.heapHits, allocations) << ".\n";
+		snprintf(line, sizeof(line), "%.1f%%", estimates.slabBytes == 0 ? 0.0 : 100.0 * estimates.roundingWaste / estimates.slabBytes);
+		out << "Rounding up to the size classes adds " << line << " to the bytes asked from the slabs.\n";
+		out << megabytes(estimates.reservedBytes) << " reserved for a peak of " << megabytes(estimates.peakPooledBytes)
+			<< " live in the slabs and the arena.\n";
+		return out.str();
+	}
+
+	std::string includeGuard(const std::string& name) {
+		std::string ret = "__LEGO_";
+		for (size_t i = 0; i < name.size(); ++i) {
+			char c = name[i];
+			if (i != 0 && isupper(static_cast<unsigned char>(c)) && islower(static_cast<unsigned char>(name[i - 1])))
+				ret += '_';
+			ret += isalnum(static_cast<unsigned char>(c)) ? static_cast<char>(toupper(static_cast<unsigned char>(c))) : '_';
+		}
+		return ret + "_H__";
+	}
+
+	void writeHeader(const std::string& summary, const Type& type, const Options& options) {
+		std::string guard = includeGuard(options.name);
+		printf("#ifndef %s\n#define %s\n\n", guard.c_str(), guard.c_str());
+		printf("// Generated by lego_compose from %s.\n", options.input.c_str());
+		std::istringstream lines(summary);
+		std::string line;
+		while (std::getline(lines, line)) {
+			if (line.empty())
+				printf("//\n");
+			else
+				printf("// %s\n", line.c_str());
+		}
+		printf("\n");
+
+		for (const char* header : { "fallback_allocator.h", "freelist_allocator.h", "heap_allocator.h", "null_allocator.h", "segregator_allocator.h", "slab_allocator.h" }) {
+			printf("#include \"%s%s\"\n", options.include.c_str(), header);
+		}
+		printf("\nnamespace lego {\n\tusing %s = %s;\n}\n\n#endif\n", options.name.c_str(), print(type, 1).c_str());
+	}
+
+	bool parseOptions(int argc, char** argv, Options& options) {
+		for (int i = 1; i < argc; ++i) {
+			std::string option = argv[i];
+			if (option.compare(0, 2, "--") != 0) {
+				options.input = option;
+				continue;
+			}
+			if (i + 1 == argc) {
+				fprintf(stderr, "%s needs a value\n", option.c_str());
+				return false;
+			}
+
+			const char* value = argv[++i];
+			if (option == "--name")
+				options.name = value;
+			else if (option == "--classes")
+				options.classes = strtoull(value, nullptr, 10);
+			else if (option == "--small")
+				options.small = strtoull(value, nullptr, 10);
+			else if (option == "--arena")
+				options.arena = strtoull(value, nullptr, 10);
+			else if (option == "--coverage")
+				options.coverage = strtod(value, nullptr);
+			else if (option == "--headroom")
+				options.headroom = strtod(value, nullptr);
+			else if (option == "--alignment")
+				options.alignment = strtoull(value, nullptr, 10);
+			else if (option == "--include")
+				options.include = value;
+			else {
+				fprintf(stderr, "Unknown option %s\n", option.c_str());
+				return false;
+			}
+		}
+
+		if (options.input.empty()) {
+			fprintf(stderr, "usage: lego_compose [options] <trace or histogram>\n");
+			return false;
+		}
+		if (options.alignment == 0 || (options.alignment & (options.alignment - 1)) != 0) {
+			fprintf(stderr, "--alignment must be a power of 2\n");
+			return false;
+		}
+		if (options.coverage <= 0 || options.coverage > 1 || options.headroom < 1) {
+			fprintf(stderr, "--coverage must be in (0, 1] and --headroom at least 1\n");
+			return false;
+		}
+		return true;
+	}
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parseOptions(argc, argv, options))
+		return 1;
+
+	Workload workload;
+	if (!readWorkload(options.input, workload))
+		return 1;
+
+	std::vector<SizeClass> classes = pickClasses(workload, options);
+	for (const auto& entry : workload.sizes) {
+		int sizeClass = classOf(classes, entry.first, options);
+		if (sizeClass >= 0)
+			classes[sizeClass].requests += entry.second.requests;
+	}
+
+	// A trace is run twice: once to measure what the slabs and the arena must hold, and once against what we picked
+	size_t arenaCapacity = 0;
+	Estimates estimates;
+	if (workload.isTrace) {
+		replay(workload, classes, arenaCapacity, true, options);
+		sizeCapacities(classes, arenaCapacity, options);
+		for (SizeClass& sizeClass : classes) {
+			sizeClass.peakLive = 0;
+		}
+		estimates = replay(workload, classes, arenaCapacity, false, options);
+	}
+	else {
+		estimates = estimateHistogram(workload, classes, arenaCapacity, options);
+		sizeCapacities(classes, arenaCapacity, options);
+	}
+
+	estimates.reservedBytes = arenaCapacity;
+	for (const SizeClass& sizeClass : classes) {
+		estimates.reservedBytes += sizeClass.capacity;
+	}
+
+	std::string summary = report(workload, classes, arenaCapacity, estimates);
+	fputs(summary.c_str(), stderr);
+	writeHeader(summary, composition(classes, arenaCapacity, options), options);
+	return 0;
+}